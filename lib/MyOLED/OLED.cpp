@@ -11,6 +11,16 @@ void OLED::command (unsigned char c)
 
 void OLED::data (unsigned char d)
 {
+  if (cursor < kCells)
+    {
+      if (shadow[cursor] != (char)d)
+        {
+          shadow[cursor] = d;
+          changes[cursor >> 3] |= 1 << (cursor & 7);
+        }
+      // Past the end of a line the display writes off screen
+      cursor = (cursor % kCols == kCols - 1) ? kCells : cursor + 1;
+    }
 
   tx_packet[0] = 0x40;
   tx_packet[1] = d;
@@ -68,21 +78,43 @@ void OLED::init ()
 	command(0x80);  //set DDRAM address to 0x00
 	command(0x0C);  //display ON
   delay(100);
+  forget();
 }
 
   // Set the character insertion address at the given line and character
 void OLED::set_point (unsigned char line, unsigned char pos)
 {
   command((line * 0x20 + pos) | (1 << 7));
+  cursor = (line < kRows && pos < kCols) ? line * kCols + pos : kCells;
 }
 
 // Write the given string (Writes a max of 20 characters)
+// Characters the display already shows are skipped (each one sent is
+// an I2C transaction), moving the address past them when one needs
+// sending
 void OLED::write (const char * str)
 {
   unsigned char count = 0;
+  bool skipped = false;
   while(*str != '\0' && count < 20)
     {
-      data(*str);
+      if (cursor < kCells && shadow[cursor] == *str)
+        {
+          cursor = (cursor % kCols == kCols - 1) ? kCells : cursor + 1;
+          skipped = true;
+        }
+      else
+        {
+          if (skipped)
+            {
+              // The rest would be off the end of the line
+              if (cursor >= kCells)
+                return;
+              set_point(cursor / kCols, cursor % kCols);
+              skipped = false;
+            }
+          data(*str);
+        }
       count ++;
       str ++;
     }
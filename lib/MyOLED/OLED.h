@@ -3,12 +3,19 @@
 #include "Wire.h"
 #include "Arduino.h"
 
+// A copy of the characters on the display is kept, with a bit per cell
+// set when it changes, so the screen can be mirrored elsewhere.
 class OLED {
 
  public:
+  static const unsigned char kRows = 4;
+  static const unsigned char kCols = 20;
+  static const unsigned char kCells = kRows * kCols;
+
   OLED (int i2c_address = 0x3C){
     // 0x3C or 0x78 are usual addresses
     slave2w = i2c_address;
+    forget();
   }
   
   // Start up the display on I2C
@@ -22,20 +29,57 @@ class OLED {
 
   // Clear display - Note, I think it is advantageous to pause after this command before writing anything else
   void clear () 
-  { command (0x01); delay(10); }
+  { command (0x01); forget(); mClears ++; delay(10); }
+
+  // Count of clear()s, so drawing that is kept can tell it was wiped
+  unsigned char clears () const
+  { return mClears; }
 
   // Set the character insertion address at the given line and character
   void set_point (unsigned char line, unsigned char pos);
 
   // Write the given string (Writes a max of 20 characters)
   void write (const char * str);
+
+  // Character in a cell (row * kCols + column)
+  char cell (unsigned char i) const
+  { return shadow[i]; }
+
+  // Changed since clean()?
+  bool changed (unsigned char i) const
+  { return changes[i >> 3] & (1 << (i & 7)); }
+
+  // Changed bits for cells 8 * i to 8 * i + 7
+  unsigned char changed_byte (unsigned char i) const
+  { return changes[i]; }
+
+  void clean (unsigned char i)
+  { changes[i >> 3] &= ~(1 << (i & 7)); }
+
+  // Everything counts as changed (for a full copy)
+  void mark_all ()
+  { memset(changes, 0xFF, sizeof(changes)); }
   
  private:
+  // Blank the copy, as clear() blanks the display
+  void forget ()
+  {
+    memset(shadow, ' ', sizeof(shadow));
+    mark_all();
+    cursor = 0;
+  }
+
   // Send a raw packet
   void send_packet();
 
   // I2C address
   unsigned char slave2w;
   unsigned char tx_packet[2] = {0x00, 0x00};
+
+  // What the display shows, and where the next character goes
+  char shadow[kCells];
+  unsigned char changes[kCells / 8];
+  unsigned char cursor;
+  unsigned char mClears = 0;
   
 };
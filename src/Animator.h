@@ -0,0 +1,262 @@
+#pragma once
+
+#include <limits.h>
+#include "Compositor.h"
+#include "Curves.h"
+
+// Frame period for animations (50 fps)
+const unsigned int kFramePeriod = 20;
+
+// Time allowed for compositing in one frame. Sending the frame to the
+// LEDs adds ~4.3 ms, which leaves over half of each period for the
+// buttons and the OLED.
+const unsigned long kFrameBudgetUs = 3000;
+
+// Tick-aligned frames: how long before a second edge a window builds
+// the frame for it, and how long before the edge the loop stops
+// drawing the OLED so it is free to send the frame on time
+const unsigned int kPrerenderMs = 60;
+const unsigned int kEdgeGuardMs = 25;
+
+// Busy-wait for an edge closer than this rather than come back later
+const long kEdgeSpinUs = 2000;
+
+
+/*
+ * A colour that changes with time: a one shot ramp from one colour to
+ * another, or a repeating pulse or breath between them. The position
+ * in the cycle comes from the clock, not a frame count, so a dropped
+ * frame never slows an effect down.
+ */
+struct Effect
+{
+  Effect ():
+    shape(k_curve_linear), from(0, 0, 0), to(0, 0, 0), period(1), repeat(false)
+  {}
+
+  Effect (curve_t shape, CRGB from, CRGB to, unsigned int period, bool repeat = true):
+    shape(shape), from(from), to(to), period(period ? period : 1), repeat(repeat)
+  {}
+
+  bool operator== (const Effect & o) const
+  {
+    return shape == o.shape && from == o.from && to == o.to
+      && period == o.period && repeat == o.repeat;
+  }
+
+  // Colour at the given time since the effect started
+  CRGB value (unsigned long t) const
+  {
+    fix8_8 phase;
+    if (repeat)
+      phase = ((uint32_t)(t % period) << 8) / period;
+    else if (t >= period)
+      phase = kFixOne;
+    else
+      phase = ((uint32_t)t << 8) / period;
+    return blend_colour(from, to, curve(shape, phase));
+  }
+
+  curve_t shape;
+  CRGB from;
+  CRGB to;
+  unsigned int period;  // ms per cycle, or length of a ramp
+  bool repeat;
+};
+
+
+/*
+ * Paces LED frames. frame() is called every loop, but only does
+ * anything every kFramePeriod: it moves glyph transitions and effects
+ * on by the time that has really passed and hands the result to the
+ * compositor. A late frame is never made up, just skipped.
+ *
+ * A frame for a known instant (the next second edge) is built early
+ * with arm(). Paced frames stop until it has gone, and when the edge
+ * is near frame() spins on micros() and sends it, so the digits change
+ * within a fraction of a ms of the edge whatever else the loop is
+ * doing. The lateness of the first bit is kept for the stats.
+ */
+class Animator
+{
+public:
+  Animator (Compositor * face):
+    mFace(face)
+  {}
+
+  // Tint the lit pixels of the digits in the mask with an effect. Safe
+  // to call every draw: the same effect carries on where it was.
+  void set_overlay (const Effect & effect, byte mask = Compositor::kAllDigits)
+  {
+    if (mOverlayOn && effect == mOverlay && mask == mOverlayMask)
+      return;
+    mOverlay = effect;
+    mOverlayMask = mask;
+    mOverlayOn = true;
+    mOverlayStart = millis();
+  }
+
+  void clear_overlay ()
+  {
+    mOverlayOn = false;
+    mFace->clear_overlay();
+  }
+
+  // Frame period in ms. Windows that need more than kFramePeriod
+  // (e.g. the running stopwatch) raise the rate while showing.
+  void set_frame_period (unsigned char ms)
+  {
+    mPeriod = ms;
+  }
+
+  unsigned char frame_period () const
+  {
+    return mPeriod;
+  }
+
+  // Build the frame for the layers as they are now and hold it for
+  // edge_us (a micros() time). With rtc_edge, and RTC_SQW_PIN wired,
+  // the frame waits for the RTC's own second edge instead.
+  void arm (unsigned long edge_us, bool rtc_edge = false)
+  {
+    mFace->prerender(mPeriod);
+    mEdgeUs = edge_us;
+    mRtcEdge = rtc_edge;
+  }
+
+  bool armed () const
+  {
+    return mFace->armed();
+  }
+
+  // A held frame is due within ms
+  bool edge_within (unsigned int ms) const
+  {
+    return armed() && (long)(mEdgeUs - micros()) < (long)ms * 1000;
+  }
+
+  // Run a frame if one is due
+  void frame ()
+  {
+    if (armed())
+      {
+        fire_if_due();
+        return;
+      }
+
+    unsigned long now = millis();
+    unsigned int dt = now - mLastFrame;
+    if (dt < mPeriod)
+      return;
+    mLastFrame = now;
+
+    unsigned long start = micros();
+
+    mFace->advance(dt);
+    if (mOverlayOn)
+      mFace->set_overlay(Compositor::k_blend_tint, mOverlay.value(now - mOverlayStart), mOverlayMask);
+
+    if (mFace->present(kFrameBudgetUs))
+      {
+        unsigned long took = micros() - start;
+        if (took > mWorstUs)
+          mWorstUs = took;
+        mFrames ++;
+      }
+
+    // Frames sent in the last second
+    if (now - mStatsStart >= 1000)
+      {
+        mFps = mFrames;
+        mFrames = 0;
+        mStatsStart = now;
+      }
+  }
+
+  // LED frames sent in the last second
+  unsigned int fps () const
+  { return mFps; }
+
+  // Longest frame (compositing and sending) since the last reset, in us
+  unsigned long worst_us () const
+  { return mWorstUs; }
+
+  // How late the first bit of held frames was after their edge (us),
+  // least and most since the last reset. The spread is the jitter.
+  long edge_late_min () const
+  { return mLateMin; }
+
+  long edge_late_max () const
+  { return mLateMax; }
+
+  void reset_stats ()
+  {
+    mWorstUs = 0;
+    mLateMin = LONG_MAX;
+    mLateMax = LONG_MIN;
+  }
+
+private:
+  Compositor * mFace;
+
+  unsigned char mPeriod = kFramePeriod;
+  unsigned long mLastFrame = 0;
+
+  Effect mOverlay;
+  byte mOverlayMask = 0;
+  bool mOverlayOn = false;
+  unsigned long mOverlayStart = 0;
+
+  unsigned long mStatsStart = 0;
+  unsigned int mFrames = 0;
+  unsigned int mFps = 0;
+  unsigned long mWorstUs = 0;
+
+  // Held frame
+  unsigned long mEdgeUs = 0;
+  bool mRtcEdge = false;
+  unsigned long mSetupUs = 0;   // from fire() to the first bit
+  long mLateMin = LONG_MAX;
+  long mLateMax = LONG_MIN;
+
+  void fire_if_due ()
+  {
+    if ((long)(mEdgeUs - micros()) > kEdgeSpinUs)
+      return;
+
+#ifdef RTC_SQW_PIN
+    if (mRtcEdge)
+      {
+        // The seconds register moves on the falling edge of SQW. Give
+        // up on it well past the predicted edge.
+        while (digitalRead(RTC_SQW_PIN) == HIGH
+               && (long)(micros() - mEdgeUs) < 20000)
+          ;
+        mEdgeUs = micros();
+      }
+    else
+#endif
+      {
+        // Start early by the time show() takes to get to the first bit
+        while ((long)(micros() - (mEdgeUs - mSetupUs)) < 0)
+          ;
+      }
+
+    unsigned long fired = micros();
+    mFace->fire();
+    unsigned long first = mFace->first_bit_us();
+    if (!mRtcEdge)
+      mSetupUs = first - fired;
+
+    long late = first - mEdgeUs;
+    if (late < mLateMin)
+      mLateMin = late;
+    if (late > mLateMax)
+      mLateMax = late;
+
+    mLastFrame = millis();
+    mFrames ++;
+  }
+};
+
+extern Animator animator;
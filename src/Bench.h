@@ -0,0 +1,165 @@
+#pragma once
+
+#include <Arduino.h>
+#include "Timers.h"
+#include "ClockFace.h"
+#include "OLED.h"
+#include "RTClib.h"
+#include "Calendar.h"
+
+/*
+ * Micro benchmarks, run on the clock itself and reported over serial.
+ */
+
+// Each rate is measured over this long
+const unsigned int kBenchMs = 1000;
+
+// What the wires allow, to compare units against: 30 us per LED pixel,
+// and I2C at Wire's 100 kHz, 9 bits a byte. A full OLED screen is 80
+// characters and 4 addresses, each a 3 byte transaction (address,
+// control, data); rtc.now() is 2 bytes out and 8 back.
+const unsigned int kOLEDScreenBytes = (80 + 4) * 3;
+const unsigned int kLEDShowRate = 1000000UL / (kNumLEDs * 30UL);
+const unsigned int kOLEDScreenRate = 100000UL / 9 / kOLEDScreenBytes;
+const unsigned int kRTCReadRate = 100000UL / 9 / 10;
+
+// Calls of op per second, saturating at 65535
+unsigned int bench_rate (void (* op) (void *), void * arg)
+{
+  unsigned long n = 0;
+  unsigned long start = micros();
+  unsigned long took;
+  do
+    {
+      op(arg);
+      n ++;
+      took = micros() - start;
+    }
+  while (took < kBenchMs * 1000UL);
+
+  unsigned long rate = n * 1000 / (took / 1000);
+  return rate > 0xFFFF ? 0xFFFF : rate;
+}
+
+// Full LED frames, palette scaling and all
+void bench_led_op (void * leds)
+{
+  ((LEDBuffer *)leds)->show();
+}
+
+// One digit drawn, alternating between 8 and 1 across the digits
+void bench_segment_op (void * leds)
+{
+  static unsigned char n = 0;
+  n ++;
+  set_segment_display((LEDBuffer *)leds, kDigitStart[n % kNumDigits],
+                      (n & 1) ? 0x7F : 0x30, CRGB(255, 0, 0));
+}
+
+// The whole OLED, every character changed from the last time
+void bench_oled_op (void * display)
+{
+  static char c = 'A';
+  char row[OLED::kCols + 1];
+  c = (c == 'A') ? 'B' : 'A';
+  memset(row, c, OLED::kCols);
+  row[OLED::kCols] = 0;
+  for (unsigned char i = 0; i < OLED::kRows; ++i)
+    {
+      ((OLED *)display)->set_point(i, 0);
+      ((OLED *)display)->write(row);
+    }
+}
+
+void bench_rtc_op (void * rtc)
+{
+  ((RTC_DS1307 *)rtc)->now();
+}
+
+// Unix seconds to date and time fields and back, moving on by an hour
+// less a second each time so every field changes: Calendar.h, then
+// RTClib's DateTime
+void bench_civil_op (void * secs)
+{
+  CivilTime t;
+  from_epoch(*(epoch_t *)secs, &t);
+  *(epoch_t *)secs = to_epoch(t) + 3599;
+}
+
+void bench_datetime_op (void * secs)
+{
+  DateTime t (*(uint32_t *)secs);
+  *(uint32_t *)secs = t.unixtime() + 3599;
+}
+
+// One line of results: name, rate, and as a percentage of what the
+// wires allow (if nominal isn't 0)
+void bench_report (const char * name, unsigned int rate, unsigned int nominal = 0)
+{
+  Serial.print("bench ");
+  Serial.print(name);
+  Serial.print(' ');
+  Serial.print(rate);
+  Serial.print(" /s");
+  if (nominal)
+    {
+      Serial.print(' ');
+      Serial.print((unsigned long)rate * 100 / nominal);
+      Serial.print('%');
+    }
+  Serial.println();
+}
+
+// Cost of one TimerWheel tick with n countdowns running, on a bank the
+// size of the clock's (about 100 bytes of stack)
+void bench_wheel (unsigned char n)
+{
+  const unsigned int kTicks = 64;
+  TimerBank wheel;
+
+  // Spread the deadlines out, and well past the end of the run, so
+  // every tick walks a realistic slot without anything leaving
+  for (unsigned char i = 0; i < n; ++i)
+    {
+      unsigned char id = wheel.add(TimerBank::k_countdown, 600 + i * 37);
+      wheel.start(id);
+    }
+
+  unsigned long t = (timebase.now() / 1000 + 1) * 1000;
+  unsigned long worst = 0;
+  unsigned long start = micros();
+  for (unsigned int i = 0; i < kTicks; ++i, t += 1000)
+    {
+      unsigned long s = micros();
+      wheel.tick(t);
+      unsigned long took = micros() - s;
+      if (took > worst)
+        worst = took;
+    }
+  unsigned long total = micros() - start;
+
+  Serial.print("wheel ");
+  Serial.print(n);
+  Serial.print(" timers: ");
+  Serial.print(total / kTicks);
+  Serial.print(" us/tick, worst ");
+  Serial.print(worst);
+  Serial.println(" us");
+}
+
+void bench_timers ()
+{
+  bench_wheel(1);
+  bench_wheel(kNumTimers / 2);
+  bench_wheel(kNumTimers);
+}
+
+// Calendar conversions per second, each way and back
+void bench_calendar ()
+{
+  const uint32_t kStart = 1577836800UL;     // 2020-01-01
+  uint32_t secs = kStart;
+  bench_report("calendar", bench_rate(&bench_civil_op, &secs));
+  secs = kStart;
+  bench_report("DateTime", bench_rate(&bench_datetime_op, &secs));
+}
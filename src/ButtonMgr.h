@@ -1,153 +1,196 @@
 #pragma once
 
 #include <Arduino.h>
+#include "HAL.h"
+#include "TimeBase.h"
+#include "Trace.h"
 
-// Minimum button press time to check for change
-#define DEBOUNCE_TIME 15
+// Buttons are sampled every kScanMs, and a change counts once it has
+// read the same for 4 samples in a row (16 ms). Both this and the hold
+// time can be changed at run time (set_debounce_ms(), set_hold_ms()).
+const unsigned char kScanMs = 4;
 
-// Time till hold event emitted for PressHoldMgr
+// Time till hold event emitted for k_btn_press_hold buttons
 #define HOLD_TIME 600
 
+// Auto-repeat of k_btn_repeat buttons: the first repeat comes this
+// long after the press, and each one after that kRepeatStepMs sooner,
+// down to one a scan
+const unsigned int kRepeatStartMs = 284;
+const unsigned int kRepeatStepMs = 16;
+
 // Button Logic levels
 #define PRESSED LOW
 #define RELEASED HIGH
 
 
-class ButtonMgr
+/*
+ * All the buttons, read a whole port at a time (BTN_PORTS() in HAL.h)
+ * and debounced together.
+ *
+ * Each scan debounces every pin at once with vertical counters: two
+ * bit vectors hold a 2 bit counter per pin, counting the samples that
+ * differ from the debounced state. Four in a row and the pin toggles;
+ * one agreeing sample and its counter starts again. Press and release
+ * fall out as the toggled bits that are now pressed and not.
+ *
+ * A scan where no button is pressed, bouncing or changing costs the
+ * same however many buttons there are. Only the buttons that are busy
+ * are looked at one by one, to time holds and repeats.
+ */
+template <unsigned char N>
+class ButtonScanner
 {
 public:
-
- ButtonMgr(int btn_pin, void (* callback) (), bool multi_press = false):
-  mPin(btn_pin),
-    mMulti (multi_press)
-    {
-      mCallback = callback;
-    }
-  
-  void init () {
-    mLastState = digitalRead(mPin);  
-  }
-
-  virtual void check_button()
+  typedef enum {
+    k_btn_press,        // callback on press
+    k_btn_repeat,       // callback on press, then repeating faster while held
+    k_btn_press_hold    // callback on a tap (on release), hold callback on a hold
+  } mode_t;
+
+  // Add the button on pin (a bit of BTN_PORTS())
+  void add (byte pin, mode_t mode, void (* callback) (), void (* hold_callback) () = nullptr)
   {
-    bool new_state = digitalRead(mPin);
-    if(new_state == mLastState && mWaitTime == 0)
-      // We are not waiting, and there has been no change
+    if (mCount == N)
       return;
+    Button & b = mButtons[mCount++];
+    b.mask = (uint16_t)1 << pin;
+    b.mode = mode;
+    b.callback = callback;
+    b.hold_callback = hold_callback;
+    mMask |= b.mask;
+  }
 
-    if(new_state == mLastState && new_state == PRESSED && (signed long)(millis() - mWaitTime) > DEBOUNCE_TIME)
-      {
-	// We have waited
-	mCallback();
-	mNumCalls ++;
-
-	if(mMulti)
-	  {
-	    // Decrease wait each time (hold accelerates presses)
-	    int offset =  300 - (mNumCalls << 4);
-	    if (offset < 0) offset = 0;
-	    
-	    mWaitTime = millis() + offset; // wait for press in future
-	  }
-	else
-	  mWaitTime = 0; // Signal no longer waiting
-
-	return;
-      }
+  // A change counts once it has lasted this long (4 scans)
+  void set_debounce_ms (unsigned int ms)
+  {
+    mScanMs = ms >= 8 ? ms / 4 : 2;
+  }
 
-    if(new_state != mLastState)
-      {
-	mLastState = new_state;
-	
-	if(new_state == PRESSED)
-	  mWaitTime = millis();
-	else
-	  mWaitTime  = 0;
-	
-	mNumCalls = 0;
-      }
+  void set_hold_ms (unsigned int ms)
+  {
+    mHoldMs = ms;
   }
 
+  // Take the buttons as they are now as the starting state
+  void init ()
+  {
+    mState = ~trace.read(BTN_PORTS() | ~mMask) & mMask;
+    mCnt0 = mCnt1 = mDelta = 0;
+    mLastScan = millis();
+  }
 
-protected:
-  // Am I waiting for debounce test
-  unsigned long mWaitTime;
-  // Last known state of the button
-  bool mLastState;
-  
-  // Callback function on button press
-  void (* mCallback) ();
+  // Called every loop: samples the buttons when a scan is due
+  void scan ()
+  {
+    unsigned long now = millis();
+    if (now - mLastScan < mScanMs)
+      return;
+    // Keep to the tick, unless the loop has fallen well behind it
+    mLastScan = (now - mLastScan < 2u * mScanMs) ? mLastScan + mScanMs : now;
 
-  // IO pin of button
-  int mPin;
+    // Bit set for each button held down (PRESSED is low)
+    uint16_t down = ~trace.read(BTN_PORTS() | ~mMask) & mMask;
 
-  // Should we make multiple calls if the button is held
-  bool mMulti;
+    uint16_t delta = down ^ mState;
+    uint16_t fresh = delta & ~mDelta;
+    mCnt1 = (mCnt1 ^ mCnt0) & delta;
+    mCnt0 = ~mCnt0 & delta;
+    uint16_t toggle = delta & ~(mCnt0 | mCnt1);
+    mState ^= toggle;
+    mDelta = delta;
 
-  // Number of callbacks for this button press
-  unsigned int mNumCalls;
-};
+    if (!(mState | delta))
+      return;
+    for (unsigned char i = 0; i < mCount; ++i)
+      if ((mState | delta) & mButtons[i].mask)
+        update(mButtons[i], fresh, toggle);
+  }
 
+  // Bit per pin: held down, after debouncing
+  uint16_t pressed () const
+  {
+    return mState;
+  }
 
+private:
+  struct Button
+  {
+    uint16_t mask;
+    mode_t mode;
+    void (* callback) ();
+    void (* hold_callback) ();
+
+    unsigned long press_us;   // first sign of the press
+    uint16_t ticks;           // scans since the press
+    uint16_t next;            // scan of the next repeat
+    byte calls;               // callbacks made for this press
+  };
+
+  Button mButtons[N];
+  unsigned char mCount = 0;
+  uint16_t mMask = 0;
+
+  // Debounced state, vertical counters, and the pins that differed
+  // from the state last scan
+  uint16_t mState = 0;
+  uint16_t mCnt0 = 0;
+  uint16_t mCnt1 = 0;
+  uint16_t mDelta = 0;
+
+  unsigned long mLastScan = 0;
+  unsigned char mScanMs = kScanMs;
+  unsigned int mHoldMs = HOLD_TIME;
+
+  void update (Button & b, uint16_t fresh, uint16_t toggle)
+  {
+    // Time a press from its first edge, not from when it settled
+    if (fresh & b.mask & ~mState)
+      b.press_us = micros();
 
-class PressHoldMgr: public ButtonMgr
-{
-public:
+    if (toggle & b.mask)
+      {
+        if (mState & b.mask)
+          {
+            b.ticks = 0;
+            b.calls = 0;
+            if (b.mode != k_btn_press_hold)
+              {
+                fire(b.callback, b.press_us);
+                b.calls = 1;
+                b.next = kRepeatStartMs / mScanMs;
+              }
+          }
+        else if (b.mode == k_btn_press_hold && b.calls == 0)
+          // A tap: released before it became a hold
+          fire(b.callback, b.press_us);
+        return;
+      }
 
-  PressHoldMgr (int pin_num, void (* callback)(), void (* hold_callback)()):
-    ButtonMgr(pin_num, callback, false),
-    mCallOnRelease(false)
-  {mHoldCallback = hold_callback;}
- 
-  virtual void check_button ()
-    {
-    bool new_state = digitalRead(mPin);
-    
-    if(new_state == RELEASED && mLastState == RELEASED)
-      // Button not pressed
+    if (!(mState & b.mask))
       return;
-    
-    if(new_state == mLastState && new_state == PRESSED && millis() - mWaitTime > HOLD_TIME && mNumCalls == 0)
-      {
-	// We have waited so long that this is a hold event, and this hasn't been called before
-	mHoldCallback();
-	mNumCalls ++;
+    b.ticks ++;
 
-        mWaitTime = 0; // Signal no longer waiting
-        mCallOnRelease = false;
-	return;
-      }
-    else if (new_state == mLastState && new_state == PRESSED && millis() - mWaitTime > DEBOUNCE_TIME && mNumCalls == 0)
+    if (b.mode == k_btn_press_hold && b.calls == 0 && b.ticks >= mHoldMs / mScanMs)
       {
-        // Waited for debounce, and we haven't already called the hold function
-        mCallOnRelease = true;
-        return;
+        fire(b.hold_callback, b.press_us);
+        b.calls = 1;
       }
-
-    // Handle changes
-    if(new_state != mLastState)
+    else if (b.mode == k_btn_repeat && b.ticks >= b.next)
       {
-	mLastState = new_state;
-	
-	if(new_state == PRESSED)
-	  mWaitTime = millis();
-	else
-          {
-	  mWaitTime = 0;
-          if(mCallOnRelease)
-            mCallback();
-          mCallOnRelease = false;
-          }
-	
-	mNumCalls = 0;
+        fire(b.callback, micros());
+        b.calls ++;
+        // Decrease wait each time (hold accelerates presses)
+        int wait = (int)kRepeatStartMs - (int)kRepeatStepMs * (b.calls - 1);
+        b.next = b.ticks + (wait > mScanMs ? wait / mScanMs : 1);
       }
   }
 
-private:
-  // Callback for hold
-  void (* mHoldCallback) ();
-
-  // Will we make a call on button release? (i.e. have we not held too long)
-  bool mCallOnRelease;
-
+  static void fire (void (* callback) (), unsigned long input_us)
+  {
+    if (!callback)
+      return;
+    timebase.stamp_input(input_us);
+    callback();
+  }
 };
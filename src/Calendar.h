@@ -0,0 +1,148 @@
+#pragma once
+
+#include <Arduino.h>
+
+/*
+ * Calendar time as one number: seconds since 1970-01-01 00:00:00
+ * (Unix time, which is what the sync host sends), and the date and
+ * time fields worked out from it, and back, without loops.
+ *
+ * Between 1968-03-01 and 2100-02-28 every fourth year is a leap year
+ * with no exceptions, so a date is a whole number of 4 year cycles
+ * (1461 days) and a day into one. Counting years from March puts the
+ * leap day last, and the months from March have lengths that a
+ * (153 * month + 2) / 5 formula gives exactly. All the date sums fit
+ * 16 bits. The time of day is split with multiplies and shifts rather
+ * than divides. The range covers the DS1307's years (2000-2099).
+ *
+ * RTClib's DateTime counts through the years and months instead; the
+ * 't' command compares the two (bench_calendar() in Bench.h).
+ */
+
+// Seconds since 1970-01-01 00:00:00
+typedef uint32_t epoch_t;
+
+struct CivilTime
+{
+  uint16_t year;
+  byte month;     // 1-12
+  byte day;       // 1-31
+  byte hour;
+  byte minute;
+  byte second;
+};
+
+// The fields a clock window edits, in the order it steps through them
+typedef enum {
+  k_edit_none, k_edit_day, k_edit_month, k_edit_year,
+  k_edit_hr, k_edit_min, k_edit_sec
+} time_edit_t;
+
+// 1968-03-01 to 1970-01-01
+const uint16_t kCalendarOffset = 671;
+
+// The times the RTC can hold: 2000-01-01 00:00:00 to 2099-12-31 23:59:59
+const epoch_t kEpochFirst = 946684800UL;
+const epoch_t kEpochLast = 4102444799UL;
+
+inline bool is_leap_year (uint16_t year)
+{
+  return (year & 3) == 0 && year != 2100;
+}
+
+inline byte days_in_month (uint16_t year, byte month)
+{
+  if (month == 2)
+    return is_leap_year(year) ? 29 : 28;
+  // 31 days, less 1 for April, June, September and November
+  return 30 + ((month + (month >> 3)) & 1);
+}
+
+// Days since 1970-01-01
+inline uint16_t days_from_civil (uint16_t year, byte month, byte day)
+{
+  // Years and months from March 1968
+  uint16_t y = year - 1968 - (month <= 2);
+  byte m = month > 2 ? month - 3 : month + 9;
+  uint16_t doy = (153 * m + 2) / 5 + day - 1;
+  return y * 365 + (y >> 2) + doy - kCalendarOffset;
+}
+
+// The date from days since 1970-01-01 (leaves the time alone)
+inline void civil_from_days (uint16_t days, CivilTime * t)
+{
+  uint16_t d = days + kCalendarOffset;
+  uint16_t cycle = d / 1461;
+  uint16_t r = d - cycle * 1461;
+  // Year of the cycle: the leap day (r = 1460) is still year 3
+  byte y = (r - (r == 1460)) / 365;
+  uint16_t doy = r - y * 365;
+  byte m = (5 * doy + 2) / 153;
+  t->day = doy - (153 * m + 2) / 5 + 1;
+  t->month = m < 10 ? m + 3 : m - 9;
+  t->year = 1968 + cycle * 4 + y + (t->month <= 2);
+}
+
+inline epoch_t to_epoch (const CivilTime & t)
+{
+  uint16_t mod = t.hour * 60 + t.minute;
+  return days_from_civil(t.year, t.month, t.day) * 86400UL
+    + mod * 60UL + t.second;
+}
+
+inline void from_epoch (epoch_t secs, CivilTime * t)
+{
+  uint16_t days = secs / 86400UL;
+  uint32_t sod = secs - days * 86400UL;
+  // Minute of the day, sod / 60: (sod / 4) / 15, as a multiply
+  uint16_t mod = ((sod >> 2) * 17477UL) >> 18;
+  uint16_t hour = (mod * 1093UL) >> 16;           // mod / 60
+  t->second = sod - mod * 60UL;
+  t->minute = mod - hour * 60;
+  t->hour = hour;
+  civil_from_days(days, t);
+}
+
+// Sunday is 0 (1970-01-01 was a Thursday)
+inline byte day_of_week (epoch_t secs)
+{
+  return ((uint16_t)(secs / 86400UL) + 4) % 7;
+}
+
+// Months on (or back, for negative n), keeping the time of day. The
+// day is held to the length of the new month (31 March less a month
+// is 28 or 29 February). Kept within 2000-2099.
+inline epoch_t add_months (epoch_t secs, int n)
+{
+  CivilTime t;
+  from_epoch(secs, &t);
+  int months = (int)(t.year - 2000) * 12 + (t.month - 1) + n;
+  months = constrain(months, 0, (2099 - 2000) * 12 + 11);
+  t.year = 2000 + months / 12;
+  t.month = months % 12 + 1;
+  t.day = min(t.day, days_in_month(t.year, t.month));
+  return to_epoch(t);
+}
+
+// A clock window's edit: steps of the field being edited. Days, hours,
+// minutes and seconds carry into the fields above; months and years
+// are calendar months and years. The result stays within the RTC's
+// range (kEpochFirst to kEpochLast).
+inline epoch_t step_field (epoch_t secs, byte field, int steps)
+{
+  long by;
+  switch (field)
+    {
+    case k_edit_day:   by = steps * 86400L; break;
+    case k_edit_month: return add_months(secs, steps);
+    case k_edit_year:  return add_months(secs, steps * 12);
+    case k_edit_hr:    by = steps * 3600L; break;
+    case k_edit_min:   by = steps * 60L; break;
+    case k_edit_sec:   by = steps; break;
+    default:           return secs;
+    }
+  secs = constrain(secs, kEpochFirst, kEpochLast);
+  if (by < 0)
+    return secs - kEpochFirst < (epoch_t)-by ? kEpochFirst : secs + by;
+  return kEpochLast - secs < (epoch_t)by ? kEpochLast : secs + by;
+}
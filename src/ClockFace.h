@@ -1,9 +1,14 @@
  
 #pragma once
 
-extern CRGB leds[];
+#include "PixelBuffer.h"
+#include "Profile.h"
+
 const unsigned int kNumLEDs = (24*6);
 
+typedef PixelBuffer<kNumLEDs, LED_BACK_PLANE ? 2 : 1> LEDBuffer;
+extern LEDBuffer leds;
+
 // Number of pixels in each segment
 const unsigned int kSegmentLength = 3;
 
@@ -20,7 +25,8 @@ const unsigned int kSegmentLength = 3;
  * 
  */
 
-const unsigned int kDigitStart[] = {0*24,1*24,2*24,3*24,4*24,5*24};
+const unsigned char kNumDigits = 6;
+const unsigned int kDigitStart[kNumDigits] = {0*24,1*24,2*24,3*24,4*24,5*24};
 
 
 const char char_segment_table[][2] = 
@@ -84,37 +90,72 @@ const char char_segment_table[][2] =
  * \param digit_offset starting address of the 7-segment group in the mimic buffer
  * \param segments should be of the form 0abcdefg in binary where each letter represents the state of the character (1=on)
  */
-void set_segment_display (CRGB *mimic, unsigned int digit_offset, byte segments, CRGB colour, CRGB off_colour = {0,0,0})
+PROFILED void set_segment_display (LEDBuffer *mimic, unsigned int digit_offset, byte segments, CRGB colour, CRGB off_colour = {0,0,0})
 {
+    // Look the colours up once, not once per pixel
+    unsigned char on = mimic->index(colour);
+    unsigned char off = mimic->index(off_colour);
+    
     for (int segment = 6; segment >= 0; -- segment)
     {
         unsigned int segment_offset = digit_offset + segment * kSegmentLength;
+        unsigned char idx = (segments & 0x01) ? on : off;
         
-        if (segments & 0x01)
-        {
-            for(unsigned int i = 0; i < kSegmentLength; ++i)
-                mimic[segment_offset + i] = colour;
-        }
-        else
+        for(unsigned int i = 0; i < kSegmentLength; ++i)
+            mimic->set_index(segment_offset + i, idx);
+        
+        segments >>= 1;
+    }
+}
+
+/**
+ * Colour only the segments in the mask, leaving the others untouched
+ * \param pixels number of pixels to light along each segment (from its start)
+ */
+void set_segments (LEDBuffer *mimic, unsigned int digit_offset, byte mask, CRGB colour, unsigned char pixels = kSegmentLength)
+{
+    unsigned char idx = mimic->index(colour);
+    
+    for (int segment = 6; segment >= 0; -- segment)
+    {
+        if (mask & 0x01)
         {
-            for(unsigned int i = 0; i < kSegmentLength; ++i)
-                mimic[segment_offset + i] = off_colour;
+            unsigned int segment_offset = digit_offset + segment * kSegmentLength;
+            for(unsigned int i = 0; i < pixels; ++i)
+                mimic->set_index(segment_offset + i, idx);
         }
         
-        segments >>= 1;
+        mask >>= 1;
+    }
+}
+
+/**
+ * Light the segment pixels of a digit from a mask and turn the rest off
+ * \param mask bit i for pixel i of the digit (0 to 20: aaa, bbb, ... ggg)
+ */
+void set_pixel_mask (LEDBuffer *mimic, unsigned int digit_offset, unsigned long mask, CRGB colour)
+{
+    unsigned char on = mimic->index(colour);
+    unsigned char off = mimic->index(CRGB(0, 0, 0));
+    
+    for (unsigned int i = 0; i < 7 * kSegmentLength; ++i)
+    {
+        mimic->set_index(digit_offset + i, (mask & 0x01) ? on : off);
+        mask >>= 1;
     }
 }
 
-void set_colon(CRGB *mimic, unsigned int digit_offset, CRGB colour)
+void set_colon(LEDBuffer *mimic, unsigned int digit_offset, CRGB colour)
 {
-    mimic[digit_offset + 22] = colour;
-    mimic[digit_offset + 23] = colour;
+    unsigned char idx = mimic->index(colour);
+    mimic->set_index(digit_offset + 22, idx);
+    mimic->set_index(digit_offset + 23, idx);
     
 }
 
-void set_decimal(CRGB *mimic, unsigned int digit_offset, CRGB colour)
+void set_decimal(LEDBuffer *mimic, unsigned int digit_offset, CRGB colour)
 {
-    mimic[digit_offset + 21] = colour;
+    mimic->set(digit_offset + 21, colour);
 }
 
 
@@ -136,7 +177,7 @@ byte get_decimal_char(int number, byte character)
 /**
  * Find the segment representation for a given character
  */
-byte get_rep(const char input)
+PROFILED byte get_rep(const char input)
 {
     for(int i = 0; i < sizeof(char_segment_table); ++i){
         if(char_segment_table[i][0] == input)
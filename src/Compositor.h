@@ -0,0 +1,419 @@
+#pragma once
+
+#include "FastLED.h"
+#include "ClockFace.h"
+#include "Curves.h"
+
+/*
+ * Builds the LED frame from three layers, bottom to top:
+ *
+ *  - digits:  a segment mask and colour per digit (or a mask of the
+ *             digit's pixels, for frames streamed from a host)
+ *  - marks:   the colon and decimal pixels of each digit
+ *  - overlay: a transient effect over a set of digits (e.g. the
+ *             "over time" flash), applied with a blend rule
+ *
+ * Setters only mark a region dirty when the value actually changes,
+ * so windows can describe the whole face every frame. present()
+ * recomposites the dirty regions and is the only place the LED chain
+ * is written: nothing changed, nothing sent.
+ *
+ * A change of glyph can be animated (crossfade or segment morph).
+ * advance() moves running transitions on; the Animator calls it once
+ * per frame.
+ *
+ * A frame can also be built ahead of time: prerender() composes the
+ * layers onto the LED buffer's back plane and holds it until fire()
+ * sends it. Any change to the layers in between drops the held frame
+ * and goes back to drawing normally.
+ */
+class Compositor
+{
+public:
+  // How the overlay combines with the layers below it
+  typedef enum {
+    k_blend_none,   // overlay off
+    k_blend_tint,   // lit pixels take the overlay colour
+    k_blend_blank   // everything under the overlay is off
+  } blend_t;
+
+  // How a digit changes from one glyph to the next
+  typedef enum {
+    k_trans_cut,        // immediately
+    k_trans_crossfade,  // old segments fade out as new ones fade in
+    k_trans_morph       // segments grow and shrink along their length
+  } transition_t;
+
+  Compositor (LEDBuffer * buffer):
+    mBuffer(buffer)
+  {
+    memset(mSegments, 0, sizeof(mSegments));
+    memset(mPrevSegments, 0, sizeof(mPrevSegments));
+    memset(mColour, 0, sizeof(mColour));
+    memset(mColon, 0, sizeof(mColon));
+    memset(mDecimal, 0, sizeof(mDecimal));
+    memset(mPixels, 0, sizeof(mPixels));
+    invalidate();
+  }
+
+  // Digit layer
+  void set_digit (unsigned char digit, byte segments, CRGB colour)
+  {
+    byte bit = 1 << digit;
+    if (!(mRaw & bit) && mSegments[digit] == segments && mColour[digit] == colour)
+      return;
+    disarm();
+    if (mRaw & bit)
+      {
+        // No glyph to transition from
+        mRaw &= ~bit;
+        mAnimating &= ~bit;
+      }
+    else if (mSegments[digit] != segments && mTransition != k_trans_cut)
+      {
+        // Start from whatever is showing now (a transition that is
+        // still running is cut short)
+        mPrevSegments[digit] = mSegments[digit];
+        mProgress[digit] = 0;
+        mAnimating |= 1 << digit;
+      }
+    mSegments[digit] = segments;
+    mColour[digit] = colour;
+    mDirtyDigits |= bit;
+    mChanged |= bit;
+  }
+
+  // Digit layer, pixel by pixel: bit i of mask lights pixel i of the
+  // digit (see set_pixel_mask()). Always a cut.
+  void set_digit_pixels (unsigned char digit, unsigned long mask, CRGB colour)
+  {
+    byte bit = 1 << digit;
+    if ((mRaw & bit) && mPixels[digit] == mask && mColour[digit] == colour)
+      return;
+    disarm();
+    mRaw |= bit;
+    mAnimating &= ~bit;
+    mPixels[digit] = mask;
+    mColour[digit] = colour;
+    mDirtyDigits |= bit;
+    mChanged |= bit;
+  }
+
+  // Mark layer
+  void set_colon (unsigned char digit, CRGB colour)
+  {
+    if (mColon[digit] == colour)
+      return;
+    disarm();
+    mColon[digit] = colour;
+    mDirtyMarks |= 1 << digit;
+    mChanged |= 1 << digit;
+  }
+
+  void set_decimal (unsigned char digit, CRGB colour)
+  {
+    if (mDecimal[digit] == colour)
+      return;
+    disarm();
+    mDecimal[digit] = colour;
+    mDirtyMarks |= 1 << digit;
+    mChanged |= 1 << digit;
+  }
+
+  // Light the colons of the digits in the mask, turn the rest off
+  void set_colons (byte mask, CRGB colour)
+  {
+    for (unsigned char d = 0; d < kNumDigits; ++d)
+      set_colon(d, (mask & (1 << d)) ? colour : CRGB(0, 0, 0));
+  }
+
+  // Overlay layer, over the digits in the mask
+  void set_overlay (blend_t blend, CRGB colour, byte mask = kAllDigits)
+  {
+    if (blend == mBlend && colour == mOverlay && mask == mOverlayMask)
+      return;
+    disarm();
+    // Both the old and the new extent need redrawing
+    byte dirty = (mBlend == k_blend_none ? 0 : mOverlayMask)
+      | (blend == k_blend_none ? 0 : mask);
+    mBlend = blend;
+    mOverlay = colour;
+    mOverlayMask = mask;
+    mDirtyDigits |= dirty;
+    mDirtyMarks |= dirty;
+  }
+
+  void clear_overlay ()
+  {
+    set_overlay(k_blend_none, mOverlay, mOverlayMask);
+  }
+
+  void set_transition (transition_t transition, unsigned int ms)
+  {
+    mTransition = transition;
+    mTransitionMs = ms ? ms : 1;
+  }
+
+  void default_transition ()
+  {
+    set_transition(k_trans_crossfade, 250);
+  }
+
+  // Move running transitions on by dt ms.
+  // Returns true while any are still running.
+  bool advance (unsigned int dt)
+  {
+    if (!mAnimating)
+      return false;
+
+    uint32_t step = ((uint32_t)dt << 8) / mTransitionMs;
+    if (step == 0)
+      step = 1;
+
+    for (unsigned char d = 0; d < kNumDigits; ++d)
+      {
+        byte bit = 1 << d;
+        if (!(mAnimating & bit))
+          continue;
+
+        if (mProgress[d] + step >= kFixOne)
+          {
+            mProgress[d] = kFixOne;
+            mAnimating &= ~bit;
+          }
+        else
+          mProgress[d] += step;
+        mDirtyDigits |= bit;
+      }
+    return mAnimating;
+  }
+
+  bool animating () const
+  {
+    return mAnimating;
+  }
+
+  bool dirty () const
+  {
+    return mDirtyDigits | mDirtyMarks;
+  }
+
+  // Force the whole face to be rebuilt (e.g. at start up)
+  void invalidate ()
+  {
+    mDirtyDigits = mDirtyMarks = kAllDigits;
+  }
+
+  // Recomposite what changed and send it to the LEDs.
+  // Returns true if a frame was sent.
+  //
+  // budget_us limits the time spent compositing: digits that don't fit
+  // stay dirty and are picked up by the next frame.
+  bool present (unsigned long budget_us = 0xFFFFFFFF)
+  {
+    if (mArmed || !(mDirtyDigits | mDirtyMarks))
+      return false;
+
+    present_dirty(budget_us);
+    mBuffer->show();
+    return true;
+  }
+
+  // Compose the layers as they stand onto the back plane, with any
+  // transition just started already dt ms in, and hold the frame for
+  // fire(). The front plane stays on the LEDs meanwhile.
+  void prerender (unsigned int dt)
+  {
+    disarm();
+    mBuffer->begin_back();
+    advance(dt);
+    present_dirty();
+    mArmed = true;
+  }
+
+  bool armed () const
+  {
+    return mArmed;
+  }
+
+  // Send the held frame. Nothing else is done here, so the first bit
+  // goes out as soon as the palette is scaled.
+  void fire ()
+  {
+    if (!mArmed)
+      return;
+    mArmed = false;
+    mBuffer->flip();
+    mBuffer->show();
+  }
+
+  // micros() at the first bit of the last frame sent
+  unsigned long first_bit_us () const
+  {
+    return mBuffer->first_bit_us();
+  }
+
+  // Drop a held frame. The layers already describe it, so the whole
+  // face is redrawn on the front plane by the next present().
+  void disarm ()
+  {
+    if (!mArmed)
+      return;
+    mArmed = false;
+    mBuffer->cancel_back();
+    invalidate();
+  }
+
+  // The layers as set, without transitions or overlay (for mirroring)
+  byte segments (unsigned char d) const
+  { return mSegments[d]; }
+
+  CRGB colour (unsigned char d) const
+  { return mColour[d]; }
+
+  bool pixel_mode (unsigned char d) const
+  { return mRaw & (1 << d); }
+
+  unsigned long pixels (unsigned char d) const
+  { return mPixels[d]; }
+
+  bool colon_lit (unsigned char d) const
+  { return is_lit(mColon[d]); }
+
+  bool decimal_lit (unsigned char d) const
+  { return is_lit(mDecimal[d]); }
+
+  // Bit per digit whose layers changed since the last call
+  byte take_changed ()
+  {
+    byte c = mChanged;
+    mChanged = 0;
+    return c;
+  }
+
+  static const byte kAllDigits = (1 << kNumDigits) - 1;
+
+private:
+  LEDBuffer * mBuffer;
+
+  // Digit layer
+  byte mSegments[kNumDigits];
+  CRGB mColour[kNumDigits];
+
+  // Digits set pixel by pixel
+  byte mRaw = 0;
+  unsigned long mPixels[kNumDigits];
+
+  // Running glyph transitions
+  byte mPrevSegments[kNumDigits];
+  fix8_8 mProgress[kNumDigits];
+  byte mAnimating = 0;
+  transition_t mTransition = k_trans_crossfade;
+  unsigned int mTransitionMs = 250;
+
+  // Mark layer
+  CRGB mColon[kNumDigits];
+  CRGB mDecimal[kNumDigits];
+
+  // Overlay layer
+  blend_t mBlend = k_blend_none;
+  CRGB mOverlay = CRGB(0, 0, 0);
+  byte mOverlayMask = 0;
+
+  // Bit per digit needing recomposition
+  byte mDirtyDigits;
+  byte mDirtyMarks;
+
+  // Bit per digit changed since take_changed()
+  byte mChanged = kAllDigits;
+
+  // A frame is waiting on the back plane
+  bool mArmed = false;
+
+  // Recomposite dirty digits into the plane being drawn, within the
+  // time budget
+  void present_dirty (unsigned long budget_us = 0xFFFFFFFF)
+  {
+    unsigned long start = micros();
+    for (unsigned char d = 0; d < kNumDigits; ++d)
+      {
+        byte bit = 1 << d;
+        if (!((mDirtyDigits | mDirtyMarks) & bit))
+          continue;
+        if (micros() - start > budget_us)
+          break;
+
+        if (mDirtyDigits & bit)
+          compose_digit(d);
+        if (mDirtyMarks & bit)
+          compose_marks(d);
+        mDirtyDigits &= ~bit;
+        mDirtyMarks &= ~bit;
+      }
+  }
+
+  static bool is_lit (const CRGB & c)
+  {
+    return c.r | c.g | c.b;
+  }
+
+  // Apply the overlay blend rule to one colour of a digit
+  CRGB blend (unsigned char digit, const CRGB & c) const
+  {
+    if (!(mOverlayMask & (1 << digit)))
+      return c;
+
+    switch (mBlend)
+      {
+      case k_blend_tint:
+        return is_lit(c) ? mOverlay : c;
+      case k_blend_blank:
+        return CRGB(0, 0, 0);
+      default:
+        return c;
+      }
+  }
+
+  void compose_digit (unsigned char d)
+  {
+    CRGB on = blend(d, mColour[d]);
+    if (mRaw & (1 << d))
+      {
+        set_pixel_mask(mBuffer, kDigitStart[d], mPixels[d], on);
+        return;
+      }
+    if (!(mAnimating & (1 << d)))
+      {
+        set_segment_display(mBuffer, kDigitStart[d], mSegments[d], on);
+        return;
+      }
+
+    byte stay = mSegments[d] & mPrevSegments[d];
+    byte in = mSegments[d] & ~mPrevSegments[d];
+    byte out = mPrevSegments[d] & ~mSegments[d];
+
+    // Quantised to 1/16ths so a fade only needs a few palette slots
+    fix8_8 t = curve(k_curve_ease, mProgress[d]) & ~0x0F;
+
+    set_segment_display(mBuffer, kDigitStart[d], stay, on);
+    if (mTransition == k_trans_morph)
+      {
+        unsigned char lit = (t * kSegmentLength + 0x80) >> 8;
+        set_segments(mBuffer, kDigitStart[d], in, on, lit);
+        set_segments(mBuffer, kDigitStart[d], out, on, kSegmentLength - lit);
+      }
+    else
+      {
+        set_segments(mBuffer, kDigitStart[d], in, scale_colour(on, t));
+        set_segments(mBuffer, kDigitStart[d], out, scale_colour(on, kFixOne - t));
+      }
+  }
+
+  void compose_marks (unsigned char d)
+  {
+    ::set_colon(mBuffer, kDigitStart[d], blend(d, mColon[d]));
+    ::set_decimal(mBuffer, kDigitStart[d], blend(d, mDecimal[d]));
+  }
+};
+
+extern Compositor face;
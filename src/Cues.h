@@ -0,0 +1,134 @@
+#pragma once
+
+#include <Arduino.h>
+#include <avr/pgmspace.h>
+#include "Timers.h"
+
+/*
+ * Cues: actions at set times left on a countdown (flash the digits at
+ * 5:00, the speaker's light at 2:00, a message to the AV desk at 0:00).
+ *
+ * Each countdown with cues has a list of them in flash, latest first,
+ * and a cursor at the next one due. poll() compares the timer's time
+ * left with that one cue, so it costs the same however many cues there
+ * are; when it is due it is handed to the on_cue() callback and the
+ * cursor moves on. If the loop was held up, every cue passed is run in
+ * order.
+ *
+ * The cursor only ever moves forward while the timer runs, so pausing
+ * and going on never runs a cue twice. When the timer is set (or
+ * reset) it moves to the first cue below the new time: cues at or
+ * above it count as passed. The callback is told of that with
+ * k_cue_reset, so lasting actions (the light) can be undone.
+ */
+
+typedef enum {
+  k_cue_reset,        // the timer was set: undo lasting cues
+  k_cue_flash,        // flash the digits for arg s
+  k_cue_light,        // the cue light (CUE_LIGHT_PIN) on (arg 1) or off
+  k_cue_event,        // tell the host (Remote), with arg as the code
+  k_cue_beep          // sound BUZZER_PIN for arg tenths of a second
+} cue_action_t;
+
+// One cue, as kept in flash
+struct Cue
+{
+  int secs;           // time left, as shown (negative over time)
+  byte action;
+  byte arg;
+};
+
+template <unsigned char N>
+class CueEngine
+{
+public:
+  CueEngine (TimerBank * bank):
+    mBank(bank)
+  {}
+
+  void on_cue (void (* callback) (byte timer, byte action, byte arg))
+  {
+    mOnCue = callback;
+  }
+
+  // Give a countdown a list of n cues, in flash, latest first.
+  // Returns false if there are already N lists.
+  bool attach (byte timer, const Cue * cues, byte n)
+  {
+    if (mCount >= N)
+      return false;
+    List & l = mLists[mCount++];
+    l.timer = timer;
+    l.cues = cues;
+    l.n = n;
+    rewind(l);
+    return true;
+  }
+
+  // Called every loop: runs the cues that are due
+  void poll ()
+  {
+    unsigned long set = mBank->take_set();
+    for (byte i = 0; i < mCount; ++i)
+      {
+        List & l = mLists[i];
+        if (set & (1UL << l.timer))
+          {
+            rewind(l);
+            if (mOnCue)
+              mOnCue(l.timer, k_cue_reset, 0);
+          }
+        while (l.next < l.n && mBank->ms(l.timer) <= l.due)
+          {
+            Cue c;
+            memcpy_P(&c, &l.cues[l.next], sizeof(c));
+            advance(l);
+            if (mOnCue)
+              mOnCue(l.timer, c.action, c.arg);
+          }
+      }
+  }
+
+private:
+  struct List
+  {
+    const Cue * cues;   // in flash
+    byte n;
+    byte timer;
+    byte next;          // the next cue due
+    long due;           // ms left at which it is due
+  };
+
+  TimerBank * mBank;
+  List mLists[N];
+  byte mCount = 0;
+  void (* mOnCue) (byte, byte, byte) = nullptr;
+
+  // Time left, as shown, is at or below secs from this many ms
+  static long due_ms (int secs)
+  {
+    return secs * 1000L;
+  }
+
+  void advance (List & l)
+  {
+    l.next ++;
+    if (l.next < l.n)
+      l.due = due_ms((int16_t)pgm_read_word(&l.cues[l.next].secs));
+  }
+
+  // To the first cue below the time left
+  void rewind (List & l)
+  {
+    long left = mBank->ms(l.timer);
+    l.next = 0;
+    l.due = l.n ? due_ms((int16_t)pgm_read_word(&l.cues[0].secs)) : 0;
+    while (l.next < l.n && l.due >= left)
+      advance(l);
+  }
+};
+
+// Countdowns with cues
+typedef CueEngine<2> Cues;
+
+extern Cues cues;
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <Arduino.h>
+#include "FastLED.h"
+
+/*
+ * 8.8 fixed point helpers and animation curves.
+ *
+ * A fix8_8 of 0x100 is 1.0. Blend factors run from 0 (all of the
+ * first colour) to 0x100 (all of the second).
+ */
+typedef uint16_t fix8_8;
+
+const fix8_8 kFixOne = 0x100;
+
+// a + (b - a) * t
+inline uint8_t lerp8 (uint8_t a, uint8_t b, fix8_8 t)
+{
+  // Kept unsigned so the product fits 16 bits
+  if (b >= a)
+    return a + (((uint16_t)(b - a) * t) >> 8);
+  else
+    return a - (((uint16_t)(a - b) * t) >> 8);
+}
+
+inline CRGB blend_colour (const CRGB & a, const CRGB & b, fix8_8 t)
+{
+  return CRGB(lerp8(a.r, b.r, t), lerp8(a.g, b.g, t), lerp8(a.b, b.b, t));
+}
+
+inline CRGB scale_colour (const CRGB & c, fix8_8 t)
+{
+  return CRGB(((uint16_t)c.r * t) >> 8, ((uint16_t)c.g * t) >> 8, ((uint16_t)c.b * t) >> 8);
+}
+
+
+typedef enum {
+  k_curve_linear,
+  k_curve_ease,     // smoothstep, for fades and morphs
+  k_curve_breathe,  // raised cosine, one breath per cycle
+  k_curve_pulse     // fast attack, exponential decay
+} curve_t;
+
+// Curves sampled at 17 points over one cycle (0-255 = 0.0-1.0)
+const uint8_t kCurveTables[][17] PROGMEM =
+{
+  {0, 3, 11, 24, 40, 59, 81, 104, 128, 151, 174, 196, 215, 231, 244, 252, 255},
+  {0, 10, 37, 79, 127, 176, 218, 245, 255, 245, 218, 176, 128, 79, 37, 10, 0},
+  {0, 128, 255, 187, 136, 100, 73, 53, 39, 29, 21, 15, 11, 8, 6, 4, 0}
+};
+
+/**
+ * Evaluate a curve.
+ * \param phase position through the curve, 0 to 0x100
+ * \return curve value, 0 to 0x100
+ */
+inline fix8_8 curve (curve_t c, fix8_8 phase)
+{
+  if (phase >= kFixOne)
+    phase = kFixOne - 1;
+  if (c == k_curve_linear)
+    return phase;
+
+  // Interpolate between the two nearest samples
+  const uint8_t * table = kCurveTables[c - 1];
+  uint8_t i = phase >> 4;
+  uint8_t frac = phase & 0x0F;
+  int16_t a = pgm_read_byte(table + i);
+  int16_t b = pgm_read_byte(table + i + 1);
+  fix8_8 v = a + (((b - a) * frac) >> 4);
+
+  // Stretch 0-255 to 0-256 so a full sample really is 1.0
+  return v + (v >> 7);
+}
+
+
+// A colour at a time left (s). Keys in order of time make a ramp.
+struct ColourKey
+{
+  uint16_t secs;
+  CRGB colour;
+};
+
+// Colour by seconds left, through a table sampled from keys.
+//
+// The keys are blended linearly into kSteps colours, mStep seconds
+// apart. Between two samples the colour is blended again in 8.8 fixed
+// point. The step divides a minute, or is whole minutes, so keys on
+// whole minutes are sampled exactly. Two keys at the same time make a
+// step (blended over one sample). Past the last sample the colour is
+// that of the last key.
+//
+// Building costs a pass over the keys for each sample, so it is done
+// as the keys change. A look up is a divide, a multiply and a blend.
+template <unsigned char kSteps>
+class ColourRamp
+{
+public:
+  // keys: n of them, in order of time
+  void build (const ColourKey * keys, byte n)
+  {
+    if (!n)
+      return;
+    uint16_t span = keys[n - 1].secs;
+    mStep = (span + kSteps - 2) / (kSteps - 1);
+    if (mStep > 60)
+      mStep = (mStep + 59) / 60 * 60;
+    else if (mStep > 1)
+      while (60 % mStep)
+        mStep ++;
+    else
+      mStep = 1;
+    mLast = span / mStep + (span % mStep ? 1 : 0);
+
+    byte k = 0;
+    for (byte i = 0; i <= mLast; ++i)
+      {
+        uint16_t t = i * mStep;
+        while (k + 1 < n && keys[k + 1].secs <= t)
+          k ++;
+        if (k + 1 == n || t <= keys[k].secs)
+          mTable[i] = keys[k].colour;
+        else
+          {
+            uint16_t gap = keys[k + 1].secs - keys[k].secs;
+            mTable[i] = blend_colour(keys[k].colour, keys[k + 1].colour,
+                                     ((uint32_t)(t - keys[k].secs) << 8) / gap);
+          }
+      }
+  }
+
+  CRGB colour (unsigned long secs) const
+  {
+    if (secs >= (unsigned long)mLast * mStep)
+      return mTable[mLast];
+    byte i = secs / mStep;
+    fix8_8 t = ((uint32_t)(secs - i * mStep) << 8) / mStep;
+    return blend_colour(mTable[i], mTable[i + 1], t);
+  }
+
+private:
+  CRGB mTable[kSteps];
+  uint16_t mStep = 1;
+  byte mLast = 0;
+};
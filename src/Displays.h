@@ -4,9 +4,38 @@
 #include "HAL.h"
 #include "FastLED.h"
 #include "ClockFace.h"
+#include "Compositor.h"
+#include "Animator.h"
+#include "Timers.h"
+#include "Bench.h"
+#include "Sync.h"
+#include "Log.h"
+#include "Power.h"
+#include "Widgets.h"
+#include "Settings.h"
+#include "Schedule.h"
+#include "Calendar.h"
+#include "TimeZone.h"
 
 class WindowManager;
 
+// LED gain in stage mode (see LEDBuffer::set_gain)
+const fix8_8 kStageGain = 4 * kFixOne;
+
+// LED gain for the brightness setting, a percentage
+fix8_8 brightness_gain (int percent)
+{
+  return (long)percent * kFixOne / 100;
+}
+
+// LED colour for a colour setting: 4 bits a channel, 15 = 0x3F
+CRGB setting_colour (int rgb)
+{
+  return CRGB(((rgb >> 8) & 0xF) * 0x11 >> 2,
+              ((rgb >> 4) & 0xF) * 0x11 >> 2,
+              (rgb & 0xF) * 0x11 >> 2);
+}
+
 class Window
 {
 
@@ -36,62 +65,116 @@ public:
   }
   
   // Run the window manager
-  // i.e draw the current window, and do some button management
+  // i.e draw the current window, and send its LED frame (the serial
+  // port is handled in Remote.h)
+  //
+  // Windows are drawn after input, and otherwise once per LED frame
+  // period, which is as often as anything they show can change.
   void run()
   {
-    current->draw(display);
-    if (Serial.available() > 0)
+    // Close to a second edge with its frame held, skip the OLED so
+    // nothing holds up sending it
+    bool due = mRedraw || millis() - mLastDraw >= animator.frame_period();
+    if (due && !animator.edge_within(kEdgeGuardMs))
       {
-        // read the incoming byte:
-        char incomingByte = Serial.read();
-        switch (incomingByte)
-          {
-          case 'n':
-            current->down();
-            break;
-          case 'p':
-            current->up();
-            break;
-          case 'b':
-            current->back();
-            break;
-          case 'e':
-            current->enter();
-            break;
-          }
+        mLastDraw = millis();
+        mRedraw = false;
+        current->draw(display);
       }
+    // Send an LED frame, if one is due
+    animator.frame();
   }
 
   void down_evt()
-  {current->down();}
+  {current->down(); mRedraw = true;}
 
   void up_evt()
-  {current->up();}
+  {current->up(); mRedraw = true;}
   
   void enter_evt()
-  {current->enter();}
+  {current->enter(); mRedraw = true;}
   
   void back_evt()
-  {current->back();}
+  {current->back(); mRedraw = true;}
+
+  // The window on the OLED now
+  Window * showing()
+  {return current;}
 
   // Change the displayed window
   void load(Window * wind){
     display->clear();
+    // Overlays and frame settings belong to the window that set them
+    face.disarm();
+    animator.clear_overlay();
+    animator.set_frame_period(kFramePeriod);
+    face.default_transition();
     delay(5);
     current = wind;
     wind->mgr = this;
+    mRedraw = true;
   }
 
   void clean()
   {
     display->clear();
   }
+
+  // Report LED frame rate and timing over serial
+  void print_stats()
+  {
+    Serial.print("fps ");
+    Serial.print(animator.fps());
+    Serial.print(" worst ");
+    Serial.print(animator.worst_us());
+    Serial.print(" us ");
+    Serial.print(leds.milliamps());
+    Serial.print(" mA");
+    if (animator.edge_late_max() != LONG_MIN)
+      {
+        // First bit after the second edge, and its spread (jitter)
+        Serial.print(" edge ");
+        Serial.print(animator.edge_late_min());
+        Serial.print("..");
+        Serial.print(animator.edge_late_max());
+        Serial.print(" us");
+      }
+    Serial.print(" cpu ");
+    Serial.print(power.duty() / 10);
+    Serial.print("% ~");
+    Serial.print(power.milliamps());
+    Serial.print(" mA log dropped ");
+    Serial.print(logger.dropped());
+    Serial.print(" send worst ");
+    Serial.print(logger.worst_us());
+    Serial.println(" us");
+    animator.reset_stats();
+  }
   
 protected:
   Window * current;
   OLED * display;
+
+  // Draw pacing
+  unsigned long mLastDraw = 0;
+  bool mRedraw = true;
+};
+
+
+// ListMenu's screen: a label per row, and an arrow at the selected one
+const char kMenuArrow[] PROGMEM = "->";
+
+const WidgetSpot kMenuSpots[] PROGMEM = {
+  {0, 0, 2, 0}, {1, 0, 2, 0}, {2, 0, 2, 0}, {3, 0, 2, 0},
 };
 
+const WidgetSpec kMenuWidgets[] PROGMEM = {
+  {k_widget_text, 0, 3, 17, nullptr, nullptr, nullptr},
+  {k_widget_text, 1, 3, 17, nullptr, nullptr, nullptr},
+  {k_widget_text, 2, 3, 17, nullptr, nullptr, nullptr},
+  {k_widget_text, 3, 3, 17, nullptr, nullptr, nullptr},
+  {k_widget_marker, 0, 0, DISP_HEIGHT, kMenuArrow, nullptr, kMenuSpots},
+};
 
 // This menu offers a list of windows.
 template <unsigned char T>
@@ -99,6 +182,14 @@ class ListMenu : public Window
 {
 
 public:
+  ListMenu ():
+    mScreen(kMenuWidgets)
+  {
+    for (unsigned char i = 0; i < DISP_HEIGHT; ++i)
+      mScreen.bind(i, &mRows[i]);
+    mScreen.bind(DISP_HEIGHT, &mArrow);
+  }
+
   void add (Window * wind, const char * label)
   {
     // Set up back pointers. This gives the child access to the
@@ -149,21 +240,12 @@ public:
         num = DISP_HEIGHT;
       }
 
-    // Draw a label on each line
-    for (unsigned char i = 0; i < num; ++i)
-      {
-        // Translate from line number to index in labels
-        unsigned char it = i + start;
-        
-        disp->set_point (i, 0);
-
-        // If the current line is the current index, mark it
-        if(it == ind)
-          disp->write("-> ");
-
-        disp->write(mLabels[it]);
-        disp->write("   "); // Clear any artifacts from the "-> "
-      }
+    // A label on each line, and the arrow at the current index. Only
+    // rows that change (scrolling, or the arrow moving) are sent.
+    for (unsigned char i = 0; i < DISP_HEIGHT; ++i)
+      mRows[i] = i < num ? mLabels[i + start] : nullptr;
+    mArrow = ind - start;
+    mScreen.draw(disp);
   }
 
   // Go to next menu item
@@ -211,6 +293,12 @@ private:
 
   // Currently selected menu item
   unsigned char ind = 0;
+
+  // Label on each row, the row with the arrow, and the layer
+  // showing them
+  const char * mRows [DISP_HEIGHT];
+  unsigned char mArrow = 0;
+  WidgetLayer<DISP_HEIGHT + 1> mScreen;
 };
 
 
@@ -238,7 +326,7 @@ public:
     else
       mStart -= DISP_WIDTH;
     mgr->clean();
-    Serial.print((int)mLength, DEC);
+    LOG(k_log_text_length, mLength, 0);
   }
   
   virtual void down ()
@@ -280,78 +368,28 @@ private:
 };
 
 
-class UndisciplinedClock: public Window
+// Free running clock (no RTC). It ticks from the TimeBase, so it must
+// be registered with timebase.add() to keep time.
+class UndisciplinedClock: public Window, public Ticker
 {
 public:
   UndisciplinedClock ():
-    mEditState(k_none),
-    mLast(millis()),
-    year(2019),
-    month(11),
-    day(23),
-    hr(11),
-    minu(15),
-    sec(00)
-  {}
+    mEditState(k_edit_none)
+  {
+    CivilTime t = {2019, 11, 23, 11, 15, 0};
+    mNow = to_epoch(t);
+  }
 
 
   virtual void up ()
   {
-    switch(mEditState)
-      {
-      case k_day:
-        day ++; break;
-
-      case k_month:
-        month ++; break;
-
-      case k_year:
-        year ++; break;
-
-      case k_hr:
-        hr ++; break;
-
-      case k_min:
-        minu ++; break;
-
-      case k_sec:
-        sec ++; break;                   
-                  
-      default:
-      case k_none:
-        break;
-      }
-    update_forward();
+    mNow = step_field(mNow, mEditState, 1);
   }
 
   
   virtual void down ()
   {
-    switch(mEditState)
-      {
-      case k_day:
-        day --; break;
-
-      case k_month:
-        month --; break;
-
-      case k_year:
-        year --; break;
-
-      case k_hr:
-        hr --; break;
-
-      case k_min:
-        minu --; break;
-
-      case k_sec:
-        sec --; break;                   
-                  
-      default:
-      case k_none:
-        break;
-      }
-    update_backward();
+    mNow = step_field(mNow, mEditState, -1);
   }
 
   
@@ -364,30 +402,8 @@ public:
   
   virtual void enter ()
   {
-    switch(mEditState)
-      {
-      case k_day:
-        mEditState = k_month; break;
-
-      case k_month:
-        mEditState = k_year; break;
-
-      case k_year:
-        mEditState = k_hr; break;
-
-      case k_hr:
-        mEditState = k_min; break;
-
-      case k_min:
-        mEditState = k_sec; break;
-
-      case k_sec:
-        mEditState = k_none; break;      
-                  
-      default:
-      case k_none:
-        mEditState = k_day; break;
-      }
+    // Day, month, year, hours, minutes, seconds, then done
+    mEditState = (mEditState == k_edit_sec) ? k_edit_none : mEditState + 1;
     mNeedsClear = true;
   }
 
@@ -399,184 +415,395 @@ public:
       disp->clear();
       mNeedsClear = false;
     }
+
+    CivilTime t;
+    from_epoch(mNow, &t);
     
     // Draw time
     char buf [20];
-    sprintf(buf, "%2d/%02d/%4d  ", day, month, year);
+    sprintf(buf, "%2d/%02d/%4d  ", t.day, t.month, t.year);
     disp->set_point(1,3);
     disp->write(buf);
 
-    sprintf(buf, "%2d:%02d:%02d  ", hr, minu, sec);
+    sprintf(buf, "%2d:%02d:%02d  ", t.hour, t.minute, t.second);
     disp->set_point(2,6);
     disp->write(buf);
     
     CRGB Colour = {0x0F,0x1F,0};
     
-    sprintf(buf, "%02d%02d%02d", hr, minu, sec);
+    sprintf(buf, "%02d%02d%02d", t.hour, t.minute, t.second);
     
-    set_segment_display(leds, kDigitStart[0], get_rep(buf[0]), Colour);
-    set_segment_display(leds, kDigitStart[1], get_rep(buf[1]), Colour);
-    set_segment_display(leds, kDigitStart[2], get_rep(buf[2]), Colour);
-    set_segment_display(leds, kDigitStart[3], get_rep(buf[3]), Colour);
-    set_segment_display(leds, kDigitStart[4], get_rep(buf[4]), Colour);
-    set_segment_display(leds, kDigitStart[5], get_rep(buf[5]), Colour);
+    for (unsigned char d = 0; d < kNumDigits; ++d)
+      face.set_digit(d, get_rep(buf[d]), Colour);
     
-    if(sec%2){
-        set_colon(leds,kDigitStart[1],{0x0F,0x1F,0});
-        set_colon(leds,kDigitStart[3],{0x0F,0x1F,0});
+    if(t.second%2){
+        face.set_colons(0b001010, {0x0F,0x1F,0});
     } else {
-        set_colon(leds,kDigitStart[1],{0x00,0x0F,0x1F});
-        set_colon(leds,kDigitStart[3],{0x00,0x0F,0x1F});
+        face.set_colons(0b001010, {0x00,0x0F,0x1F});
     }
-    
-    FastLED.show();
 
     // Draw highlight
     switch(mEditState)
       {
-      case k_day:
+      case k_edit_day:
         disp->set_point(0,3); disp->write("\x1B\x1B"); break;
         
-      case k_month:
+      case k_edit_month:
         disp->set_point(0,6); disp->write("\x1B\x1B"); break;
         
-      case k_year:
+      case k_edit_year:
         disp->set_point(0,9); disp->write("\x1B\x1B\x1B\x1B"); break;
         
-      case k_hr:
+      case k_edit_hr:
         disp->set_point(3,6); disp->write("\x1A\x1A"); break;
         
-      case k_min:
+      case k_edit_min:
         disp->set_point(3,9); disp->write("\x1A\x1A"); break;
 
-      case k_sec:
+      case k_edit_sec:
         disp->set_point(3,12); disp->write("\x1A\x1A"); break;
         
       default:
-      case k_none:
+      case k_edit_none:
         break;
       }
-    
+  }
 
-    while(millis() - mLast > 1000)
-      {
-        mLast += 1000;
-        sec ++;
-        update_forward();   
-      }
+  virtual void tick (unsigned long now)
+  {
+    mNow ++;
   }
   
   
 private:
-  typedef enum {k_none, k_day, k_month, k_year, k_hr, k_min, k_sec} edit_t;
+  // A time_edit_t
+  unsigned char mEditState;
+  epoch_t mNow;
+
+  bool mNeedsClear = false;
+};
 
-  edit_t mEditState;
-  unsigned char day, month, hr, minu, sec;
-  unsigned int year;
 
-  unsigned long mLast;
+#include "RTClib.h"
 
-  bool mNeedsClear = false;
+extern RTC_DS1307 rtc;
 
-  // Update moving forward in time
-  void update_forward ()
+// A DateTime's fields as epoch seconds (RTClib's DateTime is only used
+// for its fields: its own epoch sums loop over years and months)
+epoch_t date_time_epoch (const DateTime & n)
+{
+  CivilTime t = {n.year(), n.month(), n.day(), n.hour(), n.minute(), n.second()};
+  return to_epoch(t);
+}
+
+// The RTC's time (UTC)
+epoch_t rtc_read ()
+{
+  return date_time_epoch(rtc.now());
+}
+
+void rtc_write (epoch_t secs)
+{
+  // Out of its years the DS1307's year byte wraps (a zone's offset
+  // can take a local time at either end just past them)
+  CivilTime t;
+  from_epoch(constrain(secs, kEpochFirst, kEpochLast), &t);
+  rtc.adjust(DateTime(t.year, t.month, t.day, t.hour, t.minute, t.second));
+}
+
+// RTCClock's screen: the date on row 1, the time on row 2, and arrows
+// at the field being edited
+const char kFmtYear[] PROGMEM = "20%02ld-";
+const char kFmtDatePart[] PROGMEM = "%02ld-";
+const char kFmtDay[] PROGMEM = "%02ld";
+const char kFmtHour[] PROGMEM = "%2ld:";
+const char kFmtTimePart[] PROGMEM = "%02ld:";
+const char kFmtSec[] PROGMEM = "%02ld";
+
+// Under the time: hours, minutes, seconds
+#define TIME_EDIT_SPOTS {3, 6, 2, '\x1A'}, {3, 9, 2, '\x1A'}, {3, 12, 2, '\x1A'}
+
+const WidgetSpot kRTCClockSpots[] PROGMEM = {
+  {0, 0, 0, 0},                 // not editing
+  {0, 11, 2, '\x1B'},           // over the day
+  {0, 8, 2, '\x1B'},            // month
+  {0, 3, 4, '\x1B'},            // year
+  TIME_EDIT_SPOTS
+};
+
+const WidgetSpec kRTCClockWidgets[] PROGMEM = {
+  {k_widget_number, 1, 3, 5, kFmtYear, nullptr, nullptr},
+  {k_widget_number, 1, 8, 3, kFmtDatePart, nullptr, nullptr},
+  {k_widget_number, 1, 11, 4, kFmtDay, nullptr, nullptr},
+  {k_widget_number, 2, 6, 3, kFmtHour, nullptr, nullptr},
+  {k_widget_number, 2, 9, 3, kFmtTimePart, nullptr, nullptr},
+  {k_widget_number, 2, 12, 4, kFmtSec, nullptr, nullptr},
+  {k_widget_marker, 0, 0, 7, nullptr, nullptr, kRTCClockSpots},
+};
+
+class RTCClock: public Window
+{
+public:
+  RTCClock ():
+    mEditState(k_edit_none),
+    mNow(0),
+    mScreen(kRTCClockWidgets)
   {
-    // Update times
-    if(sec > 59)
-      {sec = 0; minu ++;}
-    if(minu > 59)
-      {minu = 0; hr ++;}
-    if(hr > 23)
-      {hr = 0; day ++;}
-    if(day > len_month())
-      {day = 1; month++;}
-    if(month > 12)
-      {month = 1; year++;}
+    for (unsigned char i = 0; i < k_num_fields; ++i)
+      mScreen.bind(i, &mFields[i]);
+    mScreen.bind(k_num_fields, &mEditState);
   }
 
-  // Update moving backwards in time
-  void update_backward ()
-  {
-    bool day_change = false;
-    bool month_change = false;
-    // Reverse (0xFF == -1 which is greater than 59)
-    if(sec > 59)
-      {sec = 59; minu --;}
-    if(minu > 59)
-      {minu = 59; hr --;}
-    if(hr > 23)
-      {hr = 23; day --;}
 
-    // Day rollover
-    if(day == 0 || day > 31)
-      {month--;}
+  virtual void up ()
+  {
+    mNow = step_field(mNow, mEditState, 1);
+    save_state();
+  }
 
-    // month rollover
-    if(month == 0 || month > 12)
-      {month = 12; year--;}
-      
-    if(day == 0 || day > len_month())
-      {day = len_month();}
+  
+  virtual void down ()
+  {
+    mNow = step_field(mNow, mEditState, -1);
+    save_state();
   }
 
-  unsigned char len_month()
+  
+  virtual void back ()
   {
-    char lens [] = {31, 0, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    if(parent)
+      mgr->load(parent);
+  }
 
-    if(month != 2)
-      return lens[month - 1];
+  
+  virtual void enter ()
+  {
+    // Day, month, year, hours, minutes, seconds, then done (each
+    // change was written to the RTC as it was made)
+    mEditState = (mEditState == k_edit_sec) ? k_edit_none : mEditState + 1;
+  }
 
-    if (year % 4 == 0 && (year % 100 != 0 || year & 400 == 0))
-      return 29;
+  // Draw the window
+  virtual void draw(OLED * disp)
+  {
+    //if(millis() - mLast > 1000)
+    //  {
+    //    mLast = millis();
+        unsigned long read_ms = millis();
+        load_state();
+        track_edge(read_ms);
+    //  }
+    
+    
+    // Draw time: only the fields that changed go to the OLED
+    CivilTime t;
+    from_epoch(mNow, &t);
+    mFields[k_field_year] = t.year - 2000;
+    mFields[k_field_month] = t.month;
+    mFields[k_field_day] = t.day;
+    mFields[k_field_hr] = t.hour;
+    mFields[k_field_min] = t.minute;
+    mFields[k_field_sec] = t.second;
+    mScreen.draw(disp);
+    
+    // LEDs. The frame for the next second is built just before the
+    // predicted edge and sent on it.
+    if (mEditState != k_edit_none)
+      face.disarm();
+
+    unsigned long now = mNow;
+    long to_edge = mEdge + 1000 - millis();
+    if (animator.armed() || now + 1 == mShown)
+      ;  // held, or the RTC hasn't caught up with what is showing
+    else if (mEditState == k_edit_none && mSecond != kUnsynced
+             && to_edge > 0 && to_edge <= (long)kPrerenderMs)
+      {
+        show_time(mNow + 1);
+        mShown = now + 1;
+        animator.arm(micros() + (long)(mEdge + 1000 - millis()) * 1000, true);
+      }
     else
-      return 28;
+      {
+        show_time(mNow);
+        mShown = now;
+      }
+  }
+  
+  
+private:
+  typedef enum {k_field_year, k_field_month, k_field_day,
+                k_field_hr, k_field_min, k_field_sec, k_num_fields} field_t;
+
+  // A time_edit_t (a byte, so the marker can be bound to it)
+  unsigned char mEditState;
+
+  epoch_t mNow;
+
+  // What the OLED shows, and the layer showing it
+  unsigned char mFields[k_num_fields];
+  WidgetLayer<k_num_fields + 1> mScreen;
+
+  // Second edge tracking, and the time last put on the LEDs
+  static const unsigned char kUnsynced = 0xFF;
+  unsigned char mSecond = kUnsynced;
+  unsigned long mEdge = 0;
+  unsigned long mShown = 0;
+  
+  void show_time (epoch_t secs)
+  {
+    CRGB Colour = {0x00,0x1F,0};
+
+    CivilTime t;
+    from_epoch(secs, &t);
+    char buf [8];
+    sprintf(buf, "%02d%02d%02d", t.hour, t.minute, t.second);
     
+    for (unsigned char d = 0; d < kNumDigits; ++d)
+      face.set_digit(d, get_rep(buf[d]), Colour);
+    
+    if(t.second%2){
+        face.set_colons(0b001010, {0x00,0x1F,0});
+    } else {
+        face.set_colons(0b001010, {0x00,0x0F,0x0F});
+    }
+  }
+
+  // Find the RTC's second edge in millis() time. A read that first
+  // returns a new second was started after the edge, so an earlier
+  // sighting than predicted always moves the estimate earlier; a later
+  // one only lets it creep 1 ms, which follows a millis() clock that
+  // runs fast without being thrown by a slow loop.
+  void track_edge (unsigned long read_ms)
+  {
+    unsigned char second = mNow % 60;
+    if (second == mSecond)
+      return;
+
+    unsigned long predicted = mEdge + 1000;
+    long error = read_ms - predicted;
+    // (Far out is a first sighting, or the RTC having been set)
+    if (mSecond == kUnsynced || error < 0 || error > 100)
+      mEdge = read_ms;
+    else
+      mEdge = predicted + (error > 0);
+    mSecond = second;
+  }
+
+  // Shown and edited as local time; the RTC keeps UTC
+  void load_state(){
+    mNow = zone.local(rtc_read());
   }
   
+  void save_state(){
+    rtc_write(zone.to_utc(mNow));
+  }
+
 };
 
 
-#include "RTClib.h"
+// A window showing one timer from the bank
+class TimerView: public Window
+{
+public:
+  TimerView (TimerBank * bank, unsigned char id):
+    mBank(bank),
+    mId(id)
+  {}
 
-extern RTC_DS1307 rtc;
+  // Show a different timer
+  virtual void bind (unsigned char id)
+  {
+    mId = id;
+  }
 
-class RTCClock: public Window
+protected:
+  TimerBank * mBank;
+  unsigned char mId;
+};
+
+
+// Samples in the countdown's colour ramp (3 bytes each)
+const byte kRampSteps = 24;
+
+// ClockTimer's screen: the time on row 2, arrows under the field
+// being edited, and the talk (from the schedule) on row 0
+const WidgetSpot kClockTimerSpots[] PROGMEM = {
+  {0, 0, 0, 0},                 // not editing
+  TIME_EDIT_SPOTS
+};
+
+const WidgetSpec kClockTimerWidgets[] PROGMEM = {
+  {k_widget_number, 2, 6, 3, kFmtHour, nullptr, nullptr},
+  {k_widget_number, 2, 9, 3, kFmtTimePart, nullptr, nullptr},
+  {k_widget_number, 2, 12, 4, kFmtSec, nullptr, nullptr},
+  {k_widget_marker, 0, 0, 4, nullptr, nullptr, kClockTimerSpots},
+  {k_widget_text, 0, 6, kScheduleLabel, nullptr, nullptr, nullptr},
+};
+
+class ClockTimer: public TimerView
 {
 public:
-  RTCClock ():
+  ClockTimer (TimerBank * bank, unsigned char id):
+    TimerView(bank, id),
     mEditState(k_none),
-    mLast(millis()),
-    mNow(F(__DATE__), F(__TIME__))
-  {}
+    hr(0),
+    minu(12),
+    sec(00),
+    mScreen(kClockTimerWidgets)
+  {
+    mScreen.bind(0, &hr);
+    mScreen.bind(1, &minu);
+    mScreen.bind(2, &sec);
+    mScreen.bind(3, &mEditState);
+    mScreen.bind(4, &mTitle);
+  }
+
+  // Text over the time (nullptr for none). A new pointer redraws by
+  // itself; the same one is drawn again, as the text may have changed.
+  void set_title (const char * title)
+  {
+    if (title && title == mTitle)
+      mScreen.invalidate(4);
+    mTitle = title;
+  }
+
+
+  // Colours of the digits by time left: keys in order of time (see
+  // ColourRamp). Past time uses the colour at 0.
+  void set_colours (const ColourKey * keys, byte n)
+  {
+    mRamp.build(keys, n);
+  }
 
+  // Flash the digits white for a while (a cue). Over time, the
+  // breathing takes over. Only while this window is showing: the
+  // overlay is the face's, and other windows don't clear it.
+  void flash (unsigned int ms)
+  {
+    if (!mgr || mgr->showing() != this)
+      return;
+    mFlashEnd = millis() + ms;
+    animator.set_overlay(Effect(k_curve_pulse, {0x3F,0x3F,0x3F}, {0x00,0x00,0x00}, 500));
+  }
 
   virtual void up ()
   {
     switch(mEditState)
       {
-      case k_day:
-        mNow = mNow + TimeSpan(1,0,0,0); break;
-
-      case k_month:
-        mNow = mNow + TimeSpan(30,0,0,0); break;
-
-      case k_year:
-        mNow = mNow + TimeSpan(365,0,0,0); break;
-
       case k_hr:
-        mNow = mNow + TimeSpan(0,1,0,0);; break;
+        hr ++; break;
 
       case k_min:
-        mNow = mNow + TimeSpan(0,0,1,0); break;
+        minu ++; break;
 
       case k_sec:
-       mNow = mNow + TimeSpan(0,0,0,1); break;                   
+        sec ++; break;                   
                   
       default:
       case k_none:
         break;
       }
-      save_state();
+    update_forward();
   }
 
   
@@ -584,29 +811,20 @@ public:
   {
     switch(mEditState)
       {
-      case k_day:
-        mNow = mNow - TimeSpan(1,0,0,0); break;
-
-      case k_month:
-        mNow = mNow - TimeSpan(30,0,0,0); break;
-
-      case k_year:
-        mNow = mNow - TimeSpan(365,0,0,0); break;
-
       case k_hr:
-        mNow = mNow - TimeSpan(0,1,0,0);; break;
+        hr --; break;
 
       case k_min:
-        mNow = mNow - TimeSpan(0,0,1,0); break;
+        minu --; break;
 
       case k_sec:
-       mNow = mNow - TimeSpan(0,0,0,1); break;                   
+        sec --; break;                   
                   
       default:
       case k_none:
         break;
       }
-      save_state();
+    update_backward();
   }
 
   
@@ -621,15 +839,6 @@ public:
   {
     switch(mEditState)
       {
-      case k_day:
-        mEditState = k_month; break;
-
-      case k_month:
-        mEditState = k_year; break;
-
-      case k_year:
-        mEditState = k_hr; break;
-
       case k_hr:
         mEditState = k_min; break;
 
@@ -637,167 +846,238 @@ public:
         mEditState = k_sec; break;
 
       case k_sec:
-        // Write data to the RTC
-        mEditState = k_none; break;      
-                  
+        // Count down from the time entered (not a talk's any more)
+        mBank->set(mId, hr * 3600L + minu * 60 + sec);
+        mBank->start(mId);
+        set_title(nullptr);
+        mEditState = k_none; break;
+
       default:
       case k_none:
-        mEditState = k_day; break;
+        if (mBank->state(mId) == TimerBank::k_running)
+          {
+            mBank->pause(mId);
+            break;
+          }
+        if (mBank->state(mId) == TimerBank::k_over)
+          mBank->reset(mId);
+        // Edit from the time showing
+        split(mBank->seconds(mId));
+        mEditState = k_hr; break;
       }
-    mNeedsClear = true;
   }
 
   // Draw the window
   virtual void draw(OLED * disp)
   {
-    if(mNeedsClear)
-    {
-      disp->clear();
-      mNeedsClear = false;
-    }
-    
-    //if(millis() - mLast > 1000)
-    //  {
-    //    mLast = millis();
-        load_state();
-    //  }
+    // Show the timer, unless it is being edited
+    bool over = mBank->state(mId) == TimerBank::k_over;
+    if (mEditState == k_none)
+      {
+        long left = mBank->seconds(mId);
+        split(left < 0 ? -left : left);
+      }
     
+    // Draw time (only what changed)
+    mScreen.draw(disp);
     
-    // Draw time
-    char buf [20];
-    sprintf(buf, "%4d-%02d-%02d  ", mNow.year(), mNow.month(), mNow.day());
-    disp->set_point(1,3);
-    disp->write(buf);
+    // LEDs. While the timer runs, the frame for the next second is
+    // built just ahead of time and sent on the edge.
+    bool ticking = mEditState == k_none
+      && mBank->state(mId) != TimerBank::k_stopped;
+    if (!ticking)
+      face.disarm();
+
+    if (animator.armed())
+      ;
+    else if (ticking && mBank->ms_to_change(mId) <= kPrerenderMs)
+      {
+        long next = mBank->seconds(mId) - 1;
+        show_leds(next < 0 ? -next : next, next <= 0);
+        animator.arm(timebase.micros_at(timebase.now() + mBank->ms_to_change(mId)));
+      }
+    else
+      show_leds((long)hr * 3600 + minu * 60 + sec, over);
+  }
+  
+  
+private:
+  typedef enum {k_none, k_hr, k_min, k_sec} state_t;
 
-    sprintf(buf, "%2d:%02d:%02d  ", mNow.hour(), mNow.minute(), mNow.second());
-    disp->set_point(2,6);
-    disp->write(buf);
-    
-    CRGB Colour = {0x00,0x1F,0};
-    
-    sprintf(buf, "%02d%02d%02d", mNow.hour(), mNow.minute(), mNow.second());
-    
-    set_segment_display(leds, kDigitStart[0], get_rep(buf[0]), Colour);
-    set_segment_display(leds, kDigitStart[1], get_rep(buf[1]), Colour);
-    set_segment_display(leds, kDigitStart[2], get_rep(buf[2]), Colour);
-    set_segment_display(leds, kDigitStart[3], get_rep(buf[3]), Colour);
-    set_segment_display(leds, kDigitStart[4], get_rep(buf[4]), Colour);
-    set_segment_display(leds, kDigitStart[5], get_rep(buf[5]), Colour);
-    
-    if(mNow.second()%2){
-        set_colon(leds,kDigitStart[1],{0x00,0x1F,0});
-        set_colon(leds,kDigitStart[3],{0x00,0x1F,0});
-    } else {
-        set_colon(leds,kDigitStart[1],{0x00,0x0F,0x0F});
-        set_colon(leds,kDigitStart[3],{0x00,0x0F,0x0F});
-    }
+  // A state_t (a byte, so the marker can be bound to it)
+  unsigned char mEditState;
+  // Time being shown (or edited)
+  unsigned char hr, minu, sec;
+
+  ColourRamp<kRampSteps> mRamp;
+  unsigned long mFlashEnd = 0;
+
+  const char * mTitle = nullptr;
+
+  WidgetLayer<5> mScreen;
+
+  void split (long secs)
+  {
+    hr = secs / 3600;
+    minu = (secs / 60) % 60;
+    sec = secs % 60;
+  }
+
+  // Put a time (s, and whether it is over time) on the LEDs
+  void show_leds (unsigned long secs, bool over)
+  {
+    int hr = secs / 3600;
+    int minu = (secs / 60) % 60;
+    int sec = secs % 60;
+
+    CRGB Colour = mRamp.colour(over ? 0 : secs);
+
+    // Breathe over the top when over time
+    if (over)
+      animator.set_overlay(Effect(k_curve_breathe, {0x40,0x00,0x00}, {0x10,0x00,0x10}, 2000));
+    else if ((long)(millis() - mFlashEnd) < 0)
+      ;
+    else
+      animator.clear_overlay();
     
-    FastLED.show();
+    char buf [8];
+    sprintf(buf, "%02d%02d%02d", hr, minu, sec);
 
-    // Draw highlight
-    switch(mEditState)
+    if (hr > 0)
       {
-      case k_day:
-        disp->set_point(0,11); disp->write("\x1B\x1B"); break;
-        
-      case k_month:
-        disp->set_point(0,8); disp->write("\x1B\x1B"); break;
-        
-      case k_year:
-        disp->set_point(0,3); disp->write("\x1B\x1B\x1B\x1B"); break;
-        
-      case k_hr:
-        disp->set_point(3,6); disp->write("\x1A\x1A"); break;
-        
-      case k_min:
-        disp->set_point(3,9); disp->write("\x1A\x1A"); break;
+        // Use all six characters
+        for (unsigned char d = 0; d < kNumDigits; ++d)
+          face.set_digit(d, get_rep(buf[d]), Colour);
+    
+        face.set_colons((sec%2) ? 0b001010 : 0, Colour);
+      }
+    else
+      {
+        // Use 4 middle characters
+        face.set_digit(1, get_rep(buf[2]), Colour);
+        face.set_digit(2, get_rep(buf[3]), Colour);
+        face.set_digit(3, get_rep(buf[4]), Colour);
+        face.set_digit(4, get_rep(buf[5]), Colour);
 
-      case k_sec:
-        disp->set_point(3,12); disp->write("\x1A\x1A"); break;
+        face.set_digit(0, 0, Colour);
+        face.set_digit(5, 0, Colour);
         
-      default:
-      case k_none:
-        break;
+        face.set_colons((sec%2) ? 0b000100 : 0, Colour);
       }
-      
   }
-  
-  
-private:
-  typedef enum {k_none, k_day, k_month, k_year, k_hr, k_min, k_sec} edit_t;
 
-  edit_t mEditState;
+  // Update moving forward in time
+  void update_forward ()
+  {
+    // Update times
+    if(sec > 59)
+      {sec = 0; minu ++;}
+    if(minu > 59)
+      {minu = 0; hr ++;}
 
-  DateTime mNow;
-  unsigned long mLast = 0;
+    if (hr > 99)
+      {hr = 0;}
+  }
 
-  bool mNeedsClear = false;
-  
-  void load_state(){
-    mNow =  rtc.now();
+  // Update moving backwards in time
+  void update_backward ()
+  {
+    if(sec > 59)
+      {sec = 59; minu --;}
+    if(minu > 59)
+      {minu = 59; hr --;}
+    if (hr > 99)
+      {hr = 99;}
   }
+
+
   
-  void save_state(){
-    rtc.adjust(mNow);
-  }
+};
 
+// Stopwatch times, for its widgets
+void format_elapsed (char * buf, long tenths)
+{
+  unsigned long t = tenths;
+  unsigned long s = t / 10;
+  if (s < 3600)
+    sprintf(buf, "%02lu:%02lu.%lu", s / 60, s % 60, t % 10);
+  else
+    sprintf(buf, "%2lu:%02lu:%02lu", s / 3600, (s / 60) % 60, s % 60);
+}
+
+void format_lap (char * buf, long ms)
+{
+  unsigned long t = ms;
+  unsigned long s = t / 1000;
+  sprintf(buf, "%02lu:%02lu.%02lu", s / 60, s % 60, (t % 1000) / 10);
+}
+
+void format_split (char * buf, long ms)
+{
+  strcpy(buf, "  split ");
+  format_lap(buf + 8, ms);
+}
+
+// CountUp's screens: the time on row 2 (tenths on the OLED), and the
+// lap being looked at on rows 0 and 1 when there are any
+const char kFmtLapNumber[] PROGMEM = "Lap %-3ld ";
+
+const WidgetSpec kCountUpWidgets[] PROGMEM = {
+  {k_widget_number, 2, 6, 10, nullptr, &format_elapsed, nullptr},
 };
 
+const WidgetSpec kLapWidgets[] PROGMEM = {
+  {k_widget_number, 0, 0, 8, kFmtLapNumber, nullptr, nullptr},
+  {k_widget_number, 0, 8, 8, nullptr, &format_lap, nullptr},
+  {k_widget_number, 1, 0, 16, nullptr, &format_split, nullptr},
+};
 
-class ClockTimer: public Window
+// Stopwatch: MM:SS.cc for the first hour, then HH:MM:SS. Up takes a
+// lap while running, and steps back through the laps when stopped.
+class CountUp: public TimerView
 {
 public:
-  ClockTimer ():
-    mEditState(k_none),
-    mLast(millis()),
-    hr(0),
-    minu(12),
-    sec(00),
-    hr_start(0),
-    minu_start(0),
-    sec_start(0)
-  {}
+  CountUp (TimerBank * bank, unsigned char id):
+    TimerView(bank, id),
+    mScreen(kCountUpWidgets),
+    mLapScreen(kLapWidgets)
+  {
+    mScreen.bind(0, &mTenths);
+    mLapScreen.bind(0, &mLapNumber);
+    mLapScreen.bind(1, &mLapMs);
+    mLapScreen.bind(2, &mSplitMs);
+  }
 
 
   virtual void up ()
   {
-    switch(mEditState)
+    if (mBank->state(mId) == TimerBank::k_running)
       {
-      case k_hr:
-        hr ++; break;
-
-      case k_min:
-        minu ++; break;
-
-      case k_sec:
-        sec ++; break;                   
-                  
-      default:
-      case k_none:
-        break;
+        // Time the lap from the button press, not from now
+        unsigned long late_us = micros() - timebase.input_us();
+        unsigned long lap = mBank->ms(mId) + (timebase.stamp().ms - timebase.now()) - late_us / 1000;
+        mLaps.push(lap);
+        mShowLap = 0;
+
+        LOG(k_log_lap, lap, mLaps.total());
+        LOG(k_log_lap_input, late_us, 0);
+      }
+    else if (mLaps.count())
+      {
+        mShowLap = (mShowLap + 1) % mLaps.count();
       }
-    update_forward();
   }
 
   
   virtual void down ()
   {
-    switch(mEditState)
-      {
-      case k_hr:
-        hr --; break;
-
-      case k_min:
-        minu --; break;
-
-      case k_sec:
-        sec --; break;                   
-                  
-      default:
-      case k_none:
-        break;
-      }
-    update_backward();
+    bool running = mBank->state(mId) == TimerBank::k_running;
+    mBank->reset(mId);
+    if (running)
+      mBank->start(mId);
+    mLaps.clear();
+    // The lap lines go
+    mNeedsClear = true;
   }
 
   
@@ -810,27 +1090,16 @@ public:
   
   virtual void enter ()
   {
-    switch(mEditState)
-      {
-      case k_hr:
-        mEditState = k_min; break;
-
-      case k_min:
-        mEditState = k_sec; break;
-
-      case k_sec:
-        hr_start = hr; minu_start = minu; sec_start = sec;          
-        mEditState = k_run; break;
+    if (mBank->state(mId) == TimerBank::k_running)
+      mBank->pause(mId);
+    else
+      mBank->start(mId);
+  }
 
-      case k_run:
-        mEditState = k_none; break;
-      case k_done:
-        hr = hr_start; minu = minu_start; sec = sec_start;
-      default:
-      case k_none:
-        mEditState = k_hr; break;
-      }
-    mNeedsClear = true;
+  virtual void bind (unsigned char id)
+  {
+    TimerView::bind(id);
+    mLaps.clear();
   }
 
   // Draw the window
@@ -841,397 +1110,636 @@ public:
       disp->clear();
       mNeedsClear = false;
     }
-    
-    // Draw time
-    char buf [20];
 
-    sprintf(buf, "%2d:%02d:%02d  ", hr, minu, sec);
-    disp->set_point(2,6);
-    disp->write(buf);
-    
-    CRGB Colour = {0x0F,0x1F,0};
+    unsigned long ms = mBank->ms(mId);
+    unsigned long elapsed = ms / 1000;
+    bool running = mBank->state(mId) == TimerBank::k_running;
+    bool centi = elapsed < 3600;
 
-    if (hr > 0 || minu > 3)
-      {
-        Colour.r = 0x00;
-        Colour.g = 0x20;
-        Colour.b = 0x00;
-      }
+    CRGB Colour = {0x0F,0x1F,0};
 
-    if (hr == 0 && minu < 3)
+    unsigned char d[kNumDigits];
+    if (centi)
       {
-        Colour.r = 0x1F;
-        Colour.g = 0x1F;
-        Colour.b = 0x00;
+        split(d, elapsed / 60, elapsed % 60, (ms % 1000) / 10);
+        face.set_colons(0b000010, Colour);
+        face.set_decimal(3, Colour);
       }
-
-    if (hr == 0 && minu < 1)
+    else
       {
-        Colour.r = 0x40;
-        Colour.g = 0x00;
-        Colour.b = 0x00;
+        split(d, elapsed / 3600, (elapsed / 60) % 60, elapsed % 60);
+        face.set_colons(((elapsed % 2) ? 0b001010 : 0), Colour);
+        face.set_decimal(3, {0,0,0});
       }
-      
-    if (mEditState == k_done)
-    {
-        if(sec % 2){
-            Colour.r = 0x40;
-            Colour.g = 0x00;
-            Colour.b = 0x00;
-        } else {
-            Colour.r = 0x10;
-            Colour.g = 0x00;
-            Colour.b = 0x10;
-        }
-    }
-    
-    sprintf(buf, "%02d%02d%02d", hr, minu, sec);
+    for (unsigned char i = 0; i < kNumDigits; ++i)
+      face.set_digit(i, get_rep('0' + d[i]), Colour);
 
-    set_colon(leds,kDigitStart[0],{0,0,0});
-    set_colon(leds,kDigitStart[1],{0,0,0});
-    set_colon(leds,kDigitStart[2],{0,0,0});
-    set_colon(leds,kDigitStart[3],{0,0,0});
-    set_colon(leds,kDigitStart[4],{0,0,0});
-    set_colon(leds,kDigitStart[5],{0,0,0});
-    
-    if (hr > 0)
+    // Hundredths need a frame every 10 ms, and no crossfades
+    if (running && centi)
       {
-        // Use all six characters
-        set_segment_display(leds, kDigitStart[0], get_rep(buf[0]), Colour);
-        set_segment_display(leds, kDigitStart[1], get_rep(buf[1]), Colour);
-        set_segment_display(leds, kDigitStart[2], get_rep(buf[2]), Colour);
-        set_segment_display(leds, kDigitStart[3], get_rep(buf[3]), Colour);
-        set_segment_display(leds, kDigitStart[4], get_rep(buf[4]), Colour);
-        set_segment_display(leds, kDigitStart[5], get_rep(buf[5]), Colour);
-    
-        if(sec%2){
-          set_colon(leds,kDigitStart[1],Colour);
-          set_colon(leds,kDigitStart[3],Colour);
-        } else {
-          set_colon(leds,kDigitStart[1],{0,0,0});
-          set_colon(leds,kDigitStart[3],{0,0,0});
-        }
+        animator.set_frame_period(10);
+        face.set_transition(Compositor::k_trans_cut, 0);
       }
     else
       {
-        // Use 4 middle characters
-        set_segment_display(leds, kDigitStart[1], get_rep(buf[2]), Colour);
-        set_segment_display(leds, kDigitStart[2], get_rep(buf[3]), Colour);
-        set_segment_display(leds, kDigitStart[3], get_rep(buf[4]), Colour);
-        set_segment_display(leds, kDigitStart[4], get_rep(buf[5]), Colour);
+        animator.set_frame_period(kFramePeriod);
+        face.default_transition();
+      }
 
-        set_segment_display(leds, kDigitStart[0], 0, Colour);
-        set_segment_display(leds, kDigitStart[5], 0, Colour);
-        
-        if(sec%2){
-          set_colon(leds,kDigitStart[2],Colour);
-        } else {
-          set_colon(leds,kDigitStart[2],{0,0,0});
+    // The OLED only needs tenths, which keeps the I2C traffic down
+    mTenths = ms / 100;
+    mScreen.draw(disp);
 
-        }
+    // The lap being looked at, and its split from the one before
+    if (mLaps.count())
+      {
+        unsigned long lap = mLaps.get(mShowLap);
+        unsigned long prev = (mShowLap + 1 < mLaps.count()) ? mLaps.get(mShowLap + 1) : 0;
+        if (mShowLap + 1 == mLaps.count() && mLaps.total() > mLaps.count())
+          prev = lap; // Older lap has dropped out of the ring
+
+        mLapNumber = mLaps.total() - mShowLap;
+        mLapMs = lap;
+        mSplitMs = lap - prev;
+        mLapScreen.draw(disp);
       }
-    
-    FastLED.show();
+  }
+  
+  
+private:
 
-    // Draw highlight
-    switch(mEditState)
-      {
-        
-      case k_hr:
-        disp->set_point(3,6); disp->write("\x1A\x1A"); break;
-        
-      case k_min:
-        disp->set_point(3,9); disp->write("\x1A\x1A"); break;
+  LapRing<8> mLaps;
+  unsigned char mShowLap = 0;
 
-      case k_sec:
-        disp->set_point(3,12); disp->write("\x1A\x1A"); break;
-        
-      default:
-        break;
-      }
-    
+  // What the OLED shows, and the layers showing it
+  unsigned long mTenths = 0;
+  unsigned int mLapNumber = 0;
+  unsigned long mLapMs = 0;
+  unsigned long mSplitMs = 0;
+  WidgetLayer<1> mScreen;
+  WidgetLayer<3> mLapScreen;
 
-    switch(mEditState)
-      {
+  bool mNeedsClear = false;
 
-      case k_run:
-        while(millis() - mLast > 1000)
-          {
-            mLast += 1000;
-            sec --;
-            update_backward();
+  static void split (unsigned char * d, unsigned char a, unsigned char b, unsigned char c)
+  {
+    d[0] = a / 10 % 10; d[1] = a % 10;
+    d[2] = b / 10;      d[3] = b % 10;
+    d[4] = c / 10;      d[5] = c % 10;
+  }
 
-            if (hr == 0 && minu == 0 && sec == 0)
-              {
-                mEditState = k_done;
-                break;
-              }
-          }
-        break;
-      case k_done:
-          // Over time
-           while(millis() - mLast > 1000)
+};
+
+
+// Every timer in the bank. Enter opens the selected one (on the LED
+// digits) in the view for its kind.
+class TimerList: public Window
+{
+public:
+  TimerList (TimerBank * bank, TimerView * countdown_view, TimerView * stopwatch_view):
+    mBank(bank),
+    mCountdownView(countdown_view),
+    mStopwatchView(stopwatch_view)
+  {}
+
+  virtual void down ()
+  {
+    ind = (ind + 1) % mBank->count();
+  }
+
+  virtual void up ()
+  {
+    if(ind == 0)
+      ind = mBank->count() - 1;
+    else
+      ind--;
+  }
+
+  virtual void enter ()
+  {
+    TimerView * view = mBank->kind(ind) == TimerBank::k_stopwatch
+      ? mStopwatchView : mCountdownView;
+    view->bind(ind);
+    mgr->load(view);
+  }
+
+  virtual void back ()
+  {
+    if(parent)
+      mgr->load(parent);
+  }
+
+  virtual void draw (OLED * disp)
+  {
+    // Keep the selection on screen
+    unsigned char start = 0;
+    if (ind >= DISP_HEIGHT)
+      start = ind - DISP_HEIGHT + 1;
+
+    char buf [24];
+    for (unsigned char i = 0; i < DISP_HEIGHT && start + i < mBank->count(); ++i)
+      {
+        unsigned char id = start + i;
+        long secs = mBank->seconds(id);
+        char sign = ' ';
+        if (secs < 0)
           {
-            mLast += 1000;
-            sec ++;
-            update_forward();
+            sign = '+';
+            secs = -secs;
           }
-        break;
-      default:
-        mLast = millis();
-      }
 
+        static const char kStateChar[] = {' ', '>', '!'};
+        sprintf(buf, "%s%c%d %c%c%2ld:%02ld:%02ld",
+                id == ind ? "->" : "  ",
+                mBank->kind(id) == TimerBank::k_stopwatch ? 'S' : 'C',
+                id + 1,
+                kStateChar[mBank->state(id)],
+                sign,
+                secs / 3600, (secs / 60) % 60, secs % 60);
+        disp->set_point(i, 0);
+        disp->write(buf);
+      }
   }
-  
-  
+
 private:
-  typedef enum {k_none, k_hr, k_min, k_sec, k_run, k_done} state_t;
+  TimerBank * mBank;
+  TimerView * mCountdownView;
+  TimerView * mStopwatchView;
 
-  state_t mEditState;
-  unsigned char hr, minu, sec;
-  unsigned char hr_start, minu_start, sec_start;
+  // Currently selected timer
+  unsigned char ind = 0;
+};
 
-  unsigned long mLast;
+// Frame period while streaming: frames go out as fast as they come,
+// up to 200 fps
+const unsigned char kStreamFramePeriod = 5;
+
+// The digits, driven by a host (tools/led_stream.py) through Remote.
+// Remote opens this window when the first streamed frame arrives;
+// back returns to the window that was showing.
+//
+// Palette frames set host colours, by index:
+//
+//   first index, then r g b for it and the entries after it
+//
+// Digit frames change the digits in a mask, keeping the rest from the
+// frame before (so a keyframe is just a frame with every bit set):
+//
+//   mask (bit per digit), then a record per digit in the mask:
+//     byte 0:  bit 7 pixel mode, bits 6-0 segments (0abcdefg)
+//     byte 1:  bits 7-4 colour index, bits 3-2 repeat, bit 1 colon,
+//              bit 0 decimal point
+//     pixel mode only: 3 bytes, bit i lights pixel i (set_pixel_mask())
+//
+// A record with a repeat of n also covers the next n digits in the
+// mask, which makes runs of blank or same-glyph digits cheap.
+class StreamView: public Window
+{
+public:
+  static const unsigned char kPaletteSize = 16;
 
-  bool mNeedsClear = false;
+  StreamView ()
+  {
+    memset(mPalette, 0, sizeof(mPalette));
+    mPalette[1] = CRGB(0x0F, 0x1F, 0);
+  }
 
-  // Update moving forward in time
-  void update_forward ()
+  // Show the stream, coming back to the current window on back
+  void open (WindowManager * manager)
   {
-    // Update times
-    if(sec > 59)
-      {sec = 0; minu ++;}
-    if(minu > 59)
-      {minu = 0; hr ++;}
+    if (manager->showing() == this)
+      return;
+    mFrom = manager->showing();
+    manager->load(this);
+    mNeedsClear = true;
+  }
 
-    if (hr > 99)
-      {hr = 0;}
+  void palette (const byte * p, unsigned char len)
+  {
+    if (!len)
+      return;
+    for (unsigned char i = p[0], pos = 1; i < kPaletteSize && pos + 3 <= len; ++i, pos += 3)
+      mPalette[i] = CRGB(p[pos], p[pos + 1], p[pos + 2]);
   }
 
-  // Update moving backwards in time
-  void update_backward ()
+  // Returns false if the frame was cut short (the digits decoded so far
+  // are still shown)
+  bool frame (const byte * p, unsigned char len)
   {
-    if(sec > 59)
-      {sec = 59; minu --;}
-    if(minu > 59)
-      {minu = 59; hr --;}
-    if (hr > 99)
-      {hr = 99;}
+    if (!len)
+      return false;
+    byte mask = p[0];
+    unsigned char pos = 1;
+    unsigned char repeat = 0;
+    byte rec0 = 0, rec1 = 0;
+    unsigned long pixels = 0;
+    mFrames ++;
+
+    for (unsigned char d = 0; d < kNumDigits; ++d)
+      {
+        if (!(mask & (1 << d)))
+          continue;
+        if (repeat)
+          repeat --;
+        else
+          {
+            if (pos + 2 > len)
+              return false;
+            rec0 = p[pos++];
+            rec1 = p[pos++];
+            repeat = (rec1 >> 2) & 0x03;
+            if (rec0 & 0x80)
+              {
+                if (pos + 3 > len)
+                  return false;
+                pixels = p[pos] | (unsigned long)p[pos + 1] << 8
+                  | (unsigned long)p[pos + 2] << 16;
+                pos += 3;
+              }
+          }
+
+        CRGB colour = mPalette[rec1 >> 4];
+        if (rec0 & 0x80)
+          face.set_digit_pixels(d, pixels, colour);
+        else
+          face.set_digit(d, rec0, colour);
+        face.set_colon(d, (rec1 & 0x02) ? colour : CRGB(0, 0, 0));
+        face.set_decimal(d, (rec1 & 0x01) ? colour : CRGB(0, 0, 0));
+      }
+    return true;
+  }
+
+  virtual void back ()
+  {
+    if (mFrom)
+      mgr->load(mFrom);
   }
 
+  virtual void draw (OLED * disp)
+  {
+    // The host owns the digits: frames go out as soon as they change
+    animator.set_frame_period(kStreamFramePeriod);
+    face.set_transition(Compositor::k_trans_cut, 0);
 
-  
+    if (mNeedsClear)
+      {
+        disp->clear();
+        disp->set_point(0, 0);
+        disp->write("Streaming");
+        mNeedsClear = false;
+        mLastReport = millis();
+        mFrames = 0;
+      }
+
+    // Frames a second, once a second
+    if (millis() - mLastReport < 1000)
+      return;
+    mLastReport += 1000;
+    char buf [21];
+    sprintf(buf, "%3u frames/s  ", mFrames);
+    mFrames = 0;
+    disp->set_point(2, 0);
+    disp->write(buf);
+  }
+
+private:
+  CRGB mPalette[kPaletteSize];
+  Window * mFrom = nullptr;
+  bool mNeedsClear = true;
+  unsigned int mFrames = 0;
+  unsigned long mLastReport = 0;
 };
 
-class CountUp: public Window
+// Throughput tests on the clock itself (src/Bench.h): LED frames,
+// digit renders, OLED screens, RTC reads, and the loop rate with each
+// window added here showing. Enter runs them, one per draw so the
+// progress shows; each takes kBenchMs, and the clock doesn't respond
+// meanwhile. Results go to the OLED (up and down scroll) and over
+// serial as "bench <name> <rate> /s", with the percentage of what the
+// wires allow where they set the limit, so units can be compared.
+class BenchView: public Window
 {
 public:
-  CountUp ():
-    mLast(millis()),
-    hr(0),
-    minu(0),
-    sec(0),
-    mRunning(false)
-      {}
+  static const unsigned char kMaxWindows = 6;
 
+  // loop runs the whole main loop once, for the loop rates
+  BenchView (void (* loop) ()):
+    mLoop(loop)
+  {}
 
-  virtual void up ()
+  // Measure the loop rate with this window showing
+  void add (Window * wind, const char * label)
   {
+    if (mNumWindows == kMaxWindows)
+      return;
+    mWindows[mNumWindows] = wind;
+    mLabels[mNumWindows] = label;
+    mNumWindows ++;
+  }
 
+  virtual void up ()
+  {
+    if (mTop)
+      mTop --;
   }
 
-  
   virtual void down ()
   {
-    hr = minu = sec = 0;
+    if (mTop + DISP_HEIGHT < lines())
+      mTop ++;
   }
 
-  
   virtual void back ()
   {
-    if(parent)
+    if (mMeasuring)
+      return;
+    if (running())
+      mStep = kIdle;
+    if (parent)
       mgr->load(parent);
   }
 
-  
   virtual void enter ()
   {
-    mRunning = !mRunning;
+    if (mMeasuring)
+      return;
+    mStep = 0;
+    mTop = 0;
   }
 
-  // Draw the window
-  virtual void draw(OLED * disp)
+  virtual void draw (OLED * disp)
   {
-    if(mNeedsClear)
-    {
-      disp->clear();
-      mNeedsClear = false;
-    }
-    
-    // Draw time
-    char buf [20];
+    char buf [24];
+    // The loop being measured can load this window again (the menu,
+    // the remote): it mustn't start measuring inside itself
+    if (mMeasuring)
+      return;
+    if (running())
+      {
+        run_step(disp);
+        return;
+      }
+    if (!mDone)
+      {
+        disp->set_point(0, 0);
+        disp->write("Benchmarks");
+        disp->set_point(2, 0);
+        disp->write("Enter to run (~");
+        sprintf(buf, "%us)", (k_num_tests + mNumWindows) * kBenchMs / 1000);
+        disp->write(buf);
+        return;
+      }
+    for (unsigned char i = 0; i < DISP_HEIGHT && mTop + i < lines(); ++i)
+      {
+        format(mTop + i, buf);
+        disp->set_point(i, 0);
+        disp->write(buf);
+      }
+  }
 
-    sprintf(buf, "%2d:%02d:%02d  ", hr, minu, sec);
-    disp->set_point(2,6);
-    disp->write(buf);
-    
-    CRGB Colour = {0x0F,0x1F,0};
+private:
+  typedef enum {k_bench_led, k_bench_segments, k_bench_oled, k_bench_rtc, k_num_tests} test_t;
+  static const unsigned char kIdle = 0xFF;
+
+  void (* mLoop) ();
+  Window * mWindows[kMaxWindows];
+  const char * mLabels[kMaxWindows];
+  unsigned char mNumWindows = 0;
+
+  // Calls a second: the tests, then the loop rate per window
+  unsigned int mRates[k_num_tests + kMaxWindows];
+  unsigned char mStep = kIdle;
+  bool mDone = false;
+  bool mMeasuring = false;       // inside mLoop(), for a loop rate
+  unsigned char mTop = 0;
+
+  bool running () const
+  {
+    return mStep < k_num_tests + mNumWindows;
+  }
 
-    
-    sprintf(buf, "%02d%02d%02d", hr, minu, sec);
+  // A line per result, and one for the OLED's bytes
+  unsigned char lines () const
+  {
+    return k_num_tests + 1 + mNumWindows;
+  }
 
-    set_colon(leds,kDigitStart[0],{0,0,0});
-    set_colon(leds,kDigitStart[1],{0,0,0});
-    set_colon(leds,kDigitStart[2],{0,0,0});
-    set_colon(leds,kDigitStart[3],{0,0,0});
-    set_colon(leds,kDigitStart[4],{0,0,0});
-    set_colon(leds,kDigitStart[5],{0,0,0});
-    
-    if (hr > 0)
+  // Result line i: its name, rate, and the rate the wires allow (0 if
+  // they don't set the limit)
+  const char * result (unsigned char i, unsigned int * rate, unsigned int * nominal) const
+  {
+    static const char * const kNames[] = {"LED", "Segments", "OLED", "OLED B", "RTC"};
+    static const unsigned int kNominal[] = {kLEDShowRate, 0, kOLEDScreenRate, 0, kRTCReadRate};
+    *nominal = 0;
+    if (i == k_bench_oled + 1)
       {
-        // Use all six characters
-        set_segment_display(leds, kDigitStart[0], get_rep(buf[0]), Colour);
-        set_segment_display(leds, kDigitStart[1], get_rep(buf[1]), Colour);
-        set_segment_display(leds, kDigitStart[2], get_rep(buf[2]), Colour);
-        set_segment_display(leds, kDigitStart[3], get_rep(buf[3]), Colour);
-        set_segment_display(leds, kDigitStart[4], get_rep(buf[4]), Colour);
-        set_segment_display(leds, kDigitStart[5], get_rep(buf[5]), Colour);
-    
-        if(sec%2){
-          set_colon(leds,kDigitStart[1],Colour);
-          set_colon(leds,kDigitStart[3],Colour);
-        } else {
-          set_colon(leds,kDigitStart[1],{0,0,0});
-          set_colon(leds,kDigitStart[3],{0,0,0});
-        }
+        unsigned long bytes = (unsigned long)mRates[k_bench_oled] * kOLEDScreenBytes;
+        *rate = bytes > 0xFFFF ? 0xFFFF : bytes;
+        return kNames[i];
       }
-    else
+    unsigned char r = i > k_bench_oled ? i - 1 : i;
+    *rate = mRates[r];
+    if (i <= k_num_tests)
       {
-        // Use 4 middle characters
-        set_segment_display(leds, kDigitStart[1], get_rep(buf[2]), Colour);
-        set_segment_display(leds, kDigitStart[2], get_rep(buf[3]), Colour);
-        set_segment_display(leds, kDigitStart[3], get_rep(buf[4]), Colour);
-        set_segment_display(leds, kDigitStart[4], get_rep(buf[5]), Colour);
+        *nominal = kNominal[i];
+        return kNames[i];
+      }
+    return mLabels[r - k_num_tests];
+  }
 
-        set_segment_display(leds, kDigitStart[0], 0, Colour);
-        set_segment_display(leds, kDigitStart[5], 0, Colour);
-        
-        if(sec%2){
-          set_colon(leds,kDigitStart[2],Colour);
-        } else {
-          set_colon(leds,kDigitStart[2],{0,0,0});
+  void format (unsigned char i, char * buf) const
+  {
+    unsigned int rate, nominal;
+    const char * name = result(i, &rate, &nominal);
+    if (nominal)
+      sprintf(buf, "%-8.8s%7u %3u%%", name, rate, (unsigned int)((unsigned long)rate * 100 / nominal));
+    else
+      sprintf(buf, "%-8.8s%7u/s   ", name, rate);
+  }
 
-        }
-      }
-    
-    FastLED.show();
+  void report (unsigned char i) const
+  {
+    unsigned int rate, nominal;
+    const char * name = result(i, &rate, &nominal);
+    if (i > k_num_tests)
+      Serial.print("loop ");
+    bench_report(name, rate, nominal);
+  }
 
-    
+  static void loop_op (void * self)
+  {
+    ((BenchView *)self)->mLoop();
+  }
 
-    if (mRunning)
+  void run_step (OLED * disp)
+  {
+    unsigned int rate, nominal;
+    unsigned char line = mStep > k_bench_oled ? mStep + 1 : mStep;
+    if (mStep == 0)
+      disp->clear();
+    disp->set_point(0, 0);
+    disp->write("Benchmarking...");
+    disp->set_point(2, 0);
+    disp->write(result(line, &rate, &nominal));
+    disp->write("        ");
+
+    switch (mStep)
       {
-        while(millis() - mLast > 1000)
-          {
-            mLast += 1000;
-            sec ++;
-            update_forward();   
-          }
+      case k_bench_led:
+        mRates[mStep] = bench_rate(&bench_led_op, &leds);
+        break;
+      case k_bench_segments:
+        mRates[mStep] = bench_rate(&bench_segment_op, &leds);
+        // Put the digits back as the layers have them
+        face.invalidate();
+        break;
+      case k_bench_oled:
+        mRates[mStep] = bench_rate(&bench_oled_op, disp);
+        disp->clear();
+        break;
+      case k_bench_rtc:
+        mRates[mStep] = bench_rate(&bench_rtc_op, &rtc);
+        break;
+      default:
+        {
+          // The real loop, as fast as it goes: no sleeping between
+          bool sleep = power.enabled();
+          power.enable(false);
+          mgr->load(mWindows[mStep - k_num_tests]);
+          mMeasuring = true;
+          mRates[mStep] = bench_rate(&loop_op, this);
+          mMeasuring = false;
+          mgr->load(this);
+          power.enable(sleep);
+        }
       }
-    else
+
+    report(line);
+    if (mStep == k_bench_oled)
+      report(line + 1);
+    mStep ++;
+    if (!running())
       {
-        mLast = millis();
+        mDone = true;
+        disp->clear();
       }
-    
-
   }
-  
-  
-private:
+};
 
-  bool mRunning;
-  unsigned char hr, minu, sec;
+// SettingsView's screen, drawn without printf: which setting of how
+// many, its name, and its value with an arrow while it is being
+// changed. The value widget is bound to the setting's id and value
+// together (id << 16 | value), so moving to another setting redraws
+// it even if the value is the same.
+void format_setting_number (char * buf, long id)
+{
+  strcpy_P(buf, PSTR("Setting "));
+  itoa(id + 1, buf + strlen(buf), 10);
+  strcat_P(buf, PSTR(" of "));
+  itoa(k_num_settings, buf + strlen(buf), 10);
+}
 
-  unsigned long mLast;
+void format_setting_name (char * buf, long id)
+{
+  SettingSpec s;
+  Settings::spec(id, &s);
+  strncpy_P(buf, s.name, OLED::kCols);
+}
 
-  bool mNeedsClear = false;
+void format_setting_value (char * buf, long packed)
+{
+  SettingSpec s;
+  Settings::spec(packed >> 16, &s);
+  int value = (int16_t)(packed & 0xFFFF);
+  if (s.type == k_setting_toggle)
+    {
+      strcpy_P(buf, value ? PSTR("On") : PSTR("Off"));
+      return;
+    }
+  if (s.type == k_setting_colour)
+    {
+      static const char kHex[] PROGMEM = "0123456789ABCDEF";
+      buf[0] = '#';
+      for (byte i = 0; i < 3; ++i)
+        buf[1 + i] = pgm_read_byte(kHex + ((value >> (8 - 4 * i)) & 0xF));
+      buf[4] = 0;
+      return;
+    }
+  itoa(value, buf, 10);
+  strcat(buf, " ");
+  strncat_P(buf, s.unit, 8);
+}
 
-  // Update moving forward in time
-  void update_forward ()
-  {
-    // Update times
-    if(sec > 59)
-      {sec = 0; minu ++;}
-    if(minu > 59)
-      {minu = 0; hr ++;}
-  }
-  
+const char kSettingArrow[] PROGMEM = "->";
+
+const WidgetSpot kSettingSpots[] PROGMEM = {
+  {0, 0, 0, 0},                 // choosing a setting
+  {2, 0, 2, 0},                 // changing it
 };
 
-/*
+const WidgetSpec kSettingWidgets[] PROGMEM = {
+  {k_widget_number, 0, 0, 20, nullptr, &format_setting_number, nullptr},
+  {k_widget_number, 1, 0, 20, nullptr, &format_setting_name, nullptr},
+  {k_widget_number, 2, 3, 17, nullptr, &format_setting_value, nullptr},
+  {k_widget_marker, 0, 0, 2, kSettingArrow, nullptr, kSettingSpots},
+};
 
-// This could do with tidying up
-template <typename T> class Modifier : public Window
+// Every setting in the registry (Settings.h), one at a time. Up and
+// down choose a setting; enter starts changing it, and then up and down
+// step it and enter or back finish. Changes take effect at once and
+// are saved a little later.
+class SettingsView: public Window
 {
-
 public:
-  Modifier<T> (const char *name, const char *format, T *ref, T min, T max):
-  mName(name), mValue(ref), mMin(min), mMax(max), mFormat(format), mIncrement(1)
-  {}
-    
-  // Button actions
-  virtual void up ()
+  SettingsView (Settings * settings):
+    mSettings(settings),
+    mScreen(kSettingWidgets)
   {
-    Serial.println("inc");
-    (*mValue) += mIncrement;
-    if (*mValue > mMax) *mValue = mMax;
+    mScreen.bind(0, &mId);
+    mScreen.bind(1, &mId);
+    mScreen.bind(2, &mShown);
+    mScreen.bind(3, &mEditing);
   }
-  
-  virtual void down ()
+
+  virtual void up ()
   {
-    Serial.println("dec");
-    (*mValue) -= mIncrement;
-    if (*mValue < mMin) *mValue = mMin;
+    if (mEditing)
+      mSettings->step(mId, 1);
+    else
+      mId = mId ? mId - 1 : k_num_settings - 1;
   }
 
-  virtual void back ()
+  virtual void down ()
   {
-    if(parent)
-      mgr->load(parent);
+    if (mEditing)
+      mSettings->step(mId, -1);
+    else
+      mId = (mId + 1) % k_num_settings;
   }
 
   virtual void enter ()
   {
+    mEditing = !mEditing;
   }
 
-  // Draw the window
-  virtual void draw(OLED * disp)
+  virtual void back ()
   {
-    char buffer [20];
-
-    disp->set_point(1,0);
-    disp->write(mName);
-
-     PString str(buffer, sizeof(buffer));
-
-    str.print("Val: ");
-    str.print(*mValue);
-    disp->set_point(2,0);
-    disp->write(str);
-
-    str.begin();
-    str.print("Inc: ");
-    str.print(mIncrement);
-    disp->set_point(3,0);
-    disp->write(str);
+    if (mEditing)
+      mEditing = false;
+    else if (parent)
+      mgr->load(parent);
   }
 
+  virtual void draw (OLED * disp)
+  {
+    mShown = (long)mId << 16 | (uint16_t)mSettings->get(mId);
+    mScreen.draw(disp);
+  }
 
- private:
-  T *mValue;
-  T mMin;
-  T mMax;
-  T mIncrement;
-  const char *mName;
-  const char *mFormat;
+private:
+  Settings * mSettings;
+  unsigned char mId = 0;
+  unsigned char mEditing = 0;
+  long mShown = 0;
+  WidgetLayer<4> mScreen;
 };
-*/
@@ -5,10 +5,51 @@
 #define BTN_UP       4
 #define BTN_DOWN     3
 
+// Every button pin in one read: PIND is D0-D7 and PINB D8-D13, so bit
+// n is pin Dn. Buttons can go on any free pin of the two (at most 16).
+#define BTN_PORTS()  ((uint16_t)PINB << 8 | PIND)
+
 #define DISP_HEIGHT  4
 #define DISP_WIDTH  20
 
 #define LED_PIN      6
 
+// Serial port (commands, telemetry and clock sync). 250000 and 500000
+// are exact on a 16 MHz part, if the USB adapter can do them.
+#define SERIAL_BAUD  115200
+
+// Port and bit for LED_PIN, written directly by the WS2812 driver
+// (Nano D6 is PD6)
+#define LED_PORT     PORTD
+#define LED_DDR      DDRD
+#define LED_BIT      6
+
+// A second LED frame plane, so a tick-aligned frame is built while the
+// last one stays on the LEDs. 0 saves 88 bytes of RAM; the frame is
+// then built on the one plane, which nothing sends before it is due.
+#define LED_BACK_PLANE 1
+
+// LED supply model: current per colour channel at full drive, quiescent
+// current per LED, and the supply budget (e.g. a 2 A USB supply)
+#define LED_CHANNEL_MA  20
+#define LED_IDLE_MA      1
+#define LED_BUDGET_MA 2000
+
+// MCU supply current awake and in idle sleep (ATmega328P datasheet,
+// 16 MHz at 5 V), for the power figures. The Nano's USB bridge,
+// regulator and power LED draw more on top, awake or not.
+#define MCU_ACTIVE_MA   10
+#define MCU_IDLE_MA      3
+
+// DS1307 SQW/OUT (1 Hz, open drain). Not routed on the current board;
+// define this with the pin it is wired to and second edges are taken
+// from it rather than predicted.
+// #define RTC_SQW_PIN  A0
+
+// Cue outputs (Cues.h), where fitted: a light for the speaker (high
+// is on) and a piezo buzzer
+// #define CUE_LIGHT_PIN  8
+// #define BUZZER_PIN     9
+
 // RTC Address (I2C)
 #define RTC_ADDR unk
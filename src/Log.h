@@ -0,0 +1,130 @@
+#pragma once
+
+#include <Arduino.h>
+#include "TimeBase.h"
+
+/*
+ * Logging without text or waiting on the port.
+ *
+ * A log call stores an 11 byte record (message id, time, two numbers)
+ * in a ring; when the ring is full the oldest record goes. The ring is
+ * sent to the host in binary frames (see Remote.h) only when the loop
+ * has nothing better to do, and only as much as fits in the serial TX
+ * buffer. tools/logdecode.py turns the records back into text, using
+ * the table below.
+ *
+ * Each message has a level. Calls to messages below LOG_LEVEL compile
+ * to nothing, arguments included.
+ */
+
+#define LOG_DEBUG 0
+#define LOG_INFO  1
+#define LOG_WARN  2
+#define LOG_ERROR 3
+#define LOG_NONE  4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO
+#endif
+
+// id, level, and the text the decoder prints ({a} and {b} are the two
+// numbers). Add new messages at the end so old logs still decode.
+#define LOG_MESSAGES(X)                                                 \
+  X(k_log_boot,         LOG_INFO,  "boot")                              \
+  X(k_log_rtc_stopped,  LOG_WARN,  "RTC was stopped, set to build time") \
+  X(k_log_text_length,  LOG_DEBUG, "text window length {a}")            \
+  X(k_log_lap,          LOG_INFO,  "lap {b}: {a} ms")                   \
+  X(k_log_lap_input,    LOG_INFO,  "lap input handled +{a} us")         \
+  X(k_log_modify,       LOG_DEBUG, "setting changed by {b}, now {a}")   \
+  X(k_log_bad_frame,    LOG_WARN,  "bad remote frame ({a} so far)")     \
+  X(k_log_sync_step,    LOG_INFO,  "time base stepped {a} ms")          \
+  X(k_log_talk,         LOG_INFO,  "slot {b} started, {a} s")
+
+#define LOG_ID(id, level, text) id,
+#define LOG_LEVEL_OF(id, level, text) id##_level = level,
+typedef enum { LOG_MESSAGES(LOG_ID) k_num_log_messages } log_id_t;
+enum { LOG_MESSAGES(LOG_LEVEL_OF) };
+#undef LOG_ID
+#undef LOG_LEVEL_OF
+
+// Log message id with up to two numbers
+#define LOG(id, a, b)                                   \
+  do {                                                  \
+    if (id##_level >= LOG_LEVEL)                        \
+      logger.write(id, a, b);                           \
+  } while (0)
+
+
+// One record as sent: little endian, no padding
+struct LogRecord
+{
+  byte id;
+  uint32_t ms;        // time base
+  int32_t a;
+  int16_t b;
+} __attribute__((packed));
+
+
+// Ring of the last N records
+template <unsigned char N>
+class LogRing
+{
+public:
+  void write (byte id, long a, int b)
+  {
+    if (mCount == N)
+      {
+        // Full: the oldest goes
+        mHead = (mHead + 1) % N;
+        mCount --;
+        if (mDropped < 0xFFFF)
+          mDropped ++;
+      }
+    LogRecord & r = mRecords[(mHead + mCount) % N];
+    r.id = id;
+    r.ms = timebase.stamp().ms;
+    r.a = a;
+    r.b = b;
+    mCount ++;
+  }
+
+  // Take the oldest record. Returns false if there are none.
+  bool take (LogRecord * r)
+  {
+    if (!mCount)
+      return false;
+    *r = mRecords[mHead];
+    mHead = (mHead + 1) % N;
+    mCount --;
+    return true;
+  }
+
+  unsigned char pending () const
+  { return mCount; }
+
+  // Records lost to a full ring
+  unsigned int dropped () const
+  { return mDropped; }
+
+  // Longest time spent sending records, in us (should stay small:
+  // sending only ever fills the TX buffer, never waits on it)
+  unsigned int worst_us () const
+  { return mWorstUs; }
+
+  void note_send_time (unsigned long us)
+  {
+    if (us > mWorstUs)
+      mWorstUs = us > 0xFFFF ? 0xFFFF : us;
+  }
+
+private:
+  LogRecord mRecords[N];
+  unsigned char mHead = 0;
+  unsigned char mCount = 0;
+  unsigned int mDropped = 0;
+  unsigned int mWorstUs = 0;
+};
+
+typedef LogRing<12> Log;
+
+extern Log logger;
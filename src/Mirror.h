@@ -0,0 +1,145 @@
+#pragma once
+
+#include "OLED.h"
+#include "Compositor.h"
+
+// A full copy of both displays this often, in case an update was lost
+const unsigned long kMirrorKeyframeMs = 30000;
+
+/*
+ * What is on the OLED and the digits, as updates for a host
+ * (tools/mirror_view.py), sent by Remote in idle time.
+ *
+ * Nothing is compared here: the OLED keeps a bit per cell that changed
+ * and the compositor a bit per digit, both set as a side effect of
+ * drawing. An update takes the changed cells and digits that fit in
+ * the room it is given and clears their bits; the rest wait for the
+ * next one.
+ *
+ * OLED update: runs of changed cells, each
+ *
+ *   first cell (row * 20 + column), count, characters
+ *
+ * Digits update: a bit per digit in the update, then for each
+ *
+ *   flags (bit 7 pixel mode, bit 1 colon lit, bit 0 decimal lit),
+ *   segments (0abcdefg) or 3 bytes of pixel mask, r, g, b
+ *
+ * The colour is the digit layer's: transitions and the overlay are
+ * not mirrored.
+ */
+class Mirror
+{
+public:
+  Mirror (OLED * display, Compositor * face):
+    mDisplay(display),
+    mFace(face)
+  {}
+
+  void enable (bool on)
+  {
+    mOn = on;
+    if (on)
+      keyframe();
+  }
+
+  bool enabled () const
+  {
+    return mOn;
+  }
+
+  // Everything counts as changed
+  void keyframe ()
+  {
+    mDisplay->mark_all();
+    mDigits = Compositor::kAllDigits;
+    mLastKeyframe = millis();
+  }
+
+  // Changed digits, in at most room bytes. Returns the length, 0 if
+  // there is nothing to send.
+  byte next_digits (byte * buf, byte room)
+  {
+    if (millis() - mLastKeyframe >= kMirrorKeyframeMs)
+      keyframe();
+    mDigits |= mFace->take_changed();
+    if (!mDigits || room < 1)
+      return 0;
+
+    byte * p = buf + 1;
+    byte * end = buf + room;
+    buf[0] = 0;
+    for (unsigned char d = 0; d < kNumDigits; ++d)
+      {
+        byte bit = 1 << d;
+        if (!(mDigits & bit))
+          continue;
+        bool raw = mFace->pixel_mode(d);
+        if (p + (raw ? 7 : 5) > end)
+          break;
+
+        *p++ = (raw ? 0x80 : 0) | (mFace->colon_lit(d) << 1) | mFace->decimal_lit(d);
+        if (raw)
+          {
+            unsigned long px = mFace->pixels(d);
+            *p++ = px;
+            *p++ = px >> 8;
+            *p++ = px >> 16;
+          }
+        else
+          *p++ = mFace->segments(d);
+        CRGB c = mFace->colour(d);
+        *p++ = c.r;
+        *p++ = c.g;
+        *p++ = c.b;
+        buf[0] |= bit;
+        mDigits &= ~bit;
+      }
+    return buf[0] ? p - buf : 0;
+  }
+
+  // Changed OLED cells, in at most room bytes. Returns the length, 0 if
+  // there is nothing to send.
+  byte next_oled (byte * buf, byte room)
+  {
+    byte * p = buf;
+    byte * end = buf + room;
+    unsigned char i = 0;
+    while (i < OLED::kCells && p + 3 <= end)
+      {
+        // Whole bytes of unchanged cells at a time
+        if (!mDisplay->changed_byte(i >> 3))
+          {
+            i = (i | 7) + 1;
+            continue;
+          }
+        if (!mDisplay->changed(i))
+          {
+            ++i;
+            continue;
+          }
+
+        // A run goes to the end of the row at most
+        unsigned char row_end = (i / OLED::kCols + 1) * OLED::kCols;
+        byte * run = p;
+        p += 2;
+        run[0] = i;
+        run[1] = 0;
+        while (i < row_end && p < end && mDisplay->changed(i))
+          {
+            *p++ = mDisplay->cell(i);
+            mDisplay->clean(i);
+            run[1] ++;
+            i ++;
+          }
+      }
+    return p - buf;
+  }
+
+private:
+  OLED * mDisplay;
+  Compositor * mFace;
+  bool mOn = false;
+  byte mDigits = 0;
+  unsigned long mLastKeyframe = 0;
+};
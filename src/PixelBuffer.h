@@ -0,0 +1,386 @@
+#pragma once
+
+#include <Arduino.h>
+#include "FastLED.h"
+#include "HAL.h"
+#include "Curves.h"
+#include "Profile.h"
+
+#if F_CPU != 16000000L
+#error "The WS2812 driver in PixelBuffer.h is timed for a 16 MHz clock"
+#endif
+
+// The Arduino core's Timer0 counts, moved on by show() for the
+// overflows it takes the place of the ISR for
+extern volatile unsigned long timer0_overflow_count;
+extern volatile unsigned long timer0_millis;
+
+// Number of colours a frame can use. Slot 0 is always black.
+const unsigned char kPaletteSize = 16;
+
+/*
+ * Send one byte down the WS2812 chain, MSB first.
+ *
+ * Each bit is exactly 20 cycles (1.25 us at 16 MHz):
+ *   0 bit: high for  6 cycles (375 ns), low for 14
+ *   1 bit: high for 12 cycles (750 ns), low for  8
+ *
+ * Interrupts must be off. The line is left low, so any time spent
+ * between calls stretches the low phase of the last bit. WS2812B parts
+ * can take a low of 6-9 us as the end of the frame and latch, so the
+ * gaps (a palette lookup, under 2 us) are kept well short of that.
+ */
+static inline void ws2812_send_byte (uint8_t data, uint8_t hi, uint8_t lo) __attribute__((always_inline));
+static inline void ws2812_send_byte (uint8_t data, uint8_t hi, uint8_t lo)
+{
+  uint8_t ctr;
+  asm volatile (
+    "     ldi  %[ctr], 8       \n\t"
+    "1:   out  %[port], %[hi]  \n\t" // 0   line high
+    "     rjmp .+0             \n\t" // 1-2
+    "     rjmp .+0             \n\t" // 3-4
+    "     sbrs %[data], 7      \n\t" // 5   (5-6 if the bit is set)
+    "     out  %[port], %[lo]  \n\t" // 6   end of a 0 bit
+    "     lsl  %[data]         \n\t" // 7
+    "     rjmp .+0             \n\t" // 8-9
+    "     rjmp .+0             \n\t" // 10-11
+    "     out  %[port], %[lo]  \n\t" // 12  end of a 1 bit
+    "     rjmp .+0             \n\t" // 13-14
+    "     rjmp .+0             \n\t" // 15-16
+    "     dec  %[ctr]          \n\t" // 17
+    "     brne 1b              \n\t" // 18-19
+    : [ctr] "=&d" (ctr), [data] "+r" (data)
+    : [port] "I" (_SFR_IO_ADDR(LED_PORT)), [hi] "r" (hi), [lo] "r" (lo)
+    );
+}
+
+
+/*
+ * LED frame buffer holding a 4 bit palette index per pixel (two
+ * pixels to a byte) instead of a full CRGB. A frame only ever uses a
+ * handful of colours, so for 144 pixels a plane is 72 bytes, with a 48
+ * byte palette and 16 bytes of counts (below) per plane: 240 bytes in
+ * all with both planes, 152 with one, rather than 432 for CRGBs.
+ *
+ * Colours are interned with index(): an existing palette entry is
+ * reused, otherwise a free slot is taken. Slots no longer referenced
+ * by any pixel are reclaimed when the palette fills up.
+ *
+ * A count of pixels per palette slot is kept as pixels are written.
+ * That gives the supply current for a frame from 16 slots instead of
+ * 144 pixels, and show() scales the whole frame down if it would draw
+ * more than LED_BUDGET_MA.
+ *
+ * There are P (2) pixel planes sharing the palette. Normally both
+ * drawing and show() use the front one. begin_back() starts the next
+ * frame on the back plane (as a copy of the front) while the front
+ * stays on the LEDs; flip() then makes it the front, so a frame
+ * prepared well ahead can be sent the moment it is due. With P = 1
+ * the frame is prepared on the front plane itself: that works as long
+ * as nothing calls show() before it is due, and cancel_back() leaves
+ * it half drawn (the compositor redraws the whole face after one).
+ */
+template <unsigned int N, unsigned char P = 2>
+class PixelBuffer
+{
+public:
+  PixelBuffer ()
+  {
+    clear();
+  }
+
+  // Set every pixel to black and free the palette
+  void clear ()
+  {
+    memset(mPixels, 0, sizeof(mPixels));
+    memset(mCount, 0, sizeof(mCount));
+    for (unsigned char p = 0; p < P; ++p)
+      mCount[p][0] = N;
+    mPalette[0] = CRGB(0, 0, 0);
+    mAllocated = 1;
+    mPinned = 1;
+  }
+
+  // Find (or allocate) the palette slot for a colour
+  unsigned char index (CRGB colour)
+  {
+    for (unsigned char i = 0; i < kPaletteSize; ++i)
+      {
+        if ((mAllocated & (1 << i)) && mPalette[i] == colour)
+          {
+            mPinned |= (1 << i);
+            return i;
+          }
+      }
+
+    unsigned char slot = free_slot();
+    if (slot == 0)
+      {
+        collect();
+        slot = free_slot();
+      }
+    if (slot == 0)
+      return nearest(colour);
+
+    mPalette[slot] = colour;
+    mAllocated |= (1 << slot);
+    mPinned |= (1 << slot);
+    return slot;
+  }
+
+  // Pixels are read and written on the plane being drawn
+  void set_index (unsigned int pixel, unsigned char idx)
+  {
+    unsigned char * count = mCount[mDraw];
+    unsigned char & b = mPixels[mDraw][pixel >> 1];
+    if (pixel & 1)
+      {
+        count[b >> 4] --;
+        b = (b & 0x0F) | (idx << 4);
+      }
+    else
+      {
+        count[b & 0x0F] --;
+        b = (b & 0xF0) | idx;
+      }
+    count[idx] ++;
+  }
+
+  unsigned char get_index (unsigned int pixel) const
+  {
+    return plane_index(mDraw, pixel);
+  }
+
+  void set (unsigned int pixel, CRGB colour)
+  {
+    set_index(pixel, index(colour));
+  }
+
+  CRGB get (unsigned int pixel) const
+  {
+    return mPalette[get_index(pixel)];
+  }
+
+  // Brightness relative to the colours as written (0x100 = 1.0).
+  // Above 1.0 is allowed; the current limit still applies.
+  void set_gain (fix8_8 gain)
+  {
+    mGain = gain;
+  }
+
+  fix8_8 gain () const
+  {
+    return mGain;
+  }
+
+  // Estimated supply current of the last frame sent, in mA
+  unsigned int milliamps () const
+  {
+    return mMilliamps;
+  }
+
+  // Draw on the back plane, starting from a copy of the front
+  void begin_back ()
+  {
+    if (P == 1)
+      return;
+    unsigned char back = mFront ^ 1;
+    memcpy(mPixels[back], mPixels[mFront], sizeof(mPixels[0]));
+    memcpy(mCount[back], mCount[mFront], sizeof(mCount[0]));
+    mDraw = back;
+  }
+
+  // Go back to drawing on the front plane, dropping the back one
+  void cancel_back ()
+  {
+    mDraw = mFront;
+  }
+
+  // Make the plane being drawn the one show() sends
+  void flip ()
+  {
+    mFront = mDraw;
+  }
+
+  bool drawing_back () const
+  {
+    return mDraw != mFront;
+  }
+
+  // micros() just before the first bit of the last frame went out
+  unsigned long first_bit_us () const
+  {
+    return mFirstBitUs;
+  }
+
+  // Stream the front plane to the LED chain, expanding palette indices
+  // on the fly. Takes about 30 us per pixel (4.3 ms for 144), all with
+  // interrupts off: an ISR between pixels could run past the latch
+  // time and tear the frame. Timer0's overflows are counted here
+  // instead, so millis() and micros() don't lose the time; serial
+  // bytes past the USART's two byte buffer are lost, as with FastLED.
+  PROFILED void show ()
+  {
+    // Gain, and the palette it gives, for this frame
+    fix8_8 gain = limit_gain();
+    CRGB out[kPaletteSize];
+    for (unsigned char i = 0; i < kPaletteSize; ++i)
+      out[i] = CRGB(apply_gain(mPalette[i].r, gain),
+                    apply_gain(mPalette[i].g, gain),
+                    apply_gain(mPalette[i].b, gain));
+
+    const uint8_t mask = _BV(LED_BIT);
+    LED_DDR |= mask;
+
+    // Make sure the previous frame has latched
+    while (micros() - mLastShow < 50)
+      ;
+
+    mFirstBitUs = micros();
+    uint8_t sreg = SREG;
+    cli();
+    uint8_t hi = LED_PORT | mask;
+    uint8_t lo = LED_PORT & ~mask;
+    unsigned char overflows = 0;
+    for (unsigned int i = 0; i < N; ++i)
+      {
+        const CRGB & c = out[plane_index(mFront, i)];
+        uint8_t r = c.r, g = c.g, b = c.b;
+
+        // Every 1024 us; a pixel is 30, so none is missed
+        if (TIFR0 & _BV(TOV0))
+          {
+            TIFR0 = _BV(TOV0);
+            overflows ++;
+          }
+        // Channel order matches the chain (previously FastLED's RGB)
+        ws2812_send_byte(r, hi, lo);
+        ws2812_send_byte(g, hi, lo);
+        ws2812_send_byte(b, hi, lo);
+      }
+    count_overflows(overflows);
+    SREG = sreg;
+
+    mLastShow = micros();
+    if (!drawing_back())
+      mPinned = 1;
+  }
+
+private:
+  // Two pixels per byte, even pixel in the low nibble
+  unsigned char mPixels[P][(N + 1) / 2];
+  CRGB mPalette[kPaletteSize];
+
+  // Number of pixels using each palette slot, per plane
+  unsigned char mCount[P][kPaletteSize];
+
+  unsigned char mFront = 0;
+  unsigned char mDraw = 0;
+
+  // Bit per palette slot: in use, and interned since the last show()
+  // (and so possibly not yet written to a pixel)
+  unsigned int mAllocated;
+  unsigned int mPinned;
+
+  fix8_8 mGain = kFixOne;
+  unsigned int mMilliamps = 0;
+
+  unsigned long mLastShow = 0;
+  unsigned long mFirstBitUs = 0;
+
+  // us of Timer0 overflows counted by show() not yet in timer0_millis
+  static unsigned int sOverflowUs;
+
+  // What the Timer0 ISR would have done for n overflows (1024 us each)
+  static void count_overflows (unsigned char n)
+  {
+    timer0_overflow_count += n;
+    sOverflowUs += n * 1024U;
+    while (sOverflowUs >= 1000)
+      {
+        sOverflowUs -= 1000;
+        timer0_millis ++;
+      }
+  }
+
+  unsigned char plane_index (unsigned char plane, unsigned int pixel) const
+  {
+    unsigned char b = mPixels[plane][pixel >> 1];
+    return (pixel & 1) ? (b >> 4) : (b & 0x0F);
+  }
+
+  unsigned char free_slot () const
+  {
+    for (unsigned char i = 1; i < kPaletteSize; ++i)
+      if (!(mAllocated & (1 << i)))
+        return i;
+    return 0;
+  }
+
+  // Free every slot not referenced by a pixel on either plane
+  void collect ()
+  {
+    unsigned int used = mPinned | 1;
+    for (unsigned char i = 1; i < kPaletteSize; ++i)
+      for (unsigned char p = 0; p < P; ++p)
+        if (mCount[p][i])
+          used |= 1 << i;
+    mAllocated = used;
+  }
+
+  static uint8_t apply_gain (uint8_t c, fix8_8 gain)
+  {
+    uint32_t v = ((uint32_t)c * gain) >> 8;
+    return v > 255 ? 255 : v;
+  }
+
+  // Gain for this frame: mGain, reduced if needed to keep the
+  // estimated current within LED_BUDGET_MA
+  fix8_8 limit_gain ()
+  {
+    // Sum of all channel values in the frame at a gain of 1.0
+    const unsigned char * count = mCount[mFront];
+    uint32_t drive = 0;
+    for (unsigned char i = 1; i < kPaletteSize; ++i)
+      if (count[i])
+        drive += (uint32_t)count[i]
+          * ((unsigned int)mPalette[i].r + mPalette[i].g + mPalette[i].b);
+
+    const uint32_t idle = (uint32_t)N * LED_IDLE_MA;
+    const uint32_t full = 255UL * kFixOne;
+
+    // Current at the requested gain (an overestimate if channels
+    // saturate at 255)
+    fix8_8 gain = mGain;
+    uint32_t ma = drive * gain / (full / LED_CHANNEL_MA);
+    if (idle + ma > LED_BUDGET_MA && drive)
+      {
+        gain = (uint32_t)(LED_BUDGET_MA - idle) * full / LED_CHANNEL_MA / drive;
+        ma = drive * gain / (full / LED_CHANNEL_MA);
+      }
+    mMilliamps = idle + ma;
+    return gain;
+  }
+
+  // Palette is full of live colours: make do with the closest one
+  unsigned char nearest (CRGB colour) const
+  {
+    unsigned char best = 0;
+    unsigned int best_dist = 0xFFFF;
+    for (unsigned char i = 0; i < kPaletteSize; ++i)
+      {
+        unsigned int dist = abs((int)mPalette[i].r - colour.r)
+          + abs((int)mPalette[i].g - colour.g)
+          + abs((int)mPalette[i].b - colour.b);
+        if (dist < best_dist)
+          {
+            best = i;
+            best_dist = dist;
+          }
+      }
+    return best;
+  }
+};
+
+template <unsigned int N, unsigned char P>
+unsigned int PixelBuffer<N, P>::sOverflowUs = 0;
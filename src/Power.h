@@ -0,0 +1,108 @@
+#pragma once
+
+#include <Arduino.h>
+#include <avr/sleep.h>
+#include <avr/interrupt.h>
+#include "HAL.h"
+
+/*
+ * Sleep when the loop has nothing to do.
+ *
+ * The loop calls idle() at its end. Unless serial input is waiting,
+ * the CPU goes into idle sleep until the next interrupt:
+ *
+ *  - the millis() tick (Timer0, every 1.024 ms), which also paces LED
+ *    frames, button scans and the OLED, so nothing time driven waits
+ *    more than a tick longer than it would have
+ *  - serial RX and TX
+ *  - pin changes on the pins given to wake_on() (the buttons, and the
+ *    RTC's SQW pin when it is wired)
+ *
+ * Idle sleep leaves the clocks and Timer0 running, so micros() and the
+ * time base carry on through it and there is no timing to restart.
+ * The deeper modes stop Timer0, and with it every clock this code
+ * keeps; they would need an async timer crystal the Nano doesn't have.
+ *
+ * The time spent awake is kept as a duty cycle, from which the MCU's
+ * current is estimated (MCU_ACTIVE_MA and MCU_IDLE_MA).
+ */
+class Power
+{
+public:
+  // Wake on a change of this pin
+  void wake_on (byte pin)
+  {
+    *digitalPinToPCMSK(pin) |= bit(digitalPinToPCMSKbit(pin));
+    *digitalPinToPCICR(pin) |= bit(digitalPinToPCICRbit(pin));
+  }
+
+  void enable (bool on)
+  {
+    mOn = on;
+  }
+
+  bool enabled () const
+  {
+    return mOn;
+  }
+
+  // Sleep until the next interrupt, unless there is input to handle
+  void idle ()
+  {
+    unsigned long now = micros();
+    if (mOn)
+      {
+        set_sleep_mode(SLEEP_MODE_IDLE);
+        // Checked with interrupts off: a byte arriving after the check
+        // still wakes the sleep that follows (sleep_cpu() runs before
+        // any interrupt sei() lets in)
+        cli();
+        if (Serial.available())
+          sei();
+        else
+          {
+            sleep_enable();
+            sei();
+            sleep_cpu();
+            sleep_disable();
+            unsigned long woke = micros();
+            mAsleepUs += woke - now;
+            now = woke;
+          }
+      }
+
+    // Duty cycle over the last second
+    if (now - mWindowStart >= 1000000UL)
+      {
+        unsigned long window = now - mWindowStart;
+        mDuty = 1000 - (unsigned int)(mAsleepUs / (window / 1000));
+        mAsleepUs = 0;
+        mWindowStart = now;
+      }
+  }
+
+  // Time awake over the last second, in 1/1000ths
+  unsigned int duty () const
+  {
+    return mDuty;
+  }
+
+  // Estimated MCU current at that duty cycle
+  unsigned int milliamps () const
+  {
+    return MCU_IDLE_MA + ((unsigned long)(MCU_ACTIVE_MA - MCU_IDLE_MA) * mDuty + 500) / 1000;
+  }
+
+private:
+  bool mOn = true;
+  unsigned long mAsleepUs = 0;
+  unsigned long mWindowStart = 0;
+  unsigned int mDuty = 1000;
+};
+
+// The wake up is all a pin change is for
+EMPTY_INTERRUPT(PCINT0_vect);
+EMPTY_INTERRUPT(PCINT1_vect);
+EMPTY_INTERRUPT(PCINT2_vect);
+
+extern Power power;
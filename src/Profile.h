@@ -0,0 +1,10 @@
+#pragma once
+
+// The cycle profiler (tools/profile) times functions from their
+// symbols. In the profile build (PROFILE_SIM) the functions it looks at
+// are kept out of line so they have one; otherwise this is nothing.
+#ifdef PROFILE_SIM
+#define PROFILED __attribute__((noinline, used))
+#else
+#define PROFILED
+#endif
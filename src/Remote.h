@@ -0,0 +1,605 @@
+#pragma once
+
+#include <Arduino.h>
+#include <util/crc16.h>
+#include "Displays.h"
+#include "Log.h"
+#include "Mirror.h"
+#include "Trace.h"
+#include "Schedule.h"
+
+/*
+ * Remote control and telemetry on the serial port (tools/remote.py).
+ *
+ * Binary frames:
+ *
+ *   0xA5  len  type  payload[len]  crc_lo  crc_hi
+ *
+ * with a CRC-16/XMODEM over len, type and payload. 0xA5 never occurs in
+ * text, so frames share the port with the one letter commands and the
+ * '@' sync lines: anything outside a frame goes to those as before.
+ *
+ * Host to clock, k_frame_commands: a sequence number, then any number
+ * of commands, each an op byte and its fixed size arguments (integers
+ * little endian). The batch is run in one go and answered with an ack
+ * saying how many ran and how long it took, so the host can time the
+ * round trip.
+ *
+ * Host to clock, k_frame_palette and k_frame_digits: LED frames
+ * streamed from the host, unacked (see StreamView for the encoding).
+ *
+ * Clock to host: acks, telemetry at the rate asked for, button events,
+ * cues (Cues.h: timer, code, seconds left (2)), log records (Log.h), a
+ * few to a frame, and, while asked for, updates mirroring the OLED and
+ * digits (Mirror.h).
+ *
+ * Input traces (Trace.h) go both ways in the same form, k_frame_trace
+ * from the clock and k_frame_trace_load to it: index of the first
+ * event, events in the trace, start levels (4), then the events.
+ *
+ * Schedules (Schedule.h) are loaded with k_frame_schedule_load: index
+ * of the first slot, slots in the schedule, then up to
+ * kSchedulePerFrame slots as kept in EEPROM. k_op_schedule answers
+ * with k_frame_schedule: slots, 1 if a load is still being written,
+ * CRC of the slots (2) and the slot running.
+ *
+ * Bytes are taken from the serial RX ring as they arrive and fed to a
+ * state machine, so a frame split across loops costs nothing to wait
+ * for. Nothing is sent unless it fits in the TX ring, so the loop never
+ * blocks on the port either: a frame that doesn't fit is dropped and
+ * counted.
+ */
+class Remote
+{
+public:
+  // Frame types
+  static const byte k_frame_commands = 0x01;
+  static const byte k_frame_palette = 0x02;
+  static const byte k_frame_digits = 0x03;
+  static const byte k_frame_trace_load = 0x04;
+  static const byte k_frame_schedule_load = 0x05;
+  static const byte k_frame_ack = 0x81;
+  static const byte k_frame_telemetry = 0x82;
+  static const byte k_frame_event = 0x83;
+  static const byte k_frame_log = 0x84;
+  static const byte k_frame_mirror_oled = 0x85;
+  static const byte k_frame_mirror_digits = 0x86;
+  static const byte k_frame_trace = 0x87;
+  static const byte k_frame_schedule = 0x88;
+  static const byte k_frame_cue = 0x89;
+
+  // Commands (arguments)
+  typedef enum {
+    k_op_set = 1,       // id, seconds (4, at most kMaxTimerSecs)
+    k_op_start,         // id
+    k_op_pause,         // id
+    k_op_reset,         // id
+    k_op_window,        // window number (see add_window())
+    k_op_thresholds,    // warn minutes, alarm minutes
+    k_op_key,           // key_t
+    k_op_telemetry,     // period ms (2; 0 = off), timer id
+    k_op_mirror,        // 1 = on, 0 = off
+    k_op_trace,         // trace_op_t
+    k_op_schedule,      // (none)
+    k_op_setting,       // setting id, value (2)
+    k_num_ops
+  } op_t;
+
+  // Buttons, as commands and events
+  typedef enum {k_key_up, k_key_down, k_key_enter, k_key_back} key_t;
+
+  // Input trace (Trace.h) control
+  typedef enum {k_trace_stop, k_trace_record, k_trace_replay, k_trace_send} trace_op_t;
+
+  Remote (WindowManager * mgr, TimerBank * bank, ClockTimer * countdown,
+          StreamView * stream, Mirror * mirror):
+    mMgr(mgr),
+    mBank(bank),
+    mCountdown(countdown),
+    mStream(stream),
+    mMirror(mirror)
+  {}
+
+  // Windows that k_op_window can switch to, numbered from 0
+  void add_window (Window * wind)
+  {
+    if (mNumWindows < kMaxWindows)
+      mWindows[mNumWindows++] = wind;
+  }
+
+  // Called every loop: handle whatever has arrived, and send telemetry
+  // if it is due
+  void poll ()
+  {
+    while (Serial.available() > 0)
+      {
+        byte c = Serial.read();
+        if (mState != k_sync || c == kSync)
+          parse(c);
+        else if (!timesync.feed(c))
+          command(c);
+      }
+
+    if (mTelemetryPeriod && millis() - mLastTelemetry >= mTelemetryPeriod)
+      {
+        mLastTelemetry = millis();
+        send_telemetry();
+      }
+  }
+
+  // Tell the host a button was pressed
+  void event (key_t key)
+  {
+    byte k = key;
+    send(k_frame_event, &k, 1);
+  }
+
+  // Tell the host a cue was reached (k_cue_event)
+  void cue (byte timer, byte code, long secs)
+  {
+    byte c[4] = {timer, code};
+    put16(c + 2, secs);
+    send(k_frame_cue, c, sizeof(c));
+  }
+
+  // Send log records and mirror updates, as far as the TX ring has
+  // room. Called when the loop is otherwise idle; skipped close to an
+  // LED edge.
+  void idle ()
+  {
+    if (animator.edge_within(kEdgeGuardMs))
+      return;
+    drain_log();
+    if (mMirror->enabled())
+      send_mirror();
+    if (mTraceSend < trace.count())
+      send_trace();
+  }
+
+  // The one letter commands
+  void command (char c)
+  {
+    timebase.stamp_input(micros());
+    trace.command(c);
+    switch (c)
+      {
+      case 'n':
+        mMgr->down_evt();
+        break;
+      case 'p':
+        mMgr->up_evt();
+        break;
+      case 'b':
+        mMgr->back_evt();
+        break;
+      case 'e':
+        mMgr->enter_evt();
+        break;
+      case 's':
+        mMgr->print_stats();
+        break;
+      case 't':
+        bench_timers();
+        bench_calendar();
+        break;
+      case 'g':
+        // Stage mode: brighter, still held to LED_BUDGET_MA. Off goes
+        // back to the brightness setting.
+        leds.set_gain(leds.gain() == kStageGain
+                      ? brightness_gain(settings.get(k_set_brightness))
+                      : kStageGain);
+        break;
+      case 'z':
+        // Idle sleep on and off, to compare the duty cycle
+        power.enable(!power.enabled());
+        break;
+      }
+  }
+
+private:
+  static const byte kSync = 0xA5;
+  static const byte kLogPerFrame = 4;
+  static const byte kMirrorPayload = 48;
+  static const byte kTraceHeader = 6;
+  static const byte kTracePerFrame = 12;
+  static const byte kMaxPayload = 32;
+  static const byte kMaxWindows = 8;
+
+  // Argument bytes per op
+  static const byte kArgs[k_num_ops];
+
+  typedef enum {k_sync, k_len, k_type, k_payload, k_crc_lo, k_crc_hi} state_t;
+
+  WindowManager * mMgr;
+  TimerBank * mBank;
+  ClockTimer * mCountdown;
+  StreamView * mStream;
+  Mirror * mMirror;
+
+  Window * mWindows[kMaxWindows];
+  byte mNumWindows = 0;
+
+  // Frame being received
+  state_t mState = k_sync;
+  byte mLen = 0;
+  byte mType = 0;
+  byte mPos = 0;
+  byte mPayload[kMaxPayload];
+  uint16_t mCrc = 0;
+  unsigned long mFrameUs = 0;
+
+  unsigned int mTelemetryPeriod = 0;
+  unsigned long mLastTelemetry = 0;
+  byte mTelemetryId = 0;
+
+  // Next trace event to send (none once past the end)
+  byte mTraceSend = 0xFF;
+
+  // Counts for the telemetry
+  byte mBadFrames = 0;
+  byte mDropped = 0;
+
+  void parse (byte c)
+  {
+    switch (mState)
+      {
+      case k_sync:
+        mCrc = 0;
+        mState = k_len;
+        break;
+
+      case k_len:
+        mLen = c;
+        mCrc = _crc_xmodem_update(mCrc, c);
+        mState = (c <= kMaxPayload) ? k_type : k_sync;
+        if (mState == k_sync)
+          bad_frame();
+        break;
+
+      case k_type:
+        mType = c;
+        mCrc = _crc_xmodem_update(mCrc, c);
+        mPos = 0;
+        mState = mLen ? k_payload : k_crc_lo;
+        break;
+
+      case k_payload:
+        mPayload[mPos++] = c;
+        mCrc = _crc_xmodem_update(mCrc, c);
+        if (mPos == mLen)
+          mState = k_crc_lo;
+        break;
+
+      case k_crc_lo:
+        mState = (c == (mCrc & 0xFF)) ? k_crc_hi : k_sync;
+        if (mState == k_sync)
+          bad_frame();
+        break;
+
+      case k_crc_hi:
+        mState = k_sync;
+        if (c != (mCrc >> 8))
+          {
+            bad_frame();
+            break;
+          }
+        mFrameUs = micros();
+        timebase.stamp_input(mFrameUs);
+        if (mType == k_frame_commands && mLen)
+          run_batch();
+        else if (mType == k_frame_palette)
+          mStream->palette(mPayload, mLen);
+        else if (mType == k_frame_trace_load)
+          load_trace();
+        else if (mType == k_frame_schedule_load)
+          load_schedule();
+        else if (mType == k_frame_digits)
+          {
+            mStream->open(mMgr);
+            if (!mStream->frame(mPayload, mLen))
+              bad_frame();
+          }
+        break;
+      }
+  }
+
+  void drain_log ()
+  {
+    if (!logger.pending())
+      return;
+
+    unsigned long t0 = micros();
+    int room = Serial.availableForWrite() - 5;
+    byte n = 0;
+    LogRecord recs[kLogPerFrame];
+    while (n < kLogPerFrame && room >= (int)sizeof(LogRecord) && logger.take(recs + n))
+      {
+        room -= sizeof(LogRecord);
+        n ++;
+      }
+    if (n)
+      send(k_frame_log, (const byte *)recs, n * sizeof(LogRecord));
+    logger.note_send_time(micros() - t0);
+  }
+
+  // Digits first: they are what the room is looking at
+  void send_mirror ()
+  {
+    byte buf[kMirrorPayload];
+    int room = Serial.availableForWrite() - 5;
+    byte len = mMirror->next_digits(buf, constrain(room, 0, (int)sizeof(buf)));
+    if (len)
+      {
+        send(k_frame_mirror_digits, buf, len);
+        room -= len + 5;
+      }
+    len = mMirror->next_oled(buf, constrain(room, 0, (int)sizeof(buf)));
+    if (len)
+      send(k_frame_mirror_oled, buf, len);
+  }
+
+  void trace_op (byte op)
+  {
+    switch (op)
+      {
+      case k_trace_stop:
+        trace.stop();
+        break;
+      case k_trace_record:
+        trace.record();
+        break;
+      case k_trace_replay:
+        trace.replay();
+        break;
+      case k_trace_send:
+        mTraceSend = 0;
+        break;
+      }
+  }
+
+  void send_trace ()
+  {
+    byte buf[kTraceHeader + kTracePerFrame * sizeof(TraceEvent)];
+    int room = Serial.availableForWrite() - 5 - kTraceHeader;
+    byte n = 0;
+    while (n < kTracePerFrame && mTraceSend + n < trace.count()
+           && room >= (int)sizeof(TraceEvent))
+      {
+        memcpy(buf + kTraceHeader + n * sizeof(TraceEvent),
+               &trace.at(mTraceSend + n), sizeof(TraceEvent));
+        room -= sizeof(TraceEvent);
+        n ++;
+      }
+    if (!n)
+      return;
+    trace_header(buf, mTraceSend);
+    send(k_frame_trace, buf, kTraceHeader + n * sizeof(TraceEvent));
+    mTraceSend += n;
+  }
+
+  void trace_header (byte * buf, byte first)
+  {
+    uint32_t levels = trace.start_levels();
+    buf[0] = first;
+    buf[1] = trace.count();
+    memcpy(buf + 2, &levels, sizeof(levels));
+  }
+
+  void load_trace ()
+  {
+    if (mLen < kTraceHeader)
+      return;
+    uint32_t levels;
+    memcpy(&levels, mPayload + 2, sizeof(levels));
+    for (byte i = 0; kTraceHeader + (i + 1) * sizeof(TraceEvent) <= mLen; ++i)
+      {
+        TraceEvent e;
+        memcpy(&e, mPayload + kTraceHeader + i * sizeof(TraceEvent), sizeof(e));
+        trace.load(mPayload[0] + i, e, levels);
+      }
+  }
+
+  // A frame that comes while the last is still being written is
+  // dropped: the host checks the CRC at the end and sends it again
+  void load_schedule ()
+  {
+    if (mLen < 2)
+      return;
+    schedule.load(mPayload[0], mPayload[1], mPayload + 2,
+                  (mLen - 2) / kScheduleSlotBytes);
+  }
+
+  void send_schedule ()
+  {
+    byte buf[5];
+    buf[0] = schedule.count();
+    buf[1] = schedule.busy();
+    put16(buf + 2, schedule.crc());
+    buf[4] = schedule.current();
+    send(k_frame_schedule, buf, sizeof(buf));
+  }
+
+  void bad_frame ()
+  {
+    mBadFrames ++;
+    LOG(k_log_bad_frame, mBadFrames, 0);
+  }
+
+  static uint16_t get16 (const byte * p)
+  {
+    return p[0] | (p[1] << 8);
+  }
+
+  static uint32_t get32 (const byte * p)
+  {
+    return get16(p) | (uint32_t)get16(p + 2) << 16;
+  }
+
+  static byte * put16 (byte * p, uint16_t v)
+  {
+    *p++ = v;
+    *p++ = v >> 8;
+    return p;
+  }
+
+  void run_batch ()
+  {
+    byte done = 0;
+    byte pos = 1;
+    while (pos < mLen)
+      {
+        byte op = mPayload[pos++];
+        if (op == 0 || op >= k_num_ops || pos + kArgs[op] > mLen)
+          break;
+        run(op, mPayload + pos);
+        pos += kArgs[op];
+        done ++;
+      }
+
+    // Sequence number, commands run, time taken (us)
+    byte ack[4];
+    ack[0] = mPayload[0];
+    ack[1] = done;
+    put16(ack + 2, min(micros() - mFrameUs, 0xFFFFUL));
+    send(k_frame_ack, ack, sizeof(ack));
+  }
+
+  void run (byte op, const byte * a)
+  {
+    // Timer ops name a timer: one the bank doesn't have is skipped
+    if (op >= k_op_set && op <= k_op_reset && a[0] >= mBank->count())
+      return;
+
+    switch (op)
+      {
+      case k_op_set:
+        // A time the clock can't show is skipped, not cut short
+        if (get32(a + 1) <= kMaxTimerSecs)
+          mBank->set(a[0], get32(a + 1));
+        break;
+      case k_op_start:
+        mBank->start(a[0]);
+        break;
+      case k_op_pause:
+        mBank->pause(a[0]);
+        break;
+      case k_op_reset:
+        mBank->reset(a[0]);
+        break;
+      case k_op_window:
+        if (a[0] < mNumWindows)
+          mMgr->load(mWindows[a[0]]);
+        break;
+      case k_op_thresholds:
+        // Kept, as if set on the clock
+        settings.set(k_set_warn_min, a[0]);
+        settings.set(k_set_alarm_min, a[1]);
+        break;
+      case k_op_key:
+        key(a[0]);
+        break;
+      case k_op_telemetry:
+        mTelemetryPeriod = get16(a);
+        mTelemetryId = a[2];
+        break;
+      case k_op_mirror:
+        mMirror->enable(a[0]);
+        break;
+      case k_op_trace:
+        trace_op(a[0]);
+        break;
+      case k_op_schedule:
+        send_schedule();
+        break;
+      case k_op_setting:
+        settings.set(a[0], (int16_t)get16(a + 1));
+        break;
+      }
+  }
+
+  void key (byte k)
+  {
+    // Traced as the one letter command for the same key
+    static const char kKeyCommand[] = {'p', 'n', 'e', 'b'};
+    if (k < sizeof(kKeyCommand))
+      trace.command(kKeyCommand[k]);
+    switch (k)
+      {
+      case k_key_up:
+        mMgr->up_evt();
+        break;
+      case k_key_down:
+        mMgr->down_evt();
+        break;
+      case k_key_enter:
+        mMgr->enter_evt();
+        break;
+      case k_key_back:
+        mMgr->back_evt();
+        break;
+      }
+  }
+
+  // Timer id, kind and state, ms, then LED frame stats, then port and
+  // log health, then the CPU duty cycle (1/1000ths)
+  void send_telemetry ()
+  {
+    byte t[19];
+    byte id = mTelemetryId < mBank->count() ? mTelemetryId : 0;
+    long ms = mBank->ms(id);
+    t[0] = id;
+    t[1] = mBank->kind(id) << 4 | mBank->state(id);
+    t[2] = ms;
+    t[3] = ms >> 8;
+    t[4] = ms >> 16;
+    t[5] = ms >> 24;
+    t[6] = min(animator.fps(), 255U);
+    byte * p = put16(t + 7, min(animator.worst_us(), 0xFFFFUL));
+    p = put16(p, leds.milliamps());
+    *p++ = mBadFrames;
+    *p++ = mDropped;
+    *p++ = min(logger.dropped(), 255U);
+    p = put16(p, logger.worst_us());
+    p = put16(p, power.duty());
+    send(k_frame_telemetry, t, p - t);
+  }
+
+  void send (byte type, const byte * payload, byte len)
+  {
+    if (Serial.availableForWrite() < len + 5)
+      {
+        mDropped ++;
+        return;
+      }
+
+    uint16_t crc = _crc_xmodem_update(0, len);
+    crc = _crc_xmodem_update(crc, type);
+    for (byte i = 0; i < len; ++i)
+      crc = _crc_xmodem_update(crc, payload[i]);
+
+    Serial.write(kSync);
+    Serial.write(len);
+    Serial.write(type);
+    Serial.write(payload, len);
+    Serial.write(crc & 0xFF);
+    Serial.write(crc >> 8);
+  }
+};
+
+const byte Remote::kArgs[Remote::k_num_ops] = {
+  0,   // unused
+  5,   // k_op_set
+  1,   // k_op_start
+  1,   // k_op_pause
+  1,   // k_op_reset
+  1,   // k_op_window
+  2,   // k_op_thresholds
+  1,   // k_op_key
+  3,   // k_op_telemetry
+  1,   // k_op_mirror
+  1,   // k_op_trace
+  0,   // k_op_schedule
+  3,   // k_op_setting
+};
+
+extern Remote remote;
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include "Settings.h"
+
+/*
+ * A day's talks, kept in EEPROM: for each slot its start time, length
+ * and a label. The countdown is set and started at the start of each
+ * slot (through on_slot()), so a room runs itself from the RTC.
+ *
+ * The slots are in order of start time, so the slot for a time is
+ * found by a binary search: 7 steps for 87 slots, each an EEPROM word
+ * read, a few us in all. The RTC itself (an I2C read) is only read
+ * when the next start or end is due, by millis(), and once every
+ * kScheduleRecheckMs in case it was set in between.
+ *
+ * The schedule is loaded over the serial port a few slots at a time
+ * (Remote's k_frame_schedule_load, tools/schedule.py). Each frame's
+ * bytes are written by poll() one at a time as the EEPROM is ready
+ * for them, so loading never holds up the loop. The count goes to 0
+ * with the first frame and to the new count after the last, so a load
+ * that stops part way leaves an empty schedule rather than a mix.
+ *
+ * EEPROM, from kScheduleBase (after the settings): a count byte, then
+ * 11 bytes per slot: start (minute of the day, 2, little endian),
+ * length (minutes), label (8 characters, padded with 0s).
+ */
+
+const unsigned int kScheduleBase = 64;
+const byte kScheduleSlotBytes = 11;
+const byte kScheduleLabel = 8;
+const byte kMaxSlots = (E2END + 1 - kScheduleBase - 1) / kScheduleSlotBytes;
+const byte kSchedulePerFrame = 2;
+const unsigned long kScheduleRecheckMs = 60000;
+
+static_assert(2 + 2 * k_num_settings <= kScheduleBase,
+              "settings run into the schedule");
+
+class Schedule
+{
+public:
+  static const byte k_no_slot = 0xFF;
+
+  // Where the time of day comes from (seconds since midnight)
+  void on_clock (unsigned long (* clock) ())
+  {
+    mClock = clock;
+  }
+
+  // Told when a slot starts: its number, label and the seconds left in
+  // it (all of it at the start, less if the clock starts part way in).
+  // When a slot ends with none after it, told k_no_slot (label nullptr).
+  void on_slot (void (* callback) (byte slot, const char * label, long secs))
+  {
+    mOnSlot = callback;
+  }
+
+  void enable (bool on)
+  {
+    mOn = on;
+    mCurrent = k_no_slot;
+    mWaitMs = 0;
+  }
+
+  // Slots in EEPROM (none while a load is under way)
+  byte count () const
+  {
+    byte n = EEPROM.read(kScheduleBase);
+    return n > kMaxSlots ? 0 : n;
+  }
+
+  // The slot running, or k_no_slot between talks
+  byte current () const
+  {
+    return mCurrent;
+  }
+
+  // Start minute of a slot
+  static unsigned int start (byte slot)
+  {
+    return eeprom_read_word((const uint16_t *)address(slot));
+  }
+
+  static byte length (byte slot)
+  {
+    return EEPROM.read(address(slot) + 2);
+  }
+
+  // The last slot starting at or before a minute of the day, or
+  // k_no_slot if the first starts after it
+  byte find (unsigned int minute) const
+  {
+    byte lo = 0;
+    byte hi = count();
+    while (lo < hi)
+      {
+        byte mid = (lo + hi) / 2;
+        if (start(mid) <= minute)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+    return lo ? lo - 1 : k_no_slot;
+  }
+
+  // Take frame's worth of slots to write: first is the index of the
+  // first, total the slots in the new schedule. Returns false if the
+  // last frame is still being written.
+  bool load (byte first, byte total, const byte * slots, byte n)
+  {
+    if (busy() || n > kSchedulePerFrame || total > kMaxSlots
+        || first + n > total)
+      return false;
+
+    byte * p = mStage;
+    if (first == 0)
+      *p++ = 0;
+    memcpy(p, slots, n * kScheduleSlotBytes);
+    mStageAddr = first == 0 ? kScheduleBase : address(first);
+    mStageLen = (p - mStage) + n * kScheduleSlotBytes;
+    mStagePos = 0;
+    mCountAfter = (first + n == total) ? total : -1;
+    mCurrent = k_no_slot;
+    return true;
+  }
+
+  // Bytes of a load still to write?
+  bool busy () const
+  {
+    return mStagePos < mStageLen || mCountAfter >= 0;
+  }
+
+  // CRC-16/XMODEM of the slots, for the host to check a load
+  uint16_t crc () const
+  {
+    uint16_t crc = 0;
+    unsigned int end = address(count());
+    for (unsigned int a = kScheduleBase + 1; a < end; ++a)
+      crc = _crc_xmodem_update(crc, EEPROM.read(a));
+    return crc;
+  }
+
+  // Called every loop: writes a byte of a load when the EEPROM is
+  // ready, and starts the next slot when it is due
+  void poll ()
+  {
+    if (busy())
+      {
+        write_next();
+        return;
+      }
+    if (!mOn || !mClock || millis() - mChecked < mWaitMs)
+      return;
+    check();
+  }
+
+private:
+  unsigned long (* mClock) () = nullptr;
+  void (* mOnSlot) (byte, const char *, long) = nullptr;
+  bool mOn = true;
+
+  byte mCurrent = k_no_slot;
+  unsigned long mChecked = 0;
+  unsigned long mWaitMs = 0;
+  char mLabel [kScheduleLabel + 1];
+
+  // Load being written
+  byte mStage [1 + kSchedulePerFrame * kScheduleSlotBytes];
+  unsigned int mStageAddr = 0;
+  byte mStageLen = 0;
+  byte mStagePos = 0;
+  int mCountAfter = -1;
+
+  static unsigned int address (byte slot)
+  {
+    return kScheduleBase + 1 + slot * kScheduleSlotBytes;
+  }
+
+  void write_next ()
+  {
+    if (!eeprom_is_ready())
+      return;
+    // Bytes that are already right cost nothing
+    while (mStagePos < mStageLen)
+      {
+        unsigned int a = mStageAddr + mStagePos;
+        byte b = mStage[mStagePos++];
+        if (EEPROM.read(a) != b)
+          {
+            EEPROM.write(a, b);
+            return;
+          }
+      }
+    if (mCountAfter >= 0)
+      {
+        EEPROM.update(kScheduleBase, mCountAfter);
+        mCountAfter = -1;
+        mWaitMs = 0;
+      }
+  }
+
+  // Which slot is it now, and when will that next change?
+  void check ()
+  {
+    unsigned long now = mClock();
+    unsigned int minute = now / 60;
+    byte slot = find(minute);
+    long left = 0;
+    unsigned long next;
+
+    if (slot != k_no_slot)
+      {
+        unsigned long end = (start(slot) + (unsigned long)length(slot)) * 60;
+        if (now < end)
+          left = end - now;
+      }
+    if (left)
+      next = now + left;
+    else
+      {
+        // Between talks: until the next one starts (or tomorrow's first)
+        byte n = count();
+        byte following = slot == k_no_slot ? 0 : slot + 1;
+        next = following < n ? start(following) * 60UL
+          : n ? (start(0) + 24 * 60UL) * 60 : now + kScheduleRecheckMs / 1000;
+        slot = k_no_slot;
+      }
+
+    mChecked = millis();
+    mWaitMs = min((next - now) * 1000, kScheduleRecheckMs);
+
+    if (slot == mCurrent)
+      return;
+    mCurrent = slot;
+    if (!mOnSlot)
+      return;
+    if (slot == k_no_slot)
+      {
+        mOnSlot(k_no_slot, nullptr, 0);
+        return;
+      }
+    eeprom_read_block(mLabel, (const void *)(address(slot) + 3), kScheduleLabel);
+    mLabel[kScheduleLabel] = 0;
+    mOnSlot(slot, mLabel, left);
+  }
+};
+
+extern Schedule schedule;
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+
+/*
+ * Settings that can be changed on the clock (SettingsView in
+ * Displays.h) and kept in EEPROM, so a clock can be retuned for a
+ * venue without a reflash.
+ *
+ * Each setting is described in flash: name, unit, type, default, range
+ * and step. The values are held in RAM, indexed by id; the code that
+ * uses them is told of each change through the on_change() callback
+ * (and of every value at load()).
+ *
+ * Changes are saved once they have been left alone for kSettingsSaveMs,
+ * so holding a button down through a range is one save. poll() writes
+ * a byte at a time, and only when the EEPROM has finished the last
+ * one, so saving never holds up the loop. Only bytes that differ are
+ * written.
+ *
+ * EEPROM: a magic byte, the number of settings saved, then 2 bytes per
+ * setting (little endian) in id order. A value that is missing or out
+ * of range loads as the default.
+ */
+
+const unsigned int kSettingsBase = 0;
+const byte kSettingsMagic = 0xC5;
+const unsigned int kSettingsSaveMs = 2000;
+
+typedef enum {
+  k_setting_number,   // shown with its unit
+  k_setting_toggle,   // 0 or 1, shown as Off or On
+  k_setting_colour    // 0xRGB, 4 bits a channel, shown as #RGB
+} setting_type_t;
+
+// id, name, unit, type, default, min, max, step. Add new settings at
+// the end so values saved by older firmware still load.
+#define SETTINGS(X)                                                          \
+  X(k_set_warn_min,    "Warn at",     "min", k_setting_number, 3, 0, 59, 1)   \
+  X(k_set_alarm_min,   "Alarm at",    "min", k_setting_number, 1, 0, 59, 1)   \
+  X(k_set_hold_ms,     "Hold time",   "ms",  k_setting_number, 600, 200, 2000, 50) \
+  X(k_set_debounce_ms, "Debounce",    "ms",  k_setting_number, 16, 8, 60, 4)  \
+  X(k_set_brightness,  "Brightness",  "%",   k_setting_number, 100, 10, 400, 10) \
+  X(k_set_idle_sleep,  "Idle sleep",  "",    k_setting_toggle, 1, 0, 1, 1)  \
+  X(k_set_schedule,    "Schedule",    "",    k_setting_toggle, 1, 0, 1, 1)  \
+  X(k_set_fade_s,      "Fade over",   "s",   k_setting_number, 30, 0, 120, 5) \
+  X(k_set_ok_colour,   "Time ok",     "",    k_setting_colour, 0x090, 0, 0xFFF, 1) \
+  X(k_set_warn_colour, "Warn colour", "",    k_setting_colour, 0x770, 0, 0xFFF, 1) \
+  X(k_set_alarm_colour, "Alarm colour", "",  k_setting_colour, 0xF00, 0, 0xFFF, 1)
+
+#define SETTING_ID(id, name, unit, type, def, lo, hi, step) id,
+typedef enum { SETTINGS(SETTING_ID) k_num_settings } setting_id_t;
+#undef SETTING_ID
+
+// One setting, as kept in flash
+struct SettingSpec
+{
+  const char * name;    // in flash
+  const char * unit;    // in flash
+  byte type;
+  int def;
+  int min;
+  int max;
+  int step;
+};
+
+#define SETTING_TEXT(id, name, unit, type, def, lo, hi, step) \
+  const char id##_name[] PROGMEM = name;                       \
+  const char id##_unit[] PROGMEM = unit;
+SETTINGS(SETTING_TEXT)
+#undef SETTING_TEXT
+
+#define SETTING_SPEC(id, name, unit, type, def, lo, hi, step) \
+  {id##_name, id##_unit, type, def, lo, hi, step},
+const SettingSpec kSettingSpecs[k_num_settings] PROGMEM = { SETTINGS(SETTING_SPEC) };
+#undef SETTING_SPEC
+
+
+class Settings
+{
+public:
+  // Told of every value loaded or changed
+  void on_change (void (* callback) (byte id, int value))
+  {
+    mOnChange = callback;
+  }
+
+  static void spec (byte id, SettingSpec * s)
+  {
+    memcpy_P(s, &kSettingSpecs[id], sizeof(*s));
+  }
+
+  // Read the saved values, and apply them all
+  void load ()
+  {
+    byte saved = 0;
+    if (EEPROM.read(kSettingsBase) == kSettingsMagic)
+      saved = EEPROM.read(kSettingsBase + 1);
+    for (byte id = 0; id < k_num_settings; ++id)
+      {
+        SettingSpec s;
+        spec(id, &s);
+        int v = s.def;
+        if (id < saved)
+          {
+            unsigned int addr = slot(id);
+            int stored = (int16_t)(EEPROM.read(addr) | EEPROM.read(addr + 1) << 8);
+            if (stored >= s.min && stored <= s.max)
+              v = stored;
+          }
+        mValues[id] = v;
+        apply(id);
+      }
+    // Anything missing is written out
+    mDirty = saved != k_num_settings;
+    mChanged = millis();
+  }
+
+  int get (byte id) const
+  {
+    return mValues[id];
+  }
+
+  // Change a setting (kept to its range), apply it now and save it
+  // later
+  void set (byte id, int value)
+  {
+    if (id >= k_num_settings)
+      return;
+    SettingSpec s;
+    spec(id, &s);
+    value = constrain(value, s.min, s.max);
+    if (value == mValues[id])
+      return;
+    mValues[id] = value;
+    mDirty = true;
+    mChanged = millis();
+    apply(id);
+  }
+
+  // Up or down by steps of the setting's step
+  void step (byte id, int steps)
+  {
+    SettingSpec s;
+    spec(id, &s);
+    set(id, mValues[id] + steps * s.step);
+  }
+
+  // Waiting to be saved?
+  bool dirty () const
+  {
+    return mDirty;
+  }
+
+  // Called every loop: saves a byte, if one is due and the EEPROM is
+  // free
+  void poll ()
+  {
+    if (!mDirty || millis() - mChanged < kSettingsSaveMs || !eeprom_is_ready())
+      return;
+
+    // The first byte that differs from what should be there
+    for (unsigned int i = 0; i < kBytes; ++i)
+      {
+        byte want = image(i);
+        if (EEPROM.read(kSettingsBase + i) != want)
+          {
+            EEPROM.write(kSettingsBase + i, want);
+            return;
+          }
+      }
+    mDirty = false;
+  }
+
+private:
+  static const unsigned int kBytes = 2 + 2 * k_num_settings;
+
+  int mValues[k_num_settings];
+  bool mDirty = false;
+  unsigned long mChanged = 0;
+  void (* mOnChange) (byte, int) = nullptr;
+
+  static unsigned int slot (byte id)
+  {
+    return kSettingsBase + 2 + 2 * id;
+  }
+
+  // Byte i of the EEPROM layout, as it should be
+  byte image (unsigned int i) const
+  {
+    if (i == 0)
+      return kSettingsMagic;
+    if (i == 1)
+      return k_num_settings;
+    int v = mValues[(i - 2) / 2];
+    return (i & 1) ? v >> 8 : v & 0xFF;
+  }
+
+  void apply (byte id)
+  {
+    if (mOnChange)
+      mOnChange(id, mValues[id]);
+  }
+};
+
+extern Settings settings;
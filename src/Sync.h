@@ -0,0 +1,464 @@
+#pragma once
+
+#include <Arduino.h>
+#include "HAL.h"
+#include "TimeBase.h"
+#include "Timers.h"
+#include "Log.h"
+
+/*
+ * Keeps clocks showing the same timers over their serial ports: each
+ * clock wired TX to RX with a master clock, or all of them on a USB hub
+ * with a host PC as the master (tools/sync_host.py).
+ *
+ * A slave steers its TimeBase onto the master's with NTP style
+ * exchanges, and takes copies of the master's timers. Timers run from
+ * deadlines on the time base, so once the time bases agree the
+ * countdowns agree, to the ms, without any further traffic. Clocks
+ * that can only listen (the master's TX wired to several RXs) steer
+ * from the master's beacons instead.
+ *
+ * While a clock is master or slave the port belongs to the link, and
+ * the one letter commands are ignored. @O hands it back.
+ *
+ * Lines start with '@' so they share the port with the one letter
+ * commands. Times (t) are the sender's time base as ms.uuu.
+ *
+ *   @M / @S / @O          become master, slave, or neither
+ *   @B t                  master: the time, once a second
+ *   @Q t1                 slave: what's the time?
+ *   @R t1 t2 t3           master: t1 back, when the query arrived (t2)
+ *                         and when this answer left (t3)
+ *   @T id flags start v   master: timer id (see TimerWheel::save())
+ *   @W unix ms            host: its wall clock when sending, to set the
+ *                         RTC to
+ *   @?                    report the residual offsets since last asked
+ */
+
+class Sync
+{
+public:
+  typedef enum {k_off, k_master, k_slave} role_t;
+
+  Sync (Print * port, TimerBank * bank):
+    mPort(port),
+    mBank(bank)
+  {}
+
+  void set_role (role_t role)
+  {
+    mRole = role;
+    mOutstanding = false;
+    mSamples = 0;
+    reset_stats();
+  }
+
+  role_t role () const
+  { return mRole; }
+
+  // Called with the RTC time to set (Unix seconds), on the second
+  void on_set_clock (void (*fn)(unsigned long))
+  {
+    mSetClock = fn;
+  }
+
+  // Give the parser a byte from the port. Returns false if it is a
+  // command for the caller to handle.
+  bool feed (char c)
+  {
+    // While syncing the port is the link to the other clocks, and
+    // anything else on it (e.g. their button messages) is ignored
+    if (mLen == 0 && c != '@')
+      return mRole != k_off;
+
+    if (c == '\r')
+      return true;
+    if (c != '\n')
+      {
+        if (mLen < sizeof(mLine) - 1)
+          mLine[mLen++] = c;
+        else
+          mOverflow = true;
+        return true;
+      }
+
+    // Arrival of the whole line
+    Stamp at = timebase.stamp();
+    mLine[mLen] = 0;
+    if (!mOverflow)
+      handle(at);
+    mLen = 0;
+    mOverflow = false;
+    return true;
+  }
+
+  // Called every loop: queries (slave), timer copies (master) and a
+  // pending RTC set
+  void poll ()
+  {
+    unsigned long now = timebase.now();
+
+    if (mRole == k_slave)
+      {
+        // Faster until the first few samples are in
+        unsigned long interval = kInterval;
+        if (mSamples < 8)
+          interval = kFastInterval;
+        if ((!mOutstanding && now - mLastQuery >= interval)
+            || now - mLastQuery >= kTimeout)
+          send_query();
+      }
+
+    if (mRole == k_master)
+      {
+        if (now - mLastBeacon >= kInterval)
+          {
+            mLastBeacon = now;
+            send_beacon();
+          }
+
+        unsigned long changed = mBank->take_changed();
+        for (unsigned char id = 0; id < mBank->count(); ++id)
+          if (changed & (1UL << id))
+            send_timer(id);
+
+        // Resend one timer at a time, for slaves that missed a line or
+        // joined late
+        if (now - mLastRefresh >= kRefreshInterval && mBank->count())
+          {
+            mLastRefresh = now;
+            mRefreshId = (mRefreshId + 1) % mBank->count();
+            send_timer(mRefreshId);
+          }
+      }
+
+    if (mClockPending && (long)(mClockAt - now) <= 20)
+      {
+        // Close enough to spin for it: the RTC starts its second when
+        // the seconds register is written
+        unsigned long at = timebase.micros_at(mClockAt);
+        while ((long)(micros() - at) < 0)
+          ;
+        mClockPending = false;
+        if (mSetClock)
+          mSetClock(mClockUnix);
+      }
+  }
+
+  // Residual offset (us) of the samples since the last reset: how far
+  // this clock was from the master each time it looked
+  unsigned int samples () const
+  { return mStatN; }
+
+  long mean_us () const
+  { return mStatN ? mStatSum / (long)mStatN : 0; }
+
+  // Mean absolute offset (no floats, for the flash they would take)
+  long mad_us () const
+  { return mStatN ? mStatAbs / mStatN : 0; }
+
+  long max_us () const
+  { return mStatMax; }
+
+  void reset_stats ()
+  {
+    mStatN = 0;
+    mStatSum = 0;
+    mStatAbs = 0;
+    mStatMax = 0;
+    mRejected = 0;
+  }
+
+  void print_stats ()
+  {
+    char buf [80];
+    sprintf(buf, "@s %u %ld %ld %ld %ld %ld %u\n", mStatN, mean_us(), mad_us(),
+            max_us(), mMinRtt, timebase.freq_ppm(), mRejected);
+    mPort->print(buf);
+  }
+
+private:
+  static const unsigned long kInterval = 1000;
+  static const unsigned long kFastInterval = 250;
+  static const unsigned long kTimeout = 3000;
+  static const unsigned long kRefreshInterval = 1000;
+
+  // Errors over this are stepped out rather than steered
+  static const long kStepUs = 100000;
+  static const long kCoarseMs = 1000000;
+
+  // us per byte on the wire (8N1), taken out of the measurements
+  static const long kByteUs = 10000000L / SERIAL_BAUD;
+
+  Print * mPort;
+  TimerBank * mBank;
+  role_t mRole = k_off;
+  void (*mSetClock)(unsigned long) = nullptr;
+
+  char mLine[48];
+  unsigned char mLen = 0;
+  bool mOverflow = false;
+
+  // Slave: the query in flight
+  bool mOutstanding = false;
+  Stamp mT1;
+  unsigned char mQueryLen = 0;
+  unsigned long mLastQuery = 0;
+  unsigned long mLastSteer = 0;
+  unsigned long mLastAnswer = 0;
+  unsigned int mSamples = 0;
+
+  // Round trip: least seen (slowly forgotten), and of the best sample
+  // less the wire time
+  long mMinRtt = 0;
+  long mPathUs = 0;
+
+  // Master
+  unsigned long mLastBeacon = 0;
+  unsigned long mLastRefresh = 0;
+  unsigned char mRefreshId = 0;
+
+  // RTC set waiting for its second
+  bool mClockPending = false;
+  unsigned long mClockAt = 0;
+  unsigned long mClockUnix = 0;
+
+  // Residual stats
+  unsigned int mStatN = 0;
+  long mStatSum = 0;
+  unsigned long mStatAbs = 0;
+  long mStatMax = 0;
+  unsigned int mRejected = 0;
+
+  void handle (const Stamp & at)
+  {
+    char * p = mLine + 2;
+    switch (mLine[1])
+      {
+      case 'M':
+        set_role(k_master);
+        break;
+      case 'S':
+        set_role(k_slave);
+        break;
+      case 'O':
+        set_role(k_off);
+        break;
+      case '?':
+        print_stats();
+        reset_stats();
+        break;
+
+      case 'Q':
+        if (mRole != k_slave)
+          {
+            Stamp t1 = parse_stamp(&p);
+            reply(t1, at);
+          }
+        break;
+
+      case 'R':
+        if (mRole == k_slave && mOutstanding)
+          {
+            Stamp t1 = parse_stamp(&p);
+            Stamp t2 = parse_stamp(&p);
+            Stamp t3 = parse_stamp(&p);
+            if (t1.ms == mT1.ms && t1.us == mT1.us)
+              sample(t1, t2, t3, at, mLen + 1);
+          }
+        break;
+
+      case 'B':
+        if (mRole == k_slave)
+          beacon(parse_stamp(&p), at, mLen + 1);
+        break;
+
+      case 'T':
+        if (mRole == k_slave)
+          {
+            unsigned char id = strtoul(p, &p, 10);
+            unsigned char flags = strtoul(p, &p, 10);
+            unsigned long start = strtoul(p, &p, 10);
+            long value = strtol(p, &p, 10);
+            mBank->restore(id, flags, start, value);
+          }
+        break;
+
+      case 'W':
+        {
+          unsigned long secs = strtoul(p, &p, 10);
+          unsigned long ms = strtoul(p, &p, 10);
+          set_clock(secs, ms, at, mLen + 1);
+        }
+        break;
+      }
+  }
+
+  static Stamp parse_stamp (char ** p)
+  {
+    Stamp s;
+    s.ms = strtoul(*p, p, 10);
+    s.us = (**p == '.') ? strtoul(*p + 1, p, 10) : 0;
+    return s;
+  }
+
+  static void print_stamp (char * buf, const Stamp & s)
+  {
+    sprintf(buf, "%lu.%03u", s.ms, s.us);
+  }
+
+  void send_query ()
+  {
+    char buf [24];
+    mT1 = timebase.stamp();
+    strcpy(buf, "@Q ");
+    print_stamp(buf + 3, mT1);
+    strcat(buf, "\n");
+    mQueryLen = strlen(buf);
+    mPort->print(buf);
+    mOutstanding = true;
+    mLastQuery = timebase.now();
+  }
+
+  void reply (const Stamp & t1, const Stamp & t2)
+  {
+    char buf [48];
+    char * p = buf;
+    strcpy(p, "@R ");
+    p += 3;
+    print_stamp(p, t1);
+    p += strlen(p);
+    *p++ = ' ';
+    print_stamp(p, t2);
+    p += strlen(p);
+    *p++ = ' ';
+    // Last, so the time spent formatting is in t3 - t2
+    print_stamp(p, timebase.stamp());
+    strcat(p, "\n");
+    mPort->print(buf);
+  }
+
+  void send_beacon ()
+  {
+    char buf [24];
+    strcpy(buf, "@B ");
+    print_stamp(buf + 3, timebase.stamp());
+    strcat(buf, "\n");
+    mPort->print(buf);
+  }
+
+  void send_timer (unsigned char id)
+  {
+    unsigned char flags;
+    unsigned long start;
+    long value;
+    mBank->save(id, &flags, &start, &value);
+
+    char buf [40];
+    sprintf(buf, "@T %u %u %lu %ld\n", id, flags, start, value);
+    mPort->print(buf);
+  }
+
+  // One exchange: t1 query sent, t2 received, t3 answer sent, t4
+  // received. Each line is stamped before its first byte is sent and
+  // after its last arrives, so the wire time of each is taken out
+  // before the usual offset and round trip.
+  void sample (const Stamp & t1, const Stamp & t2, const Stamp & t3,
+               const Stamp & t4, unsigned char reply_len)
+  {
+    mOutstanding = false;
+    mLastAnswer = timebase.now();
+    if (coarse(t1, t2))
+      return;
+
+    long up = stamp_diff(t1, t2) - (long)mQueryLen * kByteUs;
+    long down = stamp_diff(t3, t4) - (long)reply_len * kByteUs;
+    long offset = (up - down) / 2;  // i.e. master - slave
+    long rtt = stamp_diff(t1, t4) - stamp_diff(t2, t3);
+
+    // Take only samples with a round trip close to the best: the others
+    // were held up somewhere, most likely one way
+    mMinRtt += 20;
+    if (mSamples == 0 || rtt < mMinRtt)
+      mMinRtt = rtt;
+    if (rtt > mMinRtt + mMinRtt / 2 + 500)
+      {
+        mRejected ++;
+        return;
+      }
+
+    mPathUs = up + down;
+    correct(offset);
+  }
+
+  // A beacon sent at t3 arrived at t4. Only used by a slave that isn't
+  // getting answers, which has to take the wire time as the whole delay.
+  void beacon (const Stamp & t3, const Stamp & t4, unsigned char len)
+  {
+    if (timebase.now() - mLastAnswer < kTimeout * 2)
+      return;
+    if (coarse(t4, t3))
+      return;
+    correct((long)len * kByteUs - stamp_diff(t3, t4));
+  }
+
+  // Clocks that started far apart: bring the ms close first
+  bool coarse (const Stamp & local, const Stamp & remote)
+  {
+    long ms = remote.ms - local.ms;
+    if (ms > -kCoarseMs && ms < kCoarseMs)
+      return false;
+    timebase.step_ms(ms);
+    LOG(k_log_sync_step, ms, 0);
+    mSamples = 0;
+    return true;
+  }
+
+  void correct (long offset)
+  {
+    // Anything far out is stepped without question (first contact, or
+    // the master restarted)
+    if (offset > kStepUs || offset < -kStepUs)
+      {
+        timebase.step(offset);
+        LOG(k_log_sync_step, offset / 1000, 0);
+        mSamples = 0;
+        return;
+      }
+
+    mSamples ++;
+    record(offset);
+
+    unsigned long now = timebase.now();
+    timebase.steer(offset, mSamples > 1 ? now - mLastSteer : 0);
+    mLastSteer = now;
+  }
+
+  void record (long offset)
+  {
+    mStatN ++;
+    mStatSum += offset;
+    long mag = offset < 0 ? -offset : offset;
+    mStatAbs += mag;
+    if (mag > mStatMax)
+      mStatMax = mag;
+  }
+
+  // Host wall clock (Unix s + ms) when it sent a line that arrived at
+  // `at`. Schedule the RTC write for the start of the next second.
+  void set_clock (unsigned long secs, unsigned long ms, const Stamp & at, unsigned char len)
+  {
+    // How long the line took: its wire time, plus half the rest of the
+    // round trip if we have been syncing
+    long delay = (long)len * kByteUs + (mSamples ? mPathUs / 2 : 0);
+    unsigned long frac = ms * 1000 + delay;  // us into the host's second
+    secs += frac / 1000000;
+    frac %= 1000000;
+
+    mClockUnix = secs + 1;
+    mClockAt = at.ms + (at.us + 1000000 - frac) / 1000;
+    mClockPending = true;
+  }
+};
+
+extern Sync timesync;
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Something that needs to know when a second has passed
+class Ticker
+{
+public:
+  // Called once per second by the TimeBase, with the time (ms) of
+  // the second that has just started
+  virtual void tick (unsigned long now) = 0;
+
+  Ticker * next_ticker = nullptr;
+};
+
+
+// A time base reading to the us: ms, and us into that ms
+struct Stamp
+{
+  unsigned long ms;
+  unsigned int us;
+};
+
+// b - a in us. Only for stamps within ~35 minutes of each other.
+inline long stamp_diff (const Stamp & a, const Stamp & b)
+{
+  return (long)(b.ms - a.ms) * 1000 + ((long)b.us - (long)a.us);
+}
+
+
+/*
+ * The one clock everything times from. poll() is called every loop;
+ * models read now() instead of calling millis() themselves, and
+ * tickers registered with add() are run once per second whether or not
+ * anything is showing them.
+ *
+ * It runs from micros(), and can be steered onto another clock (see
+ * Sync.h): a frequency correction, and phase corrections that are
+ * slewed in rather than jumped so time never runs backwards. Only
+ * large errors are stepped.
+ */
+class TimeBase
+{
+public:
+  void add (Ticker * t)
+  {
+    t->next_ticker = mTickers;
+    mTickers = t;
+  }
+
+  void poll ()
+  {
+    unsigned long us = micros();
+    unsigned long dus = us - mPollUs;
+    mPollUs = us;
+
+    // Corrections are applied in steps short enough not to overflow
+    while (dus > kChunkUs)
+      {
+        advance(kChunkUs);
+        dus -= kChunkUs;
+      }
+    advance(dus);
+
+    // One tick per poll: if the loop stalls, ticks are caught up one
+    // loop at a time rather than in a burst
+    if (mNow - mLastTick >= 1000)
+      {
+        mLastTick += 1000;
+        for (Ticker * t = mTickers; t; t = t->next_ticker)
+          t->tick(mLastTick);
+      }
+  }
+
+  // Time of the last poll, in ms
+  unsigned long now () const
+  { return mNow; }
+
+  // The time right now, to the us
+  Stamp stamp () const
+  {
+    unsigned long us = mSubUs + (micros() - mPollUs);
+    Stamp s = {mNow + us / 1000, (unsigned int)(us % 1000)};
+    return s;
+  }
+
+  // The micros() value at which the time base will read t (ms)
+  unsigned long micros_at (unsigned long t) const
+  {
+    return mPollUs + (long)(t - mNow) * 1000 - mSubUs;
+  }
+
+  // Jump by offset_us. Ticks carry on from the new second.
+  void step (long offset_us)
+  {
+    long us = (long)mSubUs + offset_us % 1000;
+    long ms = offset_us / 1000;
+    if (us < 0)
+      {
+        us += 1000;
+        ms --;
+      }
+    mNow += ms + us / 1000;
+    mSubUs = us % 1000;
+    mLastTick = mNow - mNow % 1000;
+    mSlewUs = 0;
+  }
+
+  // Jump by whole ms, for clocks too far apart to compare in us
+  void step_ms (long offset_ms)
+  {
+    mNow += offset_ms;
+    mLastTick = mNow - mNow % 1000;
+    mSlewUs = 0;
+  }
+
+  // Correct by offset_us (the reference clock minus this one), measured
+  // interval_ms after the last correction. Half the error is slewed out,
+  // and an eighth of the rate it built up at goes into the frequency.
+  void steer (long offset_us, unsigned long interval_ms)
+  {
+    mSlewUs = offset_us / 2;
+    if (interval_ms)
+      mFreqPpm += offset_us * 125L / (long)interval_ms;
+    if (mFreqPpm > kMaxPpm)
+      mFreqPpm = kMaxPpm;
+    if (mFreqPpm < -kMaxPpm)
+      mFreqPpm = -kMaxPpm;
+  }
+
+  // Frequency correction, parts per million
+  long freq_ppm () const
+  { return mFreqPpm; }
+
+  // Input handlers record when their event really happened (micros()),
+  // so whatever it triggers can be timed from that rather than from
+  // when it got round to running.
+  void stamp_input (unsigned long us)
+  { mInputUs = us; }
+
+  unsigned long input_us () const
+  { return mInputUs; }
+
+private:
+  // Room to correct a Nano's ceramic resonator (~0.5%) and then some
+  static const long kMaxPpm = 20000;
+  static const unsigned long kChunkUs = 50000;
+
+  unsigned long mInputUs = 0;
+  Ticker * mTickers = nullptr;
+  unsigned long mNow = 0;
+  unsigned long mLastTick = 0;
+
+  // micros() at the last poll, and us past mNow at that point
+  unsigned long mPollUs = 0;
+  unsigned long mSubUs = 0;
+
+  long mFreqPpm = 0;
+  long mRateAcc = 0;   // us * ppm not yet applied
+  long mSlewUs = 0;    // phase correction still to slew in
+
+  void advance (unsigned long dus)
+  {
+    mRateAcc += (long)dus * mFreqPpm;
+    long rate = mRateAcc / 1000000L;
+    mRateAcc -= rate * 1000000L;
+
+    // Slew at most 1/16 of the time passing
+    long limit = dus >> 4;
+    long slew = constrain(mSlewUs, -limit, limit);
+    mSlewUs -= slew;
+
+    mSubUs += dus + rate + slew;
+    mNow += mSubUs / 1000;
+    mSubUs %= 1000;
+  }
+};
+
+extern TimeBase timebase;
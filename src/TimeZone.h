@@ -0,0 +1,112 @@
+#pragma once
+
+#include <Arduino.h>
+#include <avr/pgmspace.h>
+#include "Calendar.h"
+
+/*
+ * Local time. The RTC keeps UTC (which is what the sync host sets it
+ * to), and the clock shows the time in the zone it was built for.
+ *
+ * The zone is a table in flash of each change of UTC offset over a
+ * decade (DST starting and ending), worked out on the PC by
+ * tools/tz_table.py into TimeZoneTable.h; the build runs it for the
+ * zone in platformio.ini. There are no rules to evaluate on the clock.
+ *
+ * The offset is kept with the span of time it holds for, so turning
+ * UTC into local time is one compare and an add until the next change
+ * comes round; then a binary search of the table finds the next span.
+ * Past the end of the table the last offset carries on.
+ */
+
+// One change of offset, as kept in flash
+struct TzChange
+{
+  uint32_t at;          // Unix time
+  int16_t offset;       // minutes, from then on
+};
+
+#include "TimeZoneTable.h"
+
+class TimeZone
+{
+public:
+  // Local time for a UTC time
+  epoch_t local (epoch_t utc)
+  {
+    // One compare for both ends (unsigned)
+    if (utc - mFrom >= mSpan)
+      find(utc);
+    return utc + mOffset;
+  }
+
+  // UTC for a local time (for setting the clock, not every second). A
+  // local time that came twice is taken as the first; one the clocks
+  // jumped over, as the offset before the jump.
+  epoch_t to_utc (epoch_t local_secs)
+  {
+    // Near enough to find the offsets either side of any change near
+    // it (changes are months apart)
+    epoch_t near = local_secs - offset_at(local_secs);
+    long before = offset_at(near - 43200L);
+    long after = offset_at(near + 43200L);
+    epoch_t first = local_secs - before;
+    epoch_t second = local_secs - after;
+    if (first > second)
+      {
+        epoch_t t = first;
+        first = second;
+        second = t;
+      }
+    if (local(first) == local_secs)
+      return first;
+    if (local(second) == local_secs)
+      return second;
+    return local_secs - before;
+  }
+
+  // Offset now in use, in seconds
+  long offset () const
+  {
+    return mOffset;
+  }
+
+private:
+  epoch_t mFrom = 0;
+  uint32_t mSpan = 0;
+  long mOffset = 0;
+
+  long offset_at (epoch_t utc)
+  {
+    local(utc);
+    return mOffset;
+  }
+
+  static uint32_t change_at (byte i)
+  {
+    return pgm_read_dword(&kTzChanges[i].at);
+  }
+
+  // The last change at or before utc, and the span to the next
+  void find (epoch_t utc)
+  {
+    byte lo = 0;
+    byte hi = kTzCount;
+    while (lo < hi)
+      {
+        byte mid = (lo + hi) / 2;
+        if (change_at(mid) <= utc)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+    // lo changes have happened
+    mFrom = lo ? change_at(lo - 1) : 0;
+    epoch_t to = lo < kTzCount ? change_at(lo) : 0xFFFFFFFFUL;
+    mSpan = to - mFrom;
+    mOffset = 60L * (lo ? (int16_t)pgm_read_word(&kTzChanges[lo - 1].offset)
+                     : kTzBaseOffset);
+  }
+};
+
+extern TimeZone zone;
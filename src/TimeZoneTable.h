@@ -0,0 +1,35 @@
+#pragma once
+
+// Generated by tools/tz_table.py: Australia/Sydney, 2026 to 2035. Don't edit.
+
+#define TZ_NAME "Australia/Sydney"
+#define TZ_FROM_YEAR 2026
+#define TZ_YEARS 10
+
+// UTC offset (min) before the first change
+const int16_t kTzBaseOffset = 660;
+
+// Changes of offset: Unix time, and the offset (min) from then
+const byte kTzCount = 20;
+const TzChange kTzChanges[] PROGMEM = {
+  {1775318400UL, 600},   // 2026-04-04 16:00 UTC
+  {1791043200UL, 660},   // 2026-10-03 16:00 UTC
+  {1806768000UL, 600},   // 2027-04-03 16:00 UTC
+  {1822492800UL, 660},   // 2027-10-02 16:00 UTC
+  {1838217600UL, 600},   // 2028-04-01 16:00 UTC
+  {1853942400UL, 660},   // 2028-09-30 16:00 UTC
+  {1869667200UL, 600},   // 2029-03-31 16:00 UTC
+  {1885996800UL, 660},   // 2029-10-06 16:00 UTC
+  {1901721600UL, 600},   // 2030-04-06 16:00 UTC
+  {1917446400UL, 660},   // 2030-10-05 16:00 UTC
+  {1933171200UL, 600},   // 2031-04-05 16:00 UTC
+  {1948896000UL, 660},   // 2031-10-04 16:00 UTC
+  {1964620800UL, 600},   // 2032-04-03 16:00 UTC
+  {1980345600UL, 660},   // 2032-10-02 16:00 UTC
+  {1996070400UL, 600},   // 2033-04-02 16:00 UTC
+  {2011795200UL, 660},   // 2033-10-01 16:00 UTC
+  {2027520000UL, 600},   // 2034-04-01 16:00 UTC
+  {2043244800UL, 660},   // 2034-09-30 16:00 UTC
+  {2058969600UL, 600},   // 2035-03-31 16:00 UTC
+  {2075299200UL, 660},   // 2035-10-06 16:00 UTC
+};
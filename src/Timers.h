@@ -0,0 +1,323 @@
+#pragma once
+
+#include "TimeBase.h"
+
+/*
+ * Timer models. These hold the time and run from the TimeBase; the
+ * windows in Displays.h are only views of them. A running timer keeps
+ * a deadline (or origin) rather than counting, so it costs nothing
+ * while it isn't being looked at, and there is never anything to catch
+ * up on when it is.
+ */
+
+// Id returned when there is no room for another timer
+const unsigned char kNoTimer = 0xFF;
+
+// Longest time a timer can be set to (99:59:59, as the clock shows it)
+const unsigned long kMaxTimerSecs = 99 * 3600UL + 59 * 60 + 59;
+
+/*
+ * A bank of N countdowns and stopwatches, 10 bytes each.
+ *
+ * Countdowns that are running sit in a hashed timing wheel under the
+ * second they reach zero. Each tick only looks at the one wheel slot
+ * for that second, so with at least as many slots as timers the cost
+ * per second doesn't grow with the number of timers. Stopped timers
+ * and stopwatches are not in the wheel at all.
+ */
+template <unsigned char N>
+class TimerWheel: public Ticker
+{
+public:
+  typedef enum {k_countdown, k_stopwatch} kind_t;
+  typedef enum {k_stopped, k_running, k_over} state_t;
+
+  TimerWheel ()
+  {
+    memset(mTimers, 0, sizeof(mTimers));
+    memset(mWheel, kNoTimer, sizeof(mWheel));
+  }
+
+  // Add a timer. Returns its id, or kNoTimer if the bank is full.
+  unsigned char add (kind_t kind, unsigned long secs = 0)
+  {
+    if (mCount >= N)
+      return kNoTimer;
+    unsigned char id = mCount++;
+    mTimers[id].flags = (kind == k_stopwatch) ? kStopwatch : 0;
+    mTimers[id].next = kNoTimer;
+    set(id, secs);
+    return id;
+  }
+
+  unsigned char count () const
+  { return mCount; }
+
+  kind_t kind (unsigned char id) const
+  { return (mTimers[id].flags & kStopwatch) ? k_stopwatch : k_countdown; }
+
+  // A countdown reads as over from its deadline, even if the wheel
+  // hasn't reached it yet
+  state_t state (unsigned char id) const
+  {
+    state_t s = (state_t)(mTimers[id].flags & kStateMask);
+    if (s == k_running && kind(id) == k_countdown && ms(id) <= 0)
+      return k_over;
+    return s;
+  }
+
+  // Set the time to count down from (stops the timer)
+  void set (unsigned char id, unsigned long secs)
+  {
+    unlink(id);
+    Timer & t = mTimers[id];
+    t.start = secs;
+    t.value = (long)secs * 1000;
+    set_state(id, k_stopped);
+    mChanged |= 1UL << id;
+    mSet |= 1UL << id;
+  }
+
+  void start (unsigned char id)
+  {
+    Timer & t = mTimers[id];
+    if (state(id) != k_stopped)
+      return;
+
+    unsigned long now = timebase.now();
+    mChanged |= 1UL << id;
+    if (kind(id) == k_stopwatch)
+      {
+        t.value = now - t.value;  // elapsed -> origin
+        set_state(id, k_running);
+        return;
+      }
+
+    if (t.value <= 0)
+      {
+        t.value = now + t.value;
+        set_state(id, k_over);
+        return;
+      }
+    t.value = now + t.value;      // left -> deadline
+    set_state(id, k_running);
+    link(id);
+  }
+
+  void pause (unsigned char id)
+  {
+    Timer & t = mTimers[id];
+    if (state(id) == k_stopped)
+      return;
+
+    unlink(id);
+    mChanged |= 1UL << id;
+    unsigned long now = timebase.now();
+    if (kind(id) == k_stopwatch)
+      t.value = now - t.value;    // origin -> elapsed
+    else
+      t.value = t.value - now;    // deadline -> left
+    set_state(id, k_stopped);
+  }
+
+  // Back to the time last set (or zero, for a stopwatch)
+  void reset (unsigned char id)
+  {
+    set(id, kind(id) == k_stopwatch ? 0 : mTimers[id].start);
+  }
+
+  unsigned long start_value (unsigned char id) const
+  { return mTimers[id].start; }
+
+  // Countdown: ms to go, negative once over time.
+  // Stopwatch: ms elapsed.
+  long ms (unsigned char id) const
+  {
+    const Timer & t = mTimers[id];
+    if ((t.flags & kStateMask) == k_stopped)
+      return t.value;
+    if (kind(id) == k_stopwatch)
+      return timebase.now() - t.value;
+    return (long)(t.value - timebase.now());
+  }
+
+  // Countdown: seconds to go, rounded up so the set time shows for the
+  // whole of the first second. Negative once over time.
+  // Stopwatch: whole seconds elapsed.
+  long seconds (unsigned char id) const
+  {
+    long v = ms(id);
+    if (kind(id) == k_countdown && v > 0)
+      return (v + 999) / 1000;
+    return v >= 0 ? v / 1000 : -(-v / 1000);
+  }
+
+  // Timers set, started or paused since the last call, bit per id
+  unsigned long take_changed ()
+  {
+    unsigned long changed = mChanged;
+    mChanged = 0;
+    return changed;
+  }
+
+  // Timers set (or reset, or copied in) since the last call, bit per
+  // id: times that jumped rather than ran
+  unsigned long take_set ()
+  {
+    unsigned long set = mSet;
+    mSet = 0;
+    return set;
+  }
+
+  // The raw state of a timer, to copy it to another bank. Times are on
+  // the time base, so the copy only agrees if the time bases do.
+  void save (unsigned char id, unsigned char * flags, unsigned long * start, long * value) const
+  {
+    const Timer & t = mTimers[id];
+    *flags = t.flags & (kStateMask | kStopwatch);
+    *start = t.start;
+    *value = t.value;
+  }
+
+  void restore (unsigned char id, unsigned char flags, unsigned long start, long value)
+  {
+    if (id >= mCount)
+      return;
+    unlink(id);
+    Timer & t = mTimers[id];
+    t.flags = flags & (kStateMask | kStopwatch);
+    t.start = start;
+    t.value = value;
+    if ((t.flags & kStateMask) == k_running && kind(id) == k_countdown)
+      link(id);
+    mSet |= 1UL << id;
+  }
+
+  // ms until seconds() next changes (while running)
+  unsigned int ms_to_change (unsigned char id) const
+  {
+    long v = ms(id);
+    if (kind(id) == k_countdown && v > 0)
+      return (v - 1) % 1000 + 1;
+    return 1000 - (v >= 0 ? v : -v) % 1000;
+  }
+
+  // Run the wheel slot for the second starting at now
+  virtual void tick (unsigned long now)
+  {
+    unsigned char * link = &mWheel[(now / 1000) & (kSlots - 1)];
+    while (*link != kNoTimer)
+      {
+        unsigned char id = *link;
+        Timer & t = mTimers[id];
+        if ((long)(t.value - now) <= 0)
+          {
+            // Due: take it out of the wheel
+            *link = t.next;
+            t.next = kNoTimer;
+            t.flags &= ~kLinked;
+            set_state(id, k_over);
+          }
+        else
+          {
+            // Due on a later turn of the wheel
+            link = &t.next;
+          }
+      }
+  }
+
+private:
+  struct Timer
+  {
+    unsigned char flags;
+    unsigned char next;    // next timer in the same wheel slot
+    unsigned long start;   // s, the time last set (99 h and more)
+    long value;            // ms: left or elapsed while stopped,
+                           // deadline or origin while running
+  };
+
+  static const unsigned char kStateMask = 0x03;
+  static const unsigned char kStopwatch = 0x04;
+  static const unsigned char kLinked = 0x08;
+
+  // Wheel slots: a power of two, at least N
+  static const unsigned char kSlots = N <= 8 ? 8 : (N <= 16 ? 16 : 32);
+
+  Timer mTimers[N];
+  unsigned char mWheel[kSlots];
+  unsigned char mCount = 0;
+  unsigned long mChanged = 0;
+  unsigned long mSet = 0;
+
+  void set_state (unsigned char id, state_t state)
+  {
+    mTimers[id].flags = (mTimers[id].flags & ~kStateMask) | state;
+  }
+
+  // File a running countdown under the tick at or after its deadline
+  void link (unsigned char id)
+  {
+    Timer & t = mTimers[id];
+    unsigned long due = ((unsigned long)t.value + 999) / 1000;
+    unsigned char & head = mWheel[due & (kSlots - 1)];
+    t.next = head;
+    head = id;
+    t.flags |= kLinked;
+  }
+
+  void unlink (unsigned char id)
+  {
+    Timer & t = mTimers[id];
+    if (!(t.flags & kLinked))
+      return;
+    t.flags &= ~kLinked;
+
+    unsigned long due = ((unsigned long)t.value + 999) / 1000;
+    unsigned char * link = &mWheel[due & (kSlots - 1)];
+    while (*link != kNoTimer && *link != id)
+      link = &mTimers[*link].next;
+    if (*link == id)
+      *link = t.next;
+    t.next = kNoTimer;
+  }
+};
+
+// Timers available to the windows (at most 32)
+const unsigned char kNumTimers = 8;
+typedef TimerWheel<kNumTimers> TimerBank;
+
+
+// The last N lap times (ms), newest first
+template <unsigned char N>
+class LapRing
+{
+public:
+  void push (unsigned long ms)
+  {
+    mHead = (mHead + 1) % N;
+    mLaps[mHead] = ms;
+    mTotal ++;
+  }
+
+  void clear ()
+  {
+    mTotal = 0;
+  }
+
+  // Laps held (at most N)
+  unsigned char count () const
+  { return mTotal < N ? mTotal : N; }
+
+  // Laps taken since the last clear
+  unsigned int total () const
+  { return mTotal; }
+
+  // i = 0 is the newest
+  unsigned long get (unsigned char i) const
+  { return mLaps[(mHead + N - i) % N]; }
+
+private:
+  unsigned long mLaps[N];
+  unsigned char mHead = 0;
+  unsigned int mTotal = 0;
+};
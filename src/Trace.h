@@ -0,0 +1,209 @@
+#pragma once
+
+#include <Arduino.h>
+
+/*
+ * Input trace: button edges and serial commands with their times, to
+ * play back later (tools/input_trace.py fetches and loads traces, and
+ * tools/trace_sim plays one through the button code on a PC).
+ *
+ * Recording keeps the last N events; the oldest go when it is full,
+ * and the button levels they leave behind are kept so playback still
+ * starts from the right state. While playing back, the buttons read
+ * the trace instead of their pins, and commands are handed to the
+ * command callback, each at its recorded time after the start.
+ *
+ * The button scanner goes through read() for its pins, and the serial
+ * command handler through command().
+ */
+
+// One event, as kept and sent: little endian, no padding
+struct TraceEvent
+{
+  uint16_t dt;        // ms since the event before (saturates at 65535)
+  byte kind;
+  byte value;         // pin << 1 | level, or the command
+} __attribute__((packed));
+
+template <unsigned char N>
+class TraceRing
+{
+public:
+  typedef enum {k_off, k_record, k_replay} mode_t;
+  typedef enum {k_event_pin, k_event_command} kind_t;
+
+  // Commands being played back go here
+  void on_command (void (* callback) (char))
+  {
+    mOnCommand = callback;
+  }
+
+  // Start a new recording
+  void record ()
+  {
+    mCount = mHead = 0;
+    mStartLevels = mLevels;
+    mLast = millis();
+    mMode = k_record;
+  }
+
+  // Play the trace from the start. Returns false if there is none.
+  bool replay ()
+  {
+    if (!mCount)
+      return false;
+    mLevels = mStartLevels;
+    mPos = 0;
+    mLast = millis();
+    mMode = k_replay;
+    return true;
+  }
+
+  void stop ()
+  {
+    mMode = k_off;
+  }
+
+  mode_t mode () const
+  {
+    return mMode;
+  }
+
+  // The button pins, a scan at a time (bit per pin): as read, and
+  // noted down where they changed while recording, or the trace's
+  // while playing back. Pins that aren't buttons should read high.
+  uint16_t read (uint16_t sample)
+  {
+    if (mMode == k_replay)
+      return mLevels;
+
+    uint16_t changed = sample ^ (uint16_t)mLevels;
+    if (mMode == k_record && changed)
+      for (byte pin = 0; pin < 16; ++pin)
+        if (changed & (1 << pin))
+          add(k_event_pin, pin << 1 | ((sample >> pin) & 1));
+    mLevels = (mLevels & 0xFFFF0000) | sample;
+    return sample;
+  }
+
+  // A serial command has arrived
+  void command (char c)
+  {
+    if (mMode == k_record)
+      add(k_event_command, c);
+  }
+
+  // Called every loop: plays back the events that are due
+  void poll ()
+  {
+    while (mMode == k_replay)
+      {
+        if (mPos == mCount)
+          {
+            mMode = k_off;
+            return;
+          }
+        const TraceEvent & e = at(mPos);
+        // The first event plays at once; the rest keep their spacing
+        if (mPos && millis() - mLast < e.dt)
+          return;
+        if (mPos)
+          mLast += e.dt;
+
+        if (e.kind == k_event_pin)
+          set_level(e.value >> 1, e.value & 1);
+        else if (mOnCommand)
+          mOnCommand(e.value);
+        mPos ++;
+      }
+  }
+
+  // The trace, oldest first
+  unsigned char count () const
+  {
+    return mCount;
+  }
+
+  const TraceEvent & at (unsigned char i) const
+  {
+    return mEvents[(mHead + i) % N];
+  }
+
+  // Button levels before the first event (bit per pin)
+  uint32_t start_levels () const
+  {
+    return mStartLevels;
+  }
+
+  // Load a trace from elsewhere, event i of it at a time
+  void load (unsigned char i, const TraceEvent & e, uint32_t start_levels)
+  {
+    if (i >= N)
+      return;
+    mMode = k_off;
+    if (i == 0)
+      {
+        mHead = mCount = 0;
+        mStartLevels = start_levels;
+      }
+    mEvents[(mHead + i) % N] = e;
+    if (i >= mCount)
+      mCount = i + 1;
+  }
+
+private:
+  TraceEvent mEvents[N];
+  unsigned char mHead = 0;
+  unsigned char mCount = 0;
+
+  mode_t mMode = k_off;
+  void (* mOnCommand) (char) = nullptr;
+
+  // Time of the last event recorded or played
+  unsigned long mLast = 0;
+
+  // Next event to play
+  unsigned char mPos = 0;
+
+  // Bit per pin: the level each button is at (released, with the
+  // pull-ups, until read), and at the start of the trace
+  uint32_t mLevels = 0xFFFFFFFF;
+  uint32_t mStartLevels = 0xFFFFFFFF;
+
+  void set_level (byte pin, bool level)
+  {
+    if (level)
+      mLevels |= (uint32_t)1 << pin;
+    else
+      mLevels &= ~((uint32_t)1 << pin);
+  }
+
+  void add (byte kind, byte value)
+  {
+    unsigned long now = millis();
+    if (mCount == N)
+      {
+        // Full: the oldest goes, and the start moves on past it
+        const TraceEvent & old = mEvents[mHead];
+        if (old.kind == k_event_pin)
+          {
+            if (old.value & 1)
+              mStartLevels |= (uint32_t)1 << (old.value >> 1);
+            else
+              mStartLevels &= ~((uint32_t)1 << (old.value >> 1));
+          }
+        mHead = (mHead + 1) % N;
+        mCount --;
+      }
+    TraceEvent & e = mEvents[(mHead + mCount) % N];
+    e.dt = (now - mLast > 0xFFFF) ? 0xFFFF : now - mLast;
+    e.kind = kind;
+    e.value = value;
+    mLast = now;
+    mCount ++;
+  }
+};
+
+typedef TraceRing<32> InputTrace;
+
+extern InputTrace trace;
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <Arduino.h>
+#include <avr/pgmspace.h>
+#include "OLED.h"
+
+/*
+ * Retained OLED widgets.
+ *
+ * A window lays out its screen as a table of widget specs in flash:
+ * where each one goes, how wide it is and how it is formatted. At run
+ * time each widget is bound to a variable of the window's, and the
+ * layer keeps the value it last drew. draw() compares each bound value
+ * with that and redraws only the widgets that changed, so a frame
+ * where nothing changed costs a read and a compare per widget, and no
+ * formatting or I2C at all.
+ *
+ * Everything is drawn again after the display has been cleared (the
+ * layer notices by OLED::clears()), and after invalidate(); one widget
+ * after invalidate(i). A marker moved by an invalidate is still taken
+ * off its last spot, which only a clear has blanked.
+ *
+ * What is kept per widget is a 16 bit key of the value (5 bytes a
+ * widget with the binding). Values of 16 bits or less are their own
+ * key; longs are folded, so two longs can in principle give the same
+ * key, but not with the same top half, nor when near each other (as a
+ * running time's successive values are): they differ by 25033 or more.
+ *
+ * Kinds:
+ *
+ *  - number: a bound number through a printf format taking a long
+ *    (format), or a formatter function; padded to width
+ *  - text: the string a bound char pointer points at, padded to width.
+ *    The pointer is what is compared: to change the text, point it at
+ *    another string.
+ *  - marker: a bound index picks a spot from a table; the glyphs are
+ *    moved there from the last spot. width is the number of spots, and
+ *    an index past them hides the marker.
+ */
+
+typedef enum {k_widget_number, k_widget_text, k_widget_marker} widget_kind_t;
+
+// Where a marker goes for one value of its index: glyph repeated width
+// times, or the spec's format text if glyph is 0. A width of 0 is
+// nowhere.
+struct WidgetSpot
+{
+  byte row;
+  byte col;
+  byte width;
+  char glyph;
+};
+
+// One widget, as kept in flash
+struct WidgetSpec
+{
+  byte kind;
+  byte row;
+  byte col;
+  byte width;
+  const char * format;                    // in flash
+  void (* formatter) (char * buf, long value);
+  const WidgetSpot * spots;               // in flash
+};
+
+template <unsigned char N>
+class WidgetLayer
+{
+  static_assert(N <= 8, "a WidgetLayer has at most 8 widgets");
+
+public:
+  // specs: N widget specs, in flash
+  WidgetLayer (const WidgetSpec * specs):
+    mSpecs(specs)
+  {
+    memset(mLast, 0xFF, sizeof(mLast));
+  }
+
+  // Bind widget i to a variable. The variable must outlive the layer
+  // (members of the window that owns it).
+  void bind (unsigned char i, const unsigned char * v)
+  { set(i, v, k_u8); }
+
+  void bind (unsigned char i, const int * v)
+  { set(i, v, k_s16); }
+
+  void bind (unsigned char i, const unsigned int * v)
+  { set(i, v, k_u16); }
+
+  void bind (unsigned char i, const long * v)
+  { set(i, v, k_s32); }
+
+  void bind (unsigned char i, const unsigned long * v)
+  { set(i, v, k_s32); }
+
+  void bind (unsigned char i, const char * const * v)
+  { set(i, v, k_text); }
+
+  // Draw everything next time
+  void invalidate ()
+  {
+    mDirty = 0xFF;
+  }
+
+  // Draw widget i next time
+  void invalidate (unsigned char i)
+  {
+    mDirty |= 1 << i;
+  }
+
+  // Draw the widgets whose values changed
+  void draw (OLED * disp)
+  {
+    // Cleared: nothing is on the screen to take off
+    bool cleared = disp->clears() != mClears;
+    byte dirty = cleared ? 0xFF : mDirty;
+    mDirty = 0;
+    mClears = disp->clears();
+
+    for (unsigned char i = 0; i < N; ++i)
+      {
+        long v = read(i);
+        uint16_t k = key(i, v);
+        if (!(dirty & (1 << i)) && k == mLast[i])
+          continue;
+        WidgetSpec spec;
+        memcpy_P(&spec, &mSpecs[i], sizeof(spec));
+        if (spec.kind == k_widget_marker)
+          move_marker(disp, spec, cleared ? -1 : (long)mLast[i], v);
+        else
+          draw_field(disp, spec, i);
+        mLast[i] = k;
+      }
+  }
+
+private:
+  typedef enum {k_u8, k_s16, k_u16, k_s32, k_text} bind_t;
+
+  const WidgetSpec * mSpecs;
+  const void * mValue[N];
+  byte mType[N];
+  uint16_t mLast[N];          // key() of the value drawn (0xFFFF: none)
+
+  byte mDirty = 0xFF;         // bit per widget to draw regardless
+  unsigned char mClears = 0;
+
+  void set (unsigned char i, const void * v, byte type)
+  {
+    if (i >= N)
+      return;
+    mValue[i] = v;
+    mType[i] = type;
+    invalidate(i);
+  }
+
+  // What is kept of a value to compare. A long is its low half plus
+  // its top half times an odd constant (2^16 / golden ratio).
+  uint16_t key (unsigned char i, long v) const
+  {
+    if (mType[i] != k_s32)
+      return v;
+    return (uint16_t)v + (uint16_t)((unsigned long)v >> 16) * 0x9E37U;
+  }
+
+  // The bound value, as compared. Text compares by pointer.
+  long read (unsigned char i) const
+  {
+    const void * v = mValue[i];
+    switch (mType[i])
+      {
+      case k_u8:   return *(const unsigned char *)v;
+      case k_s16:  return *(const int *)v;
+      case k_u16:  return *(const unsigned int *)v;
+      case k_s32:  return *(const long *)v;
+      default:     return (long)(uintptr_t)*(const char * const *)v;
+      }
+  }
+
+  void draw_field (OLED * disp, const WidgetSpec & spec, unsigned char i)
+  {
+    char buf [OLED::kCols + 1];
+    if (spec.kind == k_widget_text)
+      {
+        const char * text = *(const char * const *)mValue[i];
+        strncpy(buf, text ? text : "", sizeof(buf) - 1);
+      }
+    else if (spec.formatter)
+      spec.formatter(buf, read(i));
+    else
+      sprintf_P(buf, spec.format, read(i));
+    put(disp, spec.row, spec.col, spec.width, buf);
+  }
+
+  void move_marker (OLED * disp, const WidgetSpec & spec, long from, long to)
+  {
+    char buf [OLED::kCols + 1];
+    WidgetSpot spot;
+    if (from >= 0 && from < spec.width)
+      {
+        memcpy_P(&spot, &spec.spots[from], sizeof(spot));
+        buf[0] = 0;
+        put(disp, spot.row, spot.col, spot.width, buf);
+      }
+    if (to >= 0 && to < spec.width)
+      {
+        memcpy_P(&spot, &spec.spots[to], sizeof(spot));
+        if (!spot.width)
+          return;
+        if (spot.glyph)
+          {
+            memset(buf, spot.glyph, spot.width);
+            buf[spot.width] = 0;
+          }
+        else
+          strncpy_P(buf, spec.format, sizeof(buf) - 1);
+        put(disp, spot.row, spot.col, spot.width, buf);
+      }
+  }
+
+  // Text at a place, cut or padded with spaces to width
+  static void put (OLED * disp, byte row, byte col, byte width, char * buf)
+  {
+    if (!width)
+      return;
+    buf[OLED::kCols] = 0;
+    unsigned char len = strlen(buf);
+    if (width > OLED::kCols)
+      width = OLED::kCols;
+    while (len < width)
+      buf[len++] = ' ';
+    buf[width] = 0;
+    disp->set_point(row, col);
+    disp->write(buf);
+  }
+};
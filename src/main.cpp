@@ -2,6 +2,8 @@
 
 #include "OLED.h"
 #include "Displays.h"
+#include "Remote.h"
+#include "Cues.h"
 #include "HAL.h"
 #include "ButtonMgr.h"
 
@@ -11,45 +13,205 @@
 
 RTC_DS1307 rtc;
 
+// The RTC keeps UTC; this is the zone shown (TimeZoneTable.h)
+TimeZone zone;
 
-// Define the array of leds
-CRGB leds[kNumLEDs];
+
+// Palette indexed LED frame, streamed by leds.show()
+LEDBuffer leds;
+Compositor face (&leds);
+Animator animator (&face);
 
 
 OLED display;
 
 WindowManager mgr (&display);
 
+TimeBase timebase;
+
+// Log records, waiting for idle time to go out
+Log logger;
+
+// Button and command trace, for recording and playing back input
+InputTrace trace;
+
+// Idle sleep between loops
+Power power;
+
+// Settings kept in EEPROM, and the window for changing them
+Settings settings;
+SettingsView settings_view (&settings);
+
+// The day's talks, kept in EEPROM
+Schedule schedule;
+
+// Timer models, which keep running whichever window is showing
+TimerBank timers;
+
+// Actions at times left on the countdown
+Cues cues (&timers);
+
 RTCClock clk;
-ClockTimer tmr;
-CountUp stpw;
+ClockTimer tmr (&timers, 0);
+CountUp stpw (&timers, kNumTimers - 1);
+TimerList tmr_list (&timers, &tmr, &stpw);
 
 ListMenu<8> main_menu;
 
+// Throughput tests, with the loop rate of each window above
+BenchView bench (&loop);
+
+// Sync with other clocks over the serial port
+Sync timesync (&Serial, &timers);
+
+// Remote control and telemetry over the same port, the digits driven
+// from a host, and both displays copied to one
+StreamView stream;
+Mirror mirror (&display, &face);
+Remote remote (&mgr, &timers, &tmr, &stream, &mirror);
+
 
 
 // Some small functions to pass in as pointers to the managers
 void up ()
-{ mgr.up_evt (); Serial.println("Up");}
+{ mgr.up_evt (); remote.event(Remote::k_key_up);}
 
 void dn ()
-{ mgr.down_evt (); Serial.println("Down");}
+{ mgr.down_evt (); remote.event(Remote::k_key_down);}
 
 void entr ()
-{ mgr.enter_evt (); Serial.println("Enter");}
+{ mgr.enter_evt (); remote.event(Remote::k_key_enter);}
 
 void bk ()
-{ mgr.back_evt (); Serial.println("Back");}
+{ mgr.back_evt (); remote.event(Remote::k_key_back);}
+
+// Commands from a trace being played back
+void play_command (char c)
+{ remote.command(c); }
+
+// Set the RTC from a sync host (Unix seconds)
+void set_rtc (unsigned long secs)
+{ rtc_write(secs); }
+
+// Local time of day for the schedule (s since midnight)
+unsigned long rtc_seconds ()
+{
+  return zone.local(rtc_read()) % 86400UL;
+}
+
+// A talk on the schedule has started: count it down. Between talks
+// the countdown is left as it is, without the talk's name.
+void start_talk (byte slot, const char * label, long secs)
+{
+  if (slot == Schedule::k_no_slot)
+    {
+      tmr.set_title(nullptr);
+      return;
+    }
+  timers.set(0, secs);
+  timers.start(0);
+  tmr.set_title(label);
+  LOG(k_log_talk, secs, slot);
+}
+
+// The main countdown's cues, latest first
+const Cue kTalkCues[] PROGMEM = {
+  {300, k_cue_flash, 3},        // 5 minutes left
+  {120, k_cue_light, 1},        // 2 minutes: the speaker's light
+  {0, k_cue_event, 0},          // time: the AV desk
+  {0, k_cue_beep, 10},
+  {-60, k_cue_beep, 5},         // a reminder, a minute over
+};
+
+void run_cue (byte timer, byte action, byte arg)
+{
+  switch (action)
+    {
+    case k_cue_reset:
+#ifdef CUE_LIGHT_PIN
+      digitalWrite(CUE_LIGHT_PIN, LOW);
+#endif
+      break;
+    case k_cue_flash:
+      tmr.flash(arg * 1000U);
+      break;
+    case k_cue_light:
+#ifdef CUE_LIGHT_PIN
+      digitalWrite(CUE_LIGHT_PIN, arg ? HIGH : LOW);
+#endif
+      break;
+    case k_cue_event:
+      remote.cue(timer, arg, timers.seconds(timer));
+      break;
+    case k_cue_beep:
+#ifdef BUZZER_PIN
+      tone(BUZZER_PIN, 2000, arg * 100U);
+#endif
+      break;
+    }
+}
 
-ButtonMgr btn_up (BTN_UP, &up, true);
-ButtonMgr btn_dn (BTN_DOWN, &dn, true);
-PressHoldMgr btn_opt (BTN_OPT, &entr, &bk);
+ButtonScanner<4> buttons;
+
+
+// The countdown's colours: the alarm colour up to the alarm time, the
+// warning colour up to the warning time and the ok colour above it,
+// each fading in over the fade time before
+void apply_colours ()
+{
+  unsigned int fade = settings.get(k_set_fade_s);
+  unsigned int alarm = settings.get(k_set_alarm_min) * 60;
+  unsigned int warn = max(settings.get(k_set_warn_min) * 60U, alarm + fade);
+  CRGB ok = setting_colour(settings.get(k_set_ok_colour));
+  CRGB warning = setting_colour(settings.get(k_set_warn_colour));
+  CRGB late = setting_colour(settings.get(k_set_alarm_colour));
+  ColourKey keys[] = {
+    {0, late},
+    {(uint16_t)alarm, late},
+    {(uint16_t)(alarm + fade), warning},
+    {(uint16_t)warn, warning},
+    {(uint16_t)(warn + fade), ok},
+  };
+  tmr.set_colours(keys, sizeof(keys) / sizeof(keys[0]));
+}
+
+// Settings take effect here, as they load and change
+void apply_setting (byte id, int value)
+{
+  switch (id)
+    {
+    case k_set_warn_min:
+    case k_set_alarm_min:
+    case k_set_fade_s:
+    case k_set_ok_colour:
+    case k_set_warn_colour:
+    case k_set_alarm_colour:
+      apply_colours();
+      break;
+    case k_set_hold_ms:
+      buttons.set_hold_ms(value);
+      break;
+    case k_set_debounce_ms:
+      buttons.set_debounce_ms(value);
+      break;
+    case k_set_brightness:
+      leds.set_gain(brightness_gain(value));
+      break;
+    case k_set_idle_sleep:
+      power.enable(value);
+      break;
+    case k_set_schedule:
+      schedule.enable(value);
+      break;
+    }
+}
 
 
 void setup ()
 {
   display.init();
-  Serial.begin(9600);
+  Serial.begin(SERIAL_BAUD);
+  LOG(k_log_boot, 0, 0);
   
   if (! rtc.begin()) {
     display.set_point(0,0);
@@ -57,11 +219,15 @@ void setup ()
     while (1);
   }
   rtc.writeSqwPinMode(DS1307_SquareWave1HZ);
+#ifdef RTC_SQW_PIN
+  pinMode(RTC_SQW_PIN, INPUT_PULLUP);
+#endif
   
   if (! rtc.isrunning()) {
-    Serial.println("RTC is NOT running!");
-    // following line sets the RTC to the date & time this sketch was compiled
-    rtc.adjust(DateTime(F(__DATE__), F(__TIME__)));
+    LOG(k_log_rtc_stopped, 0, 0);
+    // following line sets the RTC to the date & time this sketch was
+    // compiled (local time, so made UTC)
+    rtc_write(zone.to_utc(date_time_epoch(DateTime(F(__DATE__), F(__TIME__)))));
   }
 
   // Button Stuff
@@ -72,24 +238,81 @@ void setup ()
   digitalWrite(BTN_DOWN, HIGH);
   digitalWrite(BTN_OPT, HIGH);
 
-  btn_up.init();
-  btn_dn.init();
-  btn_opt.init();
+  buttons.add(BTN_UP, ButtonScanner<4>::k_btn_repeat, &up);
+  buttons.add(BTN_DOWN, ButtonScanner<4>::k_btn_repeat, &dn);
+  buttons.add(BTN_OPT, ButtonScanner<4>::k_btn_press_hold, &entr, &bk);
+  buttons.init();
+
+  // Talks start the countdown, at times read from the RTC
+  schedule.on_clock(&rtc_seconds);
+  schedule.on_slot(&start_talk);
+
+  // Saved settings, applied to the buttons, LEDs, timer, sleep and
+  // schedule
+  settings.on_change(&apply_setting);
+  settings.load();
+  power.wake_on(BTN_UP);
+  power.wake_on(BTN_DOWN);
+  power.wake_on(BTN_OPT);
+#ifdef RTC_SQW_PIN
+  power.wake_on(RTC_SQW_PIN);
+#endif
   
   // Start up LEDs
-  FastLED.addLeds<WS2812, LED_PIN, RGB>(leds, kNumLEDs);
+  pinMode(LED_PIN, OUTPUT);
+  face.present();
+  
+  // Countdowns for each room, and a couple of stopwatches
+  for (unsigned char i = 0; i < kNumTimers - 2; ++i)
+    timers.add(TimerBank::k_countdown, 12 * 60);
+  timers.add(TimerBank::k_stopwatch);
+  timers.add(TimerBank::k_stopwatch);
+  timebase.add(&timers);
+  cues.on_cue(&run_cue);
+  cues.attach(0, kTalkCues, sizeof(kTalkCues) / sizeof(kTalkCues[0]));
+#ifdef CUE_LIGHT_PIN
+  pinMode(CUE_LIGHT_PIN, OUTPUT);
+#endif
+  timesync.on_set_clock(&set_rtc);
+  trace.on_command(&play_command);
   
   main_menu.add(&clk, "Clock");
   main_menu.add(&tmr, "Timer");
   main_menu.add(&stpw, "Stopwatch");
+  main_menu.add(&tmr_list, "All timers");
+  main_menu.add(&settings_view, "Settings");
+  main_menu.add(&bench, "Benchmarks");
+
+  bench.add(&main_menu, "Menu");
+  bench.add(&clk, "Clock");
+  bench.add(&tmr, "Timer");
+  bench.add(&stpw, "Stopwatch");
+  bench.add(&tmr_list, "All timers");
+
+  remote.add_window(&main_menu);
+  remote.add_window(&clk);
+  remote.add_window(&tmr);
+  remote.add_window(&stpw);
+  remote.add_window(&tmr_list);
   mgr.load(&tmr);
 }
 
 void loop ()
 {
+  timebase.poll();
+  cues.poll();
+  timesync.poll();
+  remote.poll();
   mgr.run();
-  btn_up.check_button();
-  btn_dn.check_button();
-  btn_opt.check_button();
+  trace.poll();
+  buttons.scan();
+  settings.poll();
+  schedule.poll();
+
+  // Whatever time is left
+  remote.idle();
+
+  // Nothing to do until the next interrupt
+  power.idle();
   
 }
@@ -0,0 +1,15 @@
+#pragma once
+
+// Just enough of the Arduino core to build the calendar code on a PC
+// (see calendar_check.cpp).
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+#define constrain(a, l, h) ((a) < (l) ? (l) : ((a) > (h) ? (h) : (a)))
+#define min(a, b) ((a) < (b) ? (a) : (b))
@@ -0,0 +1,151 @@
+/*
+ * Checks the calendar conversions (src/Calendar.h) against the C
+ * library's gmtime() and timegm() on a PC.
+ *
+ *   g++ -O2 -std=gnu++11 -Itools/calendar_check -Isrc tools/calendar_check/calendar_check.cpp -o calendar_check
+ *   ./calendar_check
+ *
+ * Every day from 1970-01-01 to 2099-12-31: the date from_epoch() gives,
+ * days_from_civil(), day_of_week() and days_in_month(); every second of
+ * a day both ways; add_months() against month sums done the long way;
+ * and step_field() held to 2000-01-01 00:00:00 .. 2099-12-31 23:59:59.
+ *
+ * Prints each check and exits non-zero if any failed.
+ */
+
+#include <time.h>
+
+#include "Arduino.h"
+#include "Calendar.h"
+
+static int failures = 0;
+
+static void check (unsigned long bad, const char * what)
+{
+  printf("%-4s %s", bad ? "FAIL" : "ok", what);
+  if (bad)
+    printf(" (%lu wrong)", bad);
+  printf("\n");
+  if (bad)
+    failures ++;
+}
+
+static struct tm gm (epoch_t secs)
+{
+  time_t t = secs;
+  struct tm g;
+  gmtime_r(&t, &g);
+  return g;
+}
+
+static epoch_t civil (int year, int month, int day, int hour = 0, int minute = 0, int second = 0)
+{
+  CivilTime t = {(uint16_t)year, (byte)month, (byte)day, (byte)hour, (byte)minute, (byte)second};
+  return to_epoch(t);
+}
+
+// add_months() the long way: count the months, then hold the day
+static epoch_t months_long_way (epoch_t secs, int n)
+{
+  struct tm g = gm(secs);
+  int months = (g.tm_year + 1900 - 2000) * 12 + g.tm_mon + n;
+  if (months < 0)
+    months = 0;
+  if (months > 99 * 12 + 11)
+    months = 99 * 12 + 11;
+  struct tm o = g;
+  o.tm_year = 2000 + months / 12 - 1900;
+  o.tm_mon = months % 12;
+  o.tm_mday = 1;
+  // Days in that month: the day before the 1st of the next
+  struct tm next = o;
+  next.tm_mon ++;
+  time_t last = timegm(&next) - 86400;
+  int days = gm(last).tm_mday;
+  o.tm_mday = g.tm_mday < days ? g.tm_mday : days;
+  return timegm(&o);
+}
+
+int main ()
+{
+  const uint16_t kLastDay = 47481;          // 2099-12-31
+  unsigned long bad;
+
+  bad = 0;
+  for (uint16_t d = 0; d <= kLastDay; ++d)
+    {
+      struct tm g = gm(d * 86400UL);
+      CivilTime t;
+      from_epoch(d * 86400UL + (d * 7919UL) % 86400, &t);
+      if (t.year != g.tm_year + 1900 || t.month != g.tm_mon + 1 || t.day != g.tm_mday)
+        bad ++;
+    }
+  check(bad, "from_epoch() date, every day 1970-2099");
+
+  bad = 0;
+  for (uint16_t d = 0; d <= kLastDay; ++d)
+    {
+      struct tm g = gm(d * 86400UL);
+      if (days_from_civil(g.tm_year + 1900, g.tm_mon + 1, g.tm_mday) != d)
+        bad ++;
+      if (day_of_week(d * 86400UL) != g.tm_wday)
+        bad ++;
+    }
+  check(bad, "days_from_civil() and day_of_week(), every day 1970-2099");
+
+  bad = 0;
+  for (int y = 1970; y <= 2099; ++y)
+    for (int m = 1; m <= 12; ++m)
+      {
+        epoch_t next = m == 12 ? civil(y + 1, 1, 1) : civil(y, m + 1, 1);
+        if (days_in_month(y, m) != gm(next - 86400).tm_mday)
+          bad ++;
+      }
+  check(bad, "days_in_month(), every month 1970-2099");
+
+  bad = 0;
+  const epoch_t kDays[] = {0, civil(2000, 2, 29), civil(2024, 12, 31), civil(2099, 12, 31)};
+  for (epoch_t day : kDays)
+    for (uint32_t s = 0; s < 86400; ++s)
+      {
+        CivilTime t;
+        from_epoch(day + s, &t);
+        if (t.hour != s / 3600 || t.minute != s / 60 % 60 || t.second != s % 60)
+          bad ++;
+        if (to_epoch(t) != day + s)
+          bad ++;
+      }
+  check(bad, "every second of four days, both ways");
+
+  bad = 0;
+  for (epoch_t secs = kEpochFirst; secs <= kEpochLast - 86400UL * 37; secs += 86400UL * 37 + 3671)
+    for (int n = -130; n <= 130; n += 7)
+      if (add_months(secs, n) != months_long_way(secs, n))
+        bad ++;
+  check(bad, "add_months() against months the long way, 2000-2099");
+
+  bad = 0;
+  for (byte f = k_edit_day; f <= k_edit_sec; ++f)
+    {
+      if (step_field(kEpochFirst, f, -1) != kEpochFirst)
+        bad ++;
+      if (step_field(kEpochLast, f, 1) != kEpochLast)
+        bad ++;
+      // Months and years keep the time of day
+      bool calendar = f == k_edit_month || f == k_edit_year;
+      if (step_field(kEpochFirst + 5, f, -100) != kEpochFirst + (calendar ? 5 : 0))
+        bad ++;
+      if (step_field(kEpochLast - 5, f, 100) != kEpochLast - (calendar ? 5 : 0))
+        bad ++;
+    }
+  if (step_field(civil(2024, 3, 31, 10), k_edit_month, -1) != civil(2024, 2, 29, 10))
+    bad ++;
+  if (step_field(civil(2024, 2, 29), k_edit_year, 1) != civil(2025, 2, 28))
+    bad ++;
+  if (step_field(civil(2024, 12, 31, 23, 59, 59), k_edit_sec, 1) != civil(2025, 1, 1))
+    bad ++;
+  check(bad, "step_field() held to 2000-01-01 .. 2099-12-31 23:59:59");
+
+  printf("%s\n", failures ? "FAILED" : "all ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Record, fetch and load input traces (src/Trace.h).
+
+    input_trace.py PORT [--baud 115200]
+    input_trace.py show FILE            print a trace
+
+With a port, commands are read from stdin (the port stays open: the
+Nano resets, losing its trace, each time it is opened):
+
+    record        start recording buttons and commands
+    stop          stop recording (or playing back)
+    fetch FILE    save the clock's trace
+    load FILE     send a trace to the clock
+    replay        play the clock's trace back on it
+
+A trace file is the start levels (4 bytes, bit per pin) and then the
+events as the clock keeps them. tools/trace_sim plays one through the
+button code on a PC.
+
+Needs pyserial.
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+from remote import Clock, frame
+
+TRACE, TRACE_LOAD = 0x87, 0x04
+STOP, RECORD, REPLAY, SEND = range(4)
+EVENT = struct.Struct("<HBB")
+HEADER = struct.Struct("<BBI")
+LOAD_PER_FRAME = 6
+
+
+def fetch(clock, timeout=2.0):
+    clock.batch([("trace", [SEND])])
+    events, count, levels = {}, None, 0xFFFFFFFF
+    start = time.monotonic()
+    while time.monotonic() - start < timeout:
+        for ftype, p in clock.reader.frames():
+            if ftype != TRACE:
+                continue
+            first, count, levels = HEADER.unpack_from(p)
+            for i in range((len(p) - HEADER.size) // EVENT.size):
+                events[first + i] = p[HEADER.size + i * EVENT.size:HEADER.size + (i + 1) * EVENT.size]
+        if count is not None and len(events) >= count:
+            break
+    if count is None:
+        raise TimeoutError("no trace")
+    return struct.pack("<I", levels) + b"".join(events[i] for i in range(count))
+
+
+def load(clock, data):
+    levels = struct.unpack_from("<I", data)[0]
+    events = [data[i:i + EVENT.size] for i in range(4, len(data), EVENT.size)]
+    for first in range(0, len(events), LOAD_PER_FRAME):
+        chunk = events[first:first + LOAD_PER_FRAME]
+        payload = HEADER.pack(first, len(events), levels) + b"".join(chunk)
+        clock.port.write(frame(TRACE_LOAD, payload))
+        # Let the clock take each frame from its 64 byte RX buffer
+        time.sleep(0.01)
+    clock.batch([])
+
+
+def show(data):
+    levels = struct.unpack_from("<I", data)[0]
+    print("start levels %08x" % levels)
+    t = 0
+    for i in range(4, len(data), EVENT.size):
+        dt, kind, value = EVENT.unpack_from(data, i)
+        t += dt
+        if kind == 0:
+            print("%8d ms  pin %d %s" % (t, value >> 1, "released" if value & 1 else "pressed"))
+        else:
+            print("%8d ms  command %r" % (t, chr(value)))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("port")
+    ap.add_argument("file", nargs="?")
+    ap.add_argument("--baud", type=int, default=115200)
+    a = ap.parse_args()
+
+    if a.port == "show":
+        if not a.file:
+            sys.exit(__doc__)
+        show(open(a.file, "rb").read())
+        return
+
+    clock = Clock(a.port, a.baud)
+    time.sleep(2)
+    ops = {"record": RECORD, "stop": STOP, "replay": REPLAY}
+    for text in sys.stdin:
+        words = text.split()
+        if not words:
+            continue
+        if words[0] in ops:
+            clock.batch([("trace", [ops[words[0]]])])
+        elif words[0] == "fetch" and len(words) > 1:
+            data = fetch(clock)
+            open(words[1], "wb").write(data)
+            print("%d events" % ((len(data) - 4) // EVENT.size))
+        elif words[0] == "load" and len(words) > 1:
+            load(clock, open(words[1], "rb").read())
+        else:
+            print("?", text.strip())
+
+
+if __name__ == "__main__":
+    main()
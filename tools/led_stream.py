@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+"""Drive the clock's digits from this PC (StreamView in src/Displays.h).
+
+    led_stream.py PORT [--baud 115200] [--fps 50] text "WORDS TO SCROLL" ...
+    led_stream.py PORT wipe
+    led_stream.py --dry-run text "..."      encode only, and report sizes
+
+Frames go as digit masks and palette indices, only for the digits that
+changed since the last frame, with runs of equal digits sent once. A
+full frame goes every --keyframe frames in case one was lost. At the
+end it reports the frames sent, the bytes per frame, and the frame rate
+the link could carry. Back on the clock leaves the stream.
+
+Needs pyserial for a live port.
+"""
+
+import argparse
+import os
+import re
+import struct
+import time
+
+from remote import frame
+
+PALETTE, DIGITS = 0x02, 0x03
+NUM_DIGITS = 6
+
+CLOCKFACE_H = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                           "..", "src", "ClockFace.h")
+
+
+def segment_table(path=CLOCKFACE_H):
+    """char -> 0abcdefg, from char_segment_table."""
+    table = {}
+    for ch, bits in re.findall(r"\{'(\\?.)',\s*0b([01]{8})\}", open(path).read()):
+        table[ch.replace("\\", "") or "\\"] = int(bits, 2)
+    return table
+
+
+SEGMENTS = segment_table()
+
+
+def glyph(ch):
+    return SEGMENTS.get(ch, SEGMENTS.get(ch.upper(), SEGMENTS.get(ch.lower(), 0)))
+
+
+class Digit:
+    """What one digit shows: segments or a pixel mask, colour, marks."""
+
+    def __init__(self, segments=0, colour=0, colon=False, decimal=False, pixels=None):
+        self.segments, self.colour = segments, colour
+        self.colon, self.decimal, self.pixels = colon, decimal, pixels
+
+    def key(self):
+        return (self.segments, self.colour, self.colon, self.decimal, self.pixels)
+
+    def record(self, repeat):
+        b0 = self.segments & 0x7F
+        b1 = (self.colour << 4) | (repeat << 2) | (self.colon << 1) | self.decimal
+        if self.pixels is None:
+            return bytes([b0, b1])
+        return bytes([0x80, b1]) + struct.pack("<I", self.pixels)[:3]
+
+
+def encode(digits, last):
+    """Payload for the digits that differ from last (None: all of them)."""
+    changed = [d for d in range(NUM_DIGITS)
+               if last is None or digits[d].key() != last[d].key()]
+    payload = bytes([sum(1 << d for d in changed)])
+    i = 0
+    while i < len(changed):
+        run = 1
+        while (run < 4 and i + run < len(changed)
+               and digits[changed[i + run]].key() == digits[changed[i]].key()):
+            run += 1
+        payload += digits[changed[i]].record(run - 1)
+        i += run
+    return payload
+
+
+def scroll(text, colour=1):
+    """Frames of text moving right to left across the digits."""
+    padded = " " * NUM_DIGITS + text + " " * NUM_DIGITS
+    for start in range(len(padded) - NUM_DIGITS + 1):
+        yield [Digit(glyph(c), colour) for c in padded[start:start + NUM_DIGITS]]
+
+
+def wipe(colour=2):
+    """A bar of light filling each digit pixel by pixel, then emptying."""
+    for n in list(range(22)) + list(range(20, -1, -1)):
+        yield [Digit(colour=colour, pixels=(1 << n) - 1) for _ in range(NUM_DIGITS)]
+
+
+class Link:
+    def __init__(self, path, baud, dry_run):
+        self.port = None
+        if not dry_run:
+            import serial
+            self.port = serial.Serial(path, baud, timeout=0)
+            time.sleep(2)  # the Nano resets when the port opens
+        self.bytes = 0
+
+    def send(self, ftype, payload):
+        data = frame(ftype, payload)
+        self.bytes += len(data)
+        if self.port:
+            self.port.write(data)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("port", nargs="?")
+    ap.add_argument("--baud", type=int, default=115200)
+    ap.add_argument("--fps", type=float, default=8)
+    ap.add_argument("--keyframe", type=int, default=25)
+    ap.add_argument("--dry-run", action="store_true")
+    ap.add_argument("show", nargs="*")
+    a = ap.parse_args()
+    if a.dry_run and a.port:
+        a.show.insert(0, a.port)
+    elif not a.port:
+        ap.error("need a port or --dry-run")
+    if not a.show:
+        ap.error("nothing to show")
+
+    link = Link(a.port, a.baud, a.dry_run)
+    # 0 off, 1 amber, 2 red, 3 white (dim: the LEDs are bright)
+    link.send(PALETTE, bytes([0, 0, 0, 0, 0x0F, 0x1F, 0, 0x30, 0, 0, 0x18, 0x18, 0x18]))
+    palette_bytes = link.bytes
+
+    words = a.show
+    if words[0] == "wipe":
+        frames = wipe()
+    elif words[0] == "text":
+        frames = scroll(" ".join(words[1:]))
+    else:
+        ap.error("unknown show " + words[0])
+
+    sent, last = 0, None
+    start = time.monotonic()
+    try:
+        for digits in frames:
+            key = last is None or sent % a.keyframe == 0
+            link.send(DIGITS, encode(digits, None if key else last))
+            last = digits
+            sent += 1
+            if not a.dry_run:
+                time.sleep(max(0, start + sent / a.fps - time.monotonic()))
+    except KeyboardInterrupt:
+        pass
+
+    if sent:
+        per_frame = (link.bytes - palette_bytes) / sent
+        print("%d frames, %.1f bytes/frame on the wire, the link carries %.0f frames/s at %d baud"
+              % (sent, per_frame, a.baud / 10 / per_frame, a.baud))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+"""Print the clock's log records (src/Log.h) as text.
+
+    logdecode.py PORT [--baud 115200]     read the clock's serial port
+    logdecode.py --file CAPTURE           decode a raw capture of it
+
+The message texts and levels are read from src/Log.h, so this stays in
+step with the firmware it sits next to. Other frames and text on the
+port are skipped. Needs pyserial for a live port.
+"""
+
+import argparse
+import io
+import os
+import re
+import struct
+import sys
+
+from remote import LOG, Reader
+
+RECORD = struct.Struct("<BLlh")
+LEVELS = ["DEBUG", "INFO", "WARN", "ERROR"]
+
+LOG_H = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "src", "Log.h")
+
+
+def messages(path=LOG_H):
+    """[(name, level, text)] in id order, from the LOG_MESSAGES table."""
+    table = re.findall(r'X\((k_log_\w+),\s*LOG_(\w+),\s*"((?:[^"\\]|\\.)*)"\)',
+                       open(path).read())
+    return [(name, level, text) for name, level, text in table]
+
+
+def decode(payload, table):
+    for i in range(0, len(payload) - RECORD.size + 1, RECORD.size):
+        mid, ms, a, b = RECORD.unpack_from(payload, i)
+        if mid < len(table):
+            name, level, text = table[mid]
+            yield ms, level, text.format(a=a, b=b)
+        else:
+            yield ms, "?", "unknown message %d (%d, %d)" % (mid, a, b)
+
+
+class File(io.FileIO):
+    """A capture file with the two bits of the pyserial interface Reader uses."""
+
+    in_waiting = 4096
+
+    def read(self, n):
+        data = super().read(n)
+        if not data:
+            raise EOFError
+        return data
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("port", nargs="?")
+    ap.add_argument("--baud", type=int, default=115200)
+    ap.add_argument("--file")
+    a = ap.parse_args()
+
+    if a.file:
+        port = File(a.file)
+    elif a.port:
+        import serial
+        port = serial.Serial(a.port, a.baud, timeout=0.1)
+    else:
+        ap.error("need a port or --file")
+
+    table = messages()
+    reader = Reader(port)
+    try:
+        while True:
+            for ftype, payload in reader.frames():
+                if ftype != LOG:
+                    continue
+                for ms, level, text in decode(payload, table):
+                    print("%10.3f %-5s %s" % (ms / 1000.0, level, text))
+                    sys.stdout.flush()
+    except (EOFError, KeyboardInterrupt):
+        pass
+
+
+if __name__ == "__main__":
+    main()
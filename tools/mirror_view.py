@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""Show the clock's OLED and digits in a terminal (src/Mirror.h).
+
+    mirror_view.py PORT [--baud 115200]
+
+Turns mirroring on, redraws whenever an update arrives, and shows the
+bytes per minute the mirror is using. ^C turns it off again. Needs
+pyserial and a terminal with 24 bit colour.
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+from remote import Clock
+
+OLED_UPDATE, DIGITS_UPDATE = 0x85, 0x86
+ROWS, COLS, NUM_DIGITS = 4, 20, 6
+SEGMENT_LENGTH = 3
+
+
+class Displays:
+    def __init__(self):
+        self.oled = [" "] * (ROWS * COLS)
+        # (flags, segments or pixels, (r, g, b))
+        self.digits = [(0, 0, (0, 0, 0))] * NUM_DIGITS
+
+    def oled_update(self, p):
+        i = 0
+        while i + 2 <= len(p):
+            cell, n = p[i], p[i + 1]
+            for k, ch in enumerate(p[i + 2:i + 2 + n]):
+                if cell + k < len(self.oled):
+                    self.oled[cell + k] = chr(ch) if 32 <= ch < 127 else "?"
+            i += 2 + n
+
+    def digits_update(self, p):
+        mask, i = p[0], 1
+        for d in range(NUM_DIGITS):
+            if not mask & (1 << d):
+                continue
+            flags = p[i]
+            if flags & 0x80:
+                shape = p[i + 1] | p[i + 2] << 8 | p[i + 3] << 16
+                i += 4
+            else:
+                shape = p[i + 1]
+                i += 2
+            self.digits[d] = (flags, shape, tuple(p[i:i + 3]))
+            i += 3
+
+    def lit(self, d, segment):
+        """Is segment (0 = a ... 6 = g) of digit d lit?"""
+        flags, shape, _ = self.digits[d]
+        if flags & 0x80:
+            return shape >> (segment * SEGMENT_LENGTH) & 0x07 != 0
+        return shape >> (6 - segment) & 1
+
+    def digit_rows(self):
+        rows = ["", "", ""]
+        for d in range(NUM_DIGITS):
+            flags, _, rgb = self.digits[d]
+            # The LEDs are run dim: scale up to see the colour
+            peak = max(rgb) or 1
+            on = "\x1b[38;2;%d;%d;%dm" % tuple(min(255, c * 255 // peak) for c in rgb)
+            off = "\x1b[38;2;40;40;40m"
+
+            def seg(s, ch):
+                return (on if self.lit(d, s) else off) + ch
+
+            rows[0] += " " + seg(0, "_") + " "
+            rows[1] += seg(5, "|") + seg(6, "_") + seg(1, "|")
+            rows[2] += seg(4, "|") + seg(3, "_") + seg(2, "|")
+            rows[1] += (on if flags & 0x02 else off) + ":"
+            rows[2] += (on if flags & 0x01 else off) + "."
+            rows[0] += " "
+        return [r + "\x1b[0m" for r in rows]
+
+    def draw(self, rate):
+        out = ["\x1b[H\x1b[2J", "+" + "-" * COLS + "+"]
+        for r in range(ROWS):
+            out.append("|" + "".join(self.oled[r * COLS:(r + 1) * COLS]) + "|")
+        out.append("+" + "-" * COLS + "+")
+        out.append("")
+        out.extend(self.digit_rows())
+        out.append("")
+        out.append("mirror: %.0f bytes/min" % rate)
+        sys.stdout.write("\n".join(out) + "\n")
+        sys.stdout.flush()
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("port")
+    ap.add_argument("--baud", type=int, default=115200)
+    a = ap.parse_args()
+
+    clock = Clock(a.port, a.baud)
+    time.sleep(2)  # the Nano resets when the port opens
+    clock.batch([("mirror", [1])])
+
+    shown = Displays()
+    start, received = time.monotonic(), 0
+    try:
+        while True:
+            for ftype, p in clock.reader.frames():
+                if ftype == OLED_UPDATE:
+                    shown.oled_update(p)
+                elif ftype == DIGITS_UPDATE:
+                    shown.digits_update(p)
+                else:
+                    continue
+                received += len(p) + 5
+                minutes = max(time.monotonic() - start, 1) / 60
+                shown.draw(received / minutes)
+    except KeyboardInterrupt:
+        clock.batch([("mirror", [0])])
+
+
+if __name__ == "__main__":
+    main()
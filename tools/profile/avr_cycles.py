@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+"""Cycle counts for the firmware's hot functions, from a simulated run.
+
+    avr_cycles.py run [--build] [--trace FILE] [--ms 5000] [-o OUT.json]
+    avr_cycles.py compare BEFORE.json AFTER.json
+
+run builds the profile firmware (pio run -e profile, with --build),
+picks the functions to time out of its symbols, and runs it in
+avr_profile (tools/profile/avr_profile.c, built from the line at the
+top of it) with the buttons and commands of an input trace. It prints
+a table and saves the results as JSON, with each function's cycles
+per loop added. compare shows two saved runs side by side.
+
+The profile firmware keeps the timed functions out of line (PROFILED
+in src/Profile.h) and is built without LTO so their symbols survive.
+Needs avr-nm (it comes with PlatformIO's toolchain-atmelavr).
+
+Not yet proven: avr_profile has not been built with simavr or run (see
+the top of avr_profile.c), so there is no table from it yet.
+"""
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(os.path.dirname(HERE))
+ELF = os.path.join(ROOT, ".pio", "build", "profile", "firmware.elf")
+SIM = os.path.join(HERE, "avr_profile")
+NM = os.path.expanduser("~/.platformio/packages/toolchain-atmelavr/bin/avr-nm")
+
+# Functions timed, as avr-nm -C names them
+TIMED = [
+    r"loop",
+    r"WindowManager::run\(\)",
+    r".*::draw\(OLED\*\)",
+    r"set_segment_display\(.*\)",
+    r"get_rep\(char\)",
+    r"sprintf",
+    r"OLED::write\(.*\)",
+    r"Compositor::present.*",
+    r"PixelBuffer<.*>::show\(\)",
+]
+
+
+def symbols(elf, patterns):
+    nm = NM if os.path.exists(NM) else "avr-nm"
+    out = subprocess.run([nm, "-C", "--defined-only", elf],
+                         check=True, capture_output=True, text=True).stdout
+    wanted = [re.compile(p + "$") for p in patterns]
+    found = {}
+    for line in out.splitlines():
+        parts = line.split(" ", 2)
+        if len(parts) < 3 or parts[1] not in "TtWw":
+            continue
+        addr, name = int(parts[0], 16), parts[2]
+        if any(w.match(name) for w in wanted):
+            found.setdefault(name, addr)
+    return found
+
+
+def per_loop(results):
+    loops = next((f["calls"] for f in results["functions"] if f["name"] == "loop"), 0)
+    results["loops"] = loops
+    for f in results["functions"]:
+        f["per_loop"] = round(f["total"] / loops, 1) if loops else None
+    return results
+
+
+def table(results):
+    mhz = results["mhz"]
+    awake = results["awake_cycles"]
+    total = awake + results["asleep_cycles"]
+    print(f"{results['ms']} ms simulated, {results['loops']} loops, "
+          f"awake {100.0 * awake / total if total else 0:.1f}%")
+    print(f"{'function':40} {'calls':>7} {'mean':>9} {'min':>9} {'max':>9} {'per loop':>9} {'max us':>8}")
+    for f in sorted(results["functions"], key=lambda f: -f["total"]):
+        print(f"{f['name'][:40]:40} {f['calls']:7} {f['mean']:9.0f} {f['min']:9} {f['max']:9} "
+              f"{f['per_loop'] or 0:9.0f} {f['max'] / mhz:8.0f}")
+
+
+def run(args):
+    if args.build:
+        subprocess.run(["pio", "run", "-e", "profile"], cwd=ROOT, check=True)
+    found = symbols(args.elf, TIMED + args.match)
+    if not found:
+        sys.exit(f"none of the functions are in {args.elf}")
+
+    with tempfile.NamedTemporaryFile("w", suffix=".sym", delete=False) as sym:
+        for name, addr in found.items():
+            sym.write(f"{addr:x} {name}\n")
+    with tempfile.NamedTemporaryFile(suffix=".json", delete=False) as out:
+        pass
+    try:
+        cmd = [args.sim, args.elf, sym.name, "-m", str(args.ms), "-o", out.name]
+        if args.trace:
+            cmd += ["-t", args.trace]
+        subprocess.run(cmd, check=True)
+        with open(out.name) as f:
+            results = per_loop(json.load(f))
+    finally:
+        os.unlink(sym.name)
+        os.unlink(out.name)
+
+    results["trace"] = args.trace
+    table(results)
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(results, f, indent=2)
+
+
+def compare(args):
+    with open(args.before) as f:
+        before = {fn["name"]: fn for fn in json.load(f)["functions"]}
+    with open(args.after) as f:
+        after = {fn["name"]: fn for fn in json.load(f)["functions"]}
+    print(f"{'function':40} {'mean':>9} {'':>9} {'change':>7}   {'per loop':>9} {'':>9} {'change':>7}")
+    for name in sorted(set(before) | set(after)):
+        a, b = before.get(name), after.get(name)
+        cols = []
+        for key in ("mean", "per_loop"):
+            x = a.get(key) if a else None
+            y = b.get(key) if b else None
+            change = f"{100.0 * (y - x) / x:+6.1f}%" if x and y is not None else ""
+            cols.append(f"{x if x is not None else '-':>9} {y if y is not None else '-':>9} {change:>7}")
+        print(f"{name[:40]:40} {cols[0]}   {cols[1]}")
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = ap.add_subparsers(dest="cmd", required=True)
+
+    r = sub.add_parser("run", help="profile the firmware")
+    r.add_argument("--build", action="store_true", help="build the profile firmware first")
+    r.add_argument("--elf", default=ELF)
+    r.add_argument("--sim", default=SIM, help="the avr_profile binary")
+    r.add_argument("--trace", help="input trace to play (tools/input_trace.py)")
+    r.add_argument("--ms", type=int, default=5000, help="simulated time")
+    r.add_argument("--match", action="append", default=[],
+                   help="time these functions too (regex on the demangled name)")
+    r.add_argument("-o", "--output", help="save the results as JSON")
+    r.set_defaults(func=run)
+
+    c = sub.add_parser("compare", help="compare two saved runs")
+    c.add_argument("before")
+    c.add_argument("after")
+    c.set_defaults(func=compare)
+
+    args = ap.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,484 @@
+/*
+ * Cycle counts for the firmware, run on simavr instead of a Nano.
+ *
+ *   cc -O2 -std=gnu99 -o avr_profile tools/profile/avr_profile.c -lsimavr -lelf
+ *   ./avr_profile FIRMWARE.elf SYMBOLS [-t TRACE] [-m MS] [-o OUT.json]
+ *
+ * Normally run by tools/profile/avr_cycles.py, which builds the profile
+ * firmware, makes the symbol list and reads the results.
+ *
+ * Not yet proven: this has only been checked against the declarations
+ * of the simavr calls it makes, not built with simavr or run, so there
+ * are no results from it yet. The first real run should be checked (a
+ * function's cycles against a count by hand from the listing) before
+ * any numbers from it are relied on.
+ *
+ * SYMBOLS lists the functions to time, a line each: the entry address
+ * in hex (a byte address, as avr-nm gives it) and the name. A function
+ * is entered when the PC reaches its entry, and left when the stack
+ * pointer rises above where it was then, so the cycles are inclusive:
+ * the functions it calls and any interrupts taken meanwhile count too.
+ * Time asleep (Power::idle) is not counted anywhere; it is reported on
+ * its own.
+ *
+ * The parts the firmware talks to are faked:
+ *
+ *  - I2C: every address is acknowledged, so the OLED's writes go
+ *    nowhere. The DS1307 (0xD0) answers reads with a clock running on
+ *    simulated time; writes to its time registers are ignored.
+ *  - The WS2812 pin is left unconnected; the bits go out as on the
+ *    real thing, cycles and all.
+ *  - Buttons and serial commands come from an input trace (-t, the
+ *    format tools/input_trace.py saves), played from the first loop().
+ *    Without one the buttons stay released.
+ *
+ * The results are JSON, on stdout or in -o: cycles per call of each
+ * function (calls, total, min, max, mean), and the simulated time
+ * awake and asleep.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_io.h>
+#include <simavr/avr_ioport.h>
+#include <simavr/avr_twi.h>
+#include <simavr/avr_uart.h>
+
+#define MHZ 16
+#define FLASH_WORDS (32768 / 2)
+#define MAX_FUNCS 256
+#define MAX_DEPTH 64
+#define DS1307_ADDR 0xD0
+
+/* --- the functions timed --- */
+
+struct func
+{
+  char name[128];
+  uint32_t addr;
+  uint64_t calls, total, min, max;
+};
+
+static struct func funcs[MAX_FUNCS];
+static int num_funcs;
+
+/* Function (index + 1) starting at each flash word, 0 for none */
+static uint16_t entry[FLASH_WORDS];
+
+struct frame
+{
+  int func;
+  uint16_t sp;
+  uint64_t start;
+};
+
+static struct frame stack[MAX_DEPTH];
+static int depth;
+
+/* Cycles spent awake: the clock functions are timed by */
+static uint64_t awake;
+static uint64_t asleep;
+
+static void
+read_symbols (const char * path)
+{
+  FILE * f = fopen(path, "r");
+  char line[256];
+  if (!f)
+    {
+      perror(path);
+      exit(1);
+    }
+  while (fgets(line, sizeof(line), f) && num_funcs < MAX_FUNCS)
+    {
+      unsigned long addr;
+      int n;
+      if (sscanf(line, "%lx %n", &addr, &n) != 1 || addr / 2 >= FLASH_WORDS)
+        continue;
+      struct func * fn = &funcs[num_funcs];
+      strncpy(fn->name, line + n, sizeof(fn->name) - 1);
+      fn->name[strcspn(fn->name, "\r\n")] = 0;
+      fn->addr = addr;
+      fn->min = UINT64_MAX;
+      entry[addr / 2] = ++num_funcs;
+    }
+  fclose(f);
+}
+
+static uint16_t
+stack_pointer (avr_t * avr)
+{
+  return avr->data[R_SPL] | avr->data[R_SPH] << 8;
+}
+
+static void
+leave (int f, uint64_t cycles)
+{
+  struct func * fn = &funcs[f];
+  fn->calls ++;
+  fn->total += cycles;
+  if (cycles < fn->min)
+    fn->min = cycles;
+  if (cycles > fn->max)
+    fn->max = cycles;
+}
+
+/* After each instruction: calls into and returns from timed functions */
+static void
+track (avr_t * avr)
+{
+  uint16_t sp = stack_pointer(avr);
+  while (depth && sp > stack[depth - 1].sp)
+    {
+      depth --;
+      leave(stack[depth].func, awake - stack[depth].start);
+    }
+
+  int f = entry[(avr->pc / 2) % FLASH_WORDS];
+  if (!f--)
+    return;
+  /* Back at the entry of the function just entered (a loop to the top
+     of it, or the return from an interrupt taken on the way in) */
+  if (depth && stack[depth - 1].func == f && stack[depth - 1].sp == sp)
+    return;
+  if (depth == MAX_DEPTH)
+    {
+      fprintf(stderr, "call stack too deep at %s\n", funcs[f].name);
+      exit(1);
+    }
+  stack[depth].func = f;
+  stack[depth].sp = sp;
+  stack[depth].start = awake;
+  depth ++;
+}
+
+/* --- DS1307 and everything else on I2C --- */
+
+struct i2c
+{
+  avr_irq_t * irq;
+  avr_t * avr;
+  uint8_t selected;
+  uint8_t reg;
+  int first;          /* next byte written is the register address */
+  uint8_t ram[64];
+  time_t start;
+};
+
+static uint8_t
+bcd (int v)
+{
+  return (v / 10) << 4 | v % 10;
+}
+
+static uint8_t
+ds1307_read (struct i2c * p, uint8_t reg)
+{
+  time_t t = p->start + p->avr->cycle / (MHZ * 1000000ULL);
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  switch (reg)
+    {
+    case 0: return bcd(tm.tm_sec);    /* CH clear: running */
+    case 1: return bcd(tm.tm_min);
+    case 2: return bcd(tm.tm_hour);   /* 24 hour */
+    case 3: return tm.tm_wday + 1;
+    case 4: return bcd(tm.tm_mday);
+    case 5: return bcd(tm.tm_mon + 1);
+    case 6: return bcd(tm.tm_year % 100);
+    default: return p->ram[reg];
+    }
+}
+
+static void
+i2c_hook (struct avr_irq_t * irq, uint32_t value, void * param)
+{
+  struct i2c * p = param;
+  avr_twi_msg_irq_t v;
+  v.u.v = value;
+
+  if (v.u.twi.msg & TWI_COND_STOP)
+    p->selected = 0;
+
+  if (v.u.twi.msg & TWI_COND_START)
+    {
+      /* Anyone there? Everyone is. */
+      p->selected = v.u.twi.addr;
+      p->first = 1;
+      avr_raise_irq(p->irq + TWI_IRQ_INPUT,
+                    avr_twi_irq_msg(TWI_COND_ACK, p->selected, 1));
+    }
+
+  if (!p->selected)
+    return;
+
+  if (v.u.twi.msg & TWI_COND_WRITE)
+    {
+      avr_raise_irq(p->irq + TWI_IRQ_INPUT,
+                    avr_twi_irq_msg(TWI_COND_ACK, p->selected, 1));
+      if ((p->selected & 0xFE) == DS1307_ADDR)
+        {
+          if (p->first)
+            p->reg = v.u.twi.data & 63;
+          else
+            p->ram[p->reg++ & 63] = v.u.twi.data;
+          p->first = 0;
+        }
+    }
+
+  if (v.u.twi.msg & TWI_COND_READ)
+    {
+      uint8_t data = 0xFF;
+      if ((p->selected & 0xFE) == DS1307_ADDR)
+        data = ds1307_read(p, p->reg++ & 63);
+      avr_raise_irq(p->irq + TWI_IRQ_INPUT,
+                    avr_twi_irq_msg(TWI_COND_READ, p->selected, data));
+    }
+}
+
+static const char * i2c_irq_names[2] = {
+  [TWI_IRQ_INPUT] = "8>i2c.out",
+  [TWI_IRQ_OUTPUT] = "32<i2c.in",
+};
+
+static void
+i2c_attach (avr_t * avr, struct i2c * p)
+{
+  memset(p, 0, sizeof(*p));
+  p->avr = avr;
+  p->start = 1704099600;       /* 2024-01-01 09:00:00 */
+  p->irq = avr_alloc_irq(&avr->irq_pool, 0, 2, i2c_irq_names);
+  avr_irq_register_notify(p->irq + TWI_IRQ_OUTPUT, i2c_hook, p);
+  avr_connect_irq(p->irq + TWI_IRQ_INPUT,
+                  avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_INPUT));
+  avr_connect_irq(avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_OUTPUT),
+                  p->irq + TWI_IRQ_OUTPUT);
+}
+
+/* --- input trace (src/Trace.h) --- */
+
+struct event
+{
+  uint16_t dt;
+  uint8_t kind;
+  uint8_t value;
+} __attribute__((packed));
+
+static struct event * events;
+static int num_events;
+static int next_event;
+static uint32_t start_levels = 0xFFFFFFFF;
+static uint64_t next_at;     /* cycle of the next event, 0 till loop() */
+
+static void
+read_trace (const char * path)
+{
+  FILE * f = fopen(path, "rb");
+  if (!f)
+    {
+      perror(path);
+      exit(1);
+    }
+  if (fread(&start_levels, 4, 1, f) != 1)
+    {
+      fprintf(stderr, "%s: no trace\n", path);
+      exit(1);
+    }
+  struct event e;
+  while (fread(&e, sizeof(e), 1, f) == 1)
+    {
+      events = realloc(events, (num_events + 1) * sizeof(e));
+      events[num_events++] = e;
+    }
+  fclose(f);
+}
+
+/* A bit of BTN_PORTS(): D0-D7, then D8-D13 on port B */
+static void
+set_pin (avr_t * avr, int pin, int level)
+{
+  char port = pin < 8 ? 'D' : 'B';
+  avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(port), pin & 7), level);
+}
+
+static void
+play_trace (avr_t * avr)
+{
+  while (next_event < num_events && avr->cycle >= next_at)
+    {
+      const struct event * e = &events[next_event++];
+      if (e->kind == 0)
+        set_pin(avr, e->value >> 1, e->value & 1);
+      else
+        avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT),
+                      e->value);
+      if (next_event < num_events)
+        next_at += (uint64_t)events[next_event].dt * MHZ * 1000;
+    }
+}
+
+/* --- results --- */
+
+static void
+json_string (FILE * out, const char * s)
+{
+  fputc('"', out);
+  for (; *s; ++s)
+    {
+      if (*s == '"' || *s == '\\')
+        fputc('\\', out);
+      fputc(*s, out);
+    }
+  fputc('"', out);
+}
+
+static void
+report (FILE * out, const char * firmware, uint64_t ms)
+{
+  fprintf(out, "{\n  \"firmware\": ");
+  json_string(out, firmware);
+  fprintf(out, ",\n  \"mhz\": %d,\n  \"ms\": %llu,\n", MHZ, (unsigned long long)ms);
+  fprintf(out, "  \"awake_cycles\": %llu,\n  \"asleep_cycles\": %llu,\n",
+          (unsigned long long)awake, (unsigned long long)asleep);
+  fprintf(out, "  \"functions\": [");
+  int first = 1;
+  for (int i = 0; i < num_funcs; ++i)
+    {
+      struct func * fn = &funcs[i];
+      if (!fn->calls)
+        continue;
+      fprintf(out, "%s\n    {\"name\": ", first ? "" : ",");
+      json_string(out, fn->name);
+      fprintf(out, ", \"calls\": %llu, \"total\": %llu, \"min\": %llu, \"max\": %llu, \"mean\": %.1f}",
+              (unsigned long long)fn->calls, (unsigned long long)fn->total,
+              (unsigned long long)fn->min, (unsigned long long)fn->max,
+              (double)fn->total / fn->calls);
+      first = 0;
+    }
+  fprintf(out, "\n  ]\n}\n");
+}
+
+static void
+usage (const char * name)
+{
+  fprintf(stderr, "usage: %s FIRMWARE.elf SYMBOLS [-t TRACE] [-m MS] [-o OUT.json]\n", name);
+  exit(2);
+}
+
+int
+main (int argc, char ** argv)
+{
+  const char * trace = NULL;
+  const char * out_path = NULL;
+  uint64_t ms = 5000;
+  const char * pos[2];
+  int npos = 0;
+
+  for (int i = 1; i < argc; ++i)
+    {
+      if (!strcmp(argv[i], "-t") && i + 1 < argc)
+        trace = argv[++i];
+      else if (!strcmp(argv[i], "-m") && i + 1 < argc)
+        ms = strtoull(argv[++i], NULL, 0);
+      else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+        out_path = argv[++i];
+      else if (argv[i][0] != '-' && npos < 2)
+        pos[npos++] = argv[i];
+      else
+        usage(argv[0]);
+    }
+  if (npos != 2)
+    usage(argv[0]);
+
+  elf_firmware_t fw;
+  memset(&fw, 0, sizeof(fw));
+  if (elf_read_firmware(pos[0], &fw))
+    {
+      fprintf(stderr, "%s: can't load\n", pos[0]);
+      return 1;
+    }
+  read_symbols(pos[1]);
+  if (trace)
+    read_trace(trace);
+
+  avr_t * avr = avr_make_mcu_by_name("atmega328p");
+  if (!avr)
+    {
+      fprintf(stderr, "no atmega328p in this simavr\n");
+      return 1;
+    }
+  avr_init(avr);
+  fw.frequency = MHZ * 1000000;
+  avr->log = LOG_ERROR;
+  avr_load_firmware(avr, &fw);
+
+  /* Serial goes nowhere, and the sim never waits on it */
+  uint32_t flags = 0;
+  avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+  flags &= ~(AVR_UART_FLAG_STDIO | AVR_UART_FLAG_POLL_SLEEP);
+  avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+
+  struct i2c bus;
+  i2c_attach(avr, &bus);
+
+  for (int pin = 0; pin < 16; ++pin)
+    if (pin != 0 && pin != 1 && pin < 14)    /* not RX and TX */
+      set_pin(avr, pin, (start_levels >> pin) & 1);
+
+  /* loop(), if it is in the list, starts the trace */
+  int loop_func = -1;
+  for (int i = 0; i < num_funcs; ++i)
+    if (!strcmp(funcs[i].name, "loop"))
+      loop_func = i;
+
+  uint64_t end = ms * MHZ * 1000;
+  while (avr->cycle < end)
+    {
+      int was = avr->state;
+      uint64_t before = avr->cycle;
+      int state = avr_run(avr);
+      uint64_t spent = avr->cycle - before;
+      if (state == cpu_Done || state == cpu_Crashed)
+        {
+          fprintf(stderr, "firmware stopped (%s) at %04x\n",
+                  state == cpu_Done ? "done" : "crashed", avr->pc);
+          break;
+        }
+
+      if (was == cpu_Running && state == cpu_Running)
+        awake += spent;
+      else if (was == cpu_Running)
+        {
+          /* the sleep instruction, then asleep */
+          awake += 1;
+          asleep += spent - 1;
+        }
+      else
+        asleep += spent;
+
+      track(avr);
+
+      /* As on the clock, the first event plays at once */
+      if (!next_at && (loop_func < 0 || (depth && stack[0].func == loop_func)))
+        next_at = avr->cycle;
+      if (next_at)
+        play_trace(avr);
+    }
+
+  FILE * out = stdout;
+  if (out_path && !(out = fopen(out_path, "w")))
+    {
+      perror(out_path);
+      return 1;
+    }
+  report(out, pos[0], avr->cycle / (MHZ * 1000));
+  if (out != stdout)
+    fclose(out);
+  return 0;
+}
@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+"""Remote control for the clock over its binary protocol (src/Remote.h).
+
+    remote.py PORT [--baud 115200] COMMAND ...
+
+Commands run in one batch (one frame, one ack):
+
+    set ID SECS      start ID      pause ID      reset ID   (SECS to 359999)
+    window N         thresholds WARN_MIN ALARM_MIN
+    key up|down|enter|back   mirror 0|1
+    setting ID VALUE         (ids in src/Settings.h order; colours 0xRGB)
+
+and on their own:
+
+    watch [PERIOD_MS [ID]]   print telemetry until ^C
+    ping [COUNT]             round trip of empty batches
+
+Needs pyserial.
+"""
+
+import argparse
+import binascii
+import struct
+import sys
+import time
+
+SYNC = 0xA5
+MAX_SECS = 99 * 3600 + 59 * 60 + 59     # kMaxTimerSecs
+COMMANDS, ACK, TELEMETRY, EVENT, LOG = 0x01, 0x81, 0x82, 0x83, 0x84
+CUE = 0x89
+
+OPS = {
+    "set": (1, "<BI"),
+    "start": (2, "<B"),
+    "pause": (3, "<B"),
+    "reset": (4, "<B"),
+    "window": (5, "<B"),
+    "thresholds": (6, "<BB"),
+    "key": (7, "<B"),
+    "telemetry": (8, "<HB"),
+    "mirror": (9, "<B"),
+    "trace": (10, "<B"),
+    "schedule": (11, "<"),
+    "setting": (12, "<Bh"),
+}
+KEYS = ["up", "down", "enter", "back"]
+STATES = ["stopped", "running", "over"]
+KINDS = ["countdown", "stopwatch"]
+
+
+def frame(ftype, payload):
+    body = bytes([len(payload), ftype]) + payload
+    return bytes([SYNC]) + body + struct.pack("<H", binascii.crc_hqx(body, 0))
+
+
+class Reader:
+    """Pulls frames out of the byte stream, skipping text and junk."""
+
+    def __init__(self, port):
+        self.port = port
+        self.buf = b""
+
+    def frames(self):
+        self.buf += self.port.read(self.port.in_waiting or 1)
+        while True:
+            start = self.buf.find(bytes([SYNC]))
+            if start < 0 or len(self.buf) - start < 5:
+                self.buf = self.buf[max(start, 0):] if start >= 0 else b""
+                return
+            n = self.buf[start + 1]
+            end = start + 5 + n
+            if len(self.buf) < end:
+                self.buf = self.buf[start:]
+                return
+            body = self.buf[start + 1:end - 2]
+            crc = struct.unpack("<H", self.buf[end - 2:end])[0]
+            if binascii.crc_hqx(body, 0) == crc:
+                self.buf = self.buf[end:]
+                yield body[1], body[2:]
+            else:
+                self.buf = self.buf[start + 1:]
+
+
+class Clock:
+    def __init__(self, path, baud):
+        import serial
+        self.port = serial.Serial(path, baud, timeout=0.05)
+        self.reader = Reader(self.port)
+        self.seq = 0
+
+    def batch(self, commands, timeout=1.0):
+        """Send (op, args) pairs in one frame. Returns (ran, clock us, rtt s)."""
+        self.seq = (self.seq + 1) & 0xFF
+        payload = bytes([self.seq])
+        for name, args in commands:
+            op, fmt = OPS[name]
+            payload += bytes([op]) + struct.pack(fmt, *args)
+        sent = time.monotonic()
+        self.port.write(frame(COMMANDS, payload))
+        while time.monotonic() - sent < timeout:
+            for ftype, p in self.reader.frames():
+                if ftype == ACK and p[0] == self.seq:
+                    ran, us = p[1], struct.unpack("<H", p[2:4])[0]
+                    return ran, us, time.monotonic() - sent
+                show(ftype, p)
+        raise TimeoutError("no ack")
+
+
+def show(ftype, p):
+    if ftype == TELEMETRY:
+        tid, ks, ms, fps, worst, ma, bad, dropped, log_dropped, log_us, duty = \
+            struct.unpack("<BBlBHHBBBHH", p)
+        print("timer %d %s %s %8.1f s | %2d fps worst %5d us %4d mA | bad %d dropped %d"
+              " | log dropped %d send %d us | cpu %.1f%%"
+              % (tid, KINDS[ks >> 4], STATES[ks & 0x0F], ms / 1000.0, fps, worst, ma,
+                 bad, dropped, log_dropped, log_us, duty / 10.0))
+    elif ftype == EVENT:
+        print("key", KEYS[p[0]])
+    elif ftype == CUE:
+        timer, code, secs = struct.unpack("<BBh", p)
+        print("cue %d on timer %d at %d s" % (code, timer, secs))
+
+
+def parse(words):
+    commands = []
+    while words:
+        name = words.pop(0)
+        if name not in OPS:
+            sys.exit("unknown command " + name)
+        nargs = len(OPS[name][1]) - 1
+        args = [KEYS.index(w) if w in KEYS else int(w, 0) for w in words[:nargs]]
+        del words[:nargs]
+        if name == "set" and len(args) == 2 and not 0 <= args[1] <= MAX_SECS:
+            sys.exit("set: %d s is more than the clock's 99:59:59" % args[1])
+        commands.append((name, args))
+    return commands
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("port")
+    ap.add_argument("--baud", type=int, default=115200)
+    ap.add_argument("command", nargs="+")
+    a = ap.parse_args()
+
+    clock = Clock(a.port, a.baud)
+    time.sleep(2)  # the Nano resets when the port opens
+
+    words = a.command
+    if words[0] == "watch":
+        period = int(words[1]) if len(words) > 1 else 200
+        tid = int(words[2]) if len(words) > 2 else 0
+        clock.batch([("telemetry", [period, tid])])
+        try:
+            while True:
+                for ftype, p in clock.reader.frames():
+                    show(ftype, p)
+        except KeyboardInterrupt:
+            clock.batch([("telemetry", [0, 0])])
+    elif words[0] == "ping":
+        count = int(words[1]) if len(words) > 1 else 20
+        rtts = sorted(clock.batch([])[2] * 1000 for _ in range(count))
+        print("rtt ms: min %.2f median %.2f max %.2f"
+              % (rtts[0], rtts[len(rtts) // 2], rtts[-1]))
+    else:
+        ran, us, rtt = clock.batch(parse(words))
+        print("%d commands, %d us on the clock, %.2f ms round trip" % (ran, us, rtt * 1000))
+
+
+if __name__ == "__main__":
+    main()
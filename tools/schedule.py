@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""Load a day's talks into the clock's schedule (src/Schedule.h).
+
+    schedule.py FILE PORT [--baud 115200]
+    schedule.py FILE --dry-run          print the slots as they'd be sent
+    schedule.py --status PORT           slots, CRC and slot running
+
+FILE has a slot a line, '#' starting a comment:
+
+    09:00  25  Keynote
+    09:30  25  Talk 2
+
+start (24 hour), length in minutes (up to 255), and a label of up to
+8 characters. Slots may come in any order, but mustn't overlap.
+
+The clock writes each frame to EEPROM as it goes, so frames are spaced
+out; at the end the CRC the clock has is checked against the file's,
+and the load is sent again if they differ.
+
+Needs pyserial.
+"""
+
+import argparse
+import binascii
+import struct
+import sys
+import time
+
+from remote import Clock, frame
+
+SCHEDULE_LOAD, SCHEDULE = 0x05, 0x88
+SLOT = struct.Struct("<HB8s")
+PER_FRAME = 2
+MAX_SLOTS = (1024 - 64 - 1) // SLOT.size
+# About 3.4 ms an EEPROM byte, with room to spare
+FRAME_GAP = 0.15
+
+
+def parse(path):
+    slots = []
+    for n, line in enumerate(open(path), 1):
+        line = line.split("#")[0].strip()
+        if not line:
+            continue
+        words = line.split(None, 2)
+        try:
+            hh, mm = words[0].split(":")
+            start, length = int(hh) * 60 + int(mm), int(words[1])
+            label = words[2] if len(words) > 2 else ""
+        except (ValueError, IndexError):
+            sys.exit("%s:%d: expected HH:MM MINUTES LABEL" % (path, n))
+        if not 0 <= start < 24 * 60 or not 0 < length < 256:
+            sys.exit("%s:%d: time out of range" % (path, n))
+        if len(label) > 8:
+            print("%s:%d: label cut to %r" % (path, n, label[:8]), file=sys.stderr)
+        slots.append((start, length, label[:8]))
+    slots.sort()
+    for a, b in zip(slots, slots[1:]):
+        if a[0] + a[1] > b[0]:
+            sys.exit("%s overlaps %s" % (a[2], b[2]))
+    if len(slots) > MAX_SLOTS:
+        sys.exit("%d slots, room for %d" % (len(slots), MAX_SLOTS))
+    return slots
+
+
+def pack(slots):
+    return b"".join(SLOT.pack(s, l, label.encode("ascii")) for s, l, label in slots)
+
+
+def status(clock, timeout=1.0):
+    clock.batch([("schedule", [])])
+    start = time.monotonic()
+    while time.monotonic() - start < timeout:
+        for ftype, p in clock.reader.frames():
+            if ftype == SCHEDULE:
+                return struct.unpack("<BBHB", p)
+    raise TimeoutError("no schedule status")
+
+
+def load(clock, data, count):
+    for first in range(0, max(count, 1), PER_FRAME):
+        chunk = data[first * SLOT.size:(first + PER_FRAME) * SLOT.size]
+        clock.port.write(frame(SCHEDULE_LOAD, bytes([first, count]) + chunk))
+        time.sleep(FRAME_GAP)
+    # Until the last bytes are written
+    while status(clock)[1]:
+        time.sleep(FRAME_GAP)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("file", nargs="?")
+    ap.add_argument("port", nargs="?")
+    ap.add_argument("--baud", type=int, default=115200)
+    ap.add_argument("--dry-run", action="store_true")
+    ap.add_argument("--status", metavar="PORT")
+    ap.add_argument("--tries", type=int, default=3)
+    a = ap.parse_args()
+
+    if a.status:
+        clock = Clock(a.status, a.baud)
+        time.sleep(2)
+        count, busy, crc, current = status(clock)
+        print("%d slots, crc %04x%s, %s" % (count, crc, " (loading)" if busy else "",
+              "between talks" if current == 0xFF else "slot %d running" % current))
+        return
+    if not a.file or not (a.port or a.dry_run):
+        sys.exit(__doc__)
+
+    slots = parse(a.file)
+    data = pack(slots)
+    crc = binascii.crc_hqx(data, 0)
+    if a.dry_run:
+        for i, (s, l, label) in enumerate(slots):
+            print("%2d  %02d:%02d-%02d:%02d  %s" % (i, s // 60, s % 60,
+                                                   (s + l) // 60 % 24, (s + l) % 60, label))
+        print("%d slots, %d bytes, crc %04x" % (len(slots), len(data) + 1, crc))
+        return
+
+    clock = Clock(a.port, a.baud)
+    time.sleep(2)
+    for attempt in range(a.tries):
+        load(clock, data, len(slots))
+        count, _, got, _ = status(clock)
+        if count == len(slots) and got == crc:
+            print("%d slots loaded, crc %04x" % (count, crc))
+            return
+        print("crc %04x, expected %04x: sending again" % (got, crc), file=sys.stderr)
+    sys.exit("load failed")
+
+
+if __name__ == "__main__":
+    main()
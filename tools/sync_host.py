@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+"""Master for a set of clocks on a USB hub (protocol in src/Sync.h).
+
+    sync_host.py /dev/ttyUSB0 /dev/ttyUSB1 ...
+
+Makes every clock a slave, answers their time queries from this PC's
+monotonic clock, and keeps their timers in step. Commands on stdin:
+
+    start ID [SECS]   start countdown ID (setting it to SECS first)
+    pause ID          pause it
+    reset ID SECS     stop it and set it to SECS
+    rtc               set every clock's RTC from this PC's clock
+    stats             ask each clock for its residual offsets
+    quit              hand the ports back (@O) and exit
+
+Needs pyserial.
+"""
+
+import sys
+import threading
+import time
+
+import serial
+
+BAUD = 9600
+
+# TimerWheel flags
+STOPPED, RUNNING, OVER = 0, 1, 2
+
+_epoch = time.monotonic()
+
+
+def stamp():
+    """This PC's time base as ms.uuu, wrapping like the clocks' do."""
+    us = int((time.monotonic() - _epoch) * 1e6)
+    return "%d.%03d" % ((us // 1000) & 0xFFFFFFFF, us % 1000)
+
+
+def now_ms():
+    return int((time.monotonic() - _epoch) * 1000) & 0xFFFFFFFF
+
+
+class Clock:
+    def __init__(self, path):
+        self.path = path
+        self.port = serial.Serial(path, BAUD, timeout=0.1)
+        self.lock = threading.Lock()
+        self.line = b""
+
+    def send(self, text):
+        with self.lock:
+            self.port.write(text.encode("ascii"))
+
+    def serve(self):
+        """Answer queries as soon as the line is in."""
+        while True:
+            c = self.port.read(1)
+            if not c:
+                continue
+            if c != b"\n":
+                self.line += c
+                continue
+            arrived = stamp()
+            line, self.line = self.line.decode("ascii", "replace").strip(), b""
+            if line.startswith("@Q"):
+                t1 = line[2:].strip()
+                # t3 last, so formatting time is inside t3 - t2
+                self.send("@R %s %s %s\n" % (t1, arrived, stamp()))
+            elif line.startswith("@s"):
+                f = line.split()[1:]
+                print("%s: %s samples, mean %s mean abs %s max %s us, rtt %s us, %s ppm, %s rejected"
+                      % (self.path, *f))
+
+
+class Timers:
+    """The master copy of the timers, on this PC's time base."""
+
+    def __init__(self):
+        self.timers = {}
+
+    def get(self, i):
+        return self.timers.setdefault(i, [STOPPED, 12 * 60, 12 * 60 * 1000])
+
+    def line(self, i):
+        flags, start, value = self.get(i)
+        return "@T %d %d %d %d\n" % (i, flags, start, value)
+
+    def start(self, i, secs=None):
+        if secs is not None:
+            self.reset(i, secs)
+        t = self.get(i)
+        if t[0] == STOPPED:
+            left = t[2]
+            t[2] = (now_ms() + left) & 0xFFFFFFFF
+            t[0] = RUNNING if left > 0 else OVER
+
+    def pause(self, i):
+        t = self.get(i)
+        if t[0] != STOPPED:
+            left = (t[2] - now_ms()) & 0xFFFFFFFF
+            t[2] = left - (1 << 32) if left >= 1 << 31 else left
+            t[0] = STOPPED
+
+    def reset(self, i, secs):
+        self.timers[i] = [STOPPED, secs, secs * 1000]
+
+
+def main(paths):
+    clocks = [Clock(p) for p in paths]
+    for c in clocks:
+        c.send("@S\n")
+        threading.Thread(target=c.serve, daemon=True).start()
+
+    timers = Timers()
+
+    def refresh():
+        # Resend everything now and then, for clocks plugged in late
+        while True:
+            for i in list(timers.timers):
+                for c in clocks:
+                    c.send(timers.line(i))
+            time.sleep(2)
+
+    threading.Thread(target=refresh, daemon=True).start()
+
+    for text in sys.stdin:
+        words = text.split()
+        if not words:
+            continue
+        cmd, args = words[0], [int(w) for w in words[1:]]
+        if cmd == "quit":
+            break
+        if cmd == "rtc":
+            # Wall clock at the moment of sending; the clocks add the
+            # time the line takes to arrive
+            for c in clocks:
+                t = time.time()
+                c.send("@W %d %d\n" % (int(t), int(t * 1000) % 1000))
+        elif cmd == "stats":
+            for c in clocks:
+                c.send("@?\n")
+        elif cmd in ("start", "pause", "reset"):
+            getattr(timers, cmd)(*args)
+            for c in clocks:
+                c.send(timers.line(args[0]))
+        else:
+            print("?", cmd)
+
+    for c in clocks:
+        c.send("@O\n")
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        print(__doc__)
+        sys.exit(1)
+    main(sys.argv[1:])
@@ -0,0 +1,29 @@
+#pragma once
+
+// Just enough of the Arduino core to build the sync code on a PC (see
+// sync_sim.cpp). micros() and millis() are a simulated clock.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t byte;
+
+unsigned long micros ();
+unsigned long millis ();
+
+#define constrain(a, l, h) ((a) < (l) ? (l) : ((a) > (h) ? (h) : (a)))
+
+class Print
+{
+public:
+  virtual size_t write (const uint8_t * buf, size_t len) = 0;
+
+  size_t print (const char * s)
+  {
+    return write((const uint8_t *)s, strlen(s));
+  }
+};
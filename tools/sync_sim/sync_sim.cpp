@@ -0,0 +1,223 @@
+/*
+ * Two simulated clocks running the sync code (src/Sync.h) over a pipe.
+ *
+ *   g++ -O2 -std=gnu++11 -Itools/sync_sim -Isrc tools/sync_sim/sync_sim.cpp -o sync_sim
+ *   ./sync_sim [seconds] [slave ppm] [slave offset ms]
+ *
+ * Each clock is a process with its own micros(): the slave's runs fast
+ * or slow by the given ppm and starts at an offset. The parent is the
+ * wire, passing bytes between them no faster than SERIAL_BAUD allows.
+ * Each loop of a clock takes a random few ms, as the OLED does on the
+ * real thing.
+ *
+ * The master starts a countdown a few seconds in, so the slave's copy
+ * can be checked. The slave knows the master's clock exactly (it's the
+ * host's clock), so it reports the true residual offset as well as
+ * what Sync measured.
+ */
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "TimeBase.h"
+#include "Timers.h"
+#include "Sync.h"
+
+// This clock
+static double sim_ppm = 0;
+static double sim_offset_us = 0;
+static uint64_t sim_start_ns = 0;
+
+static uint64_t real_ns ()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Microseconds since the simulation started, on the host's clock
+static double real_us ()
+{
+  return (real_ns() - sim_start_ns) / 1000.0;
+}
+
+unsigned long micros ()
+{
+  return (unsigned long)(uint32_t)(int64_t)(real_us() * (1 + sim_ppm * 1e-6) + sim_offset_us);
+}
+
+unsigned long millis ()
+{
+  return micros() / 1000;
+}
+
+// The port, on one end of a socket
+class Port: public Print
+{
+public:
+  explicit Port (int fd): mFd(fd) {}
+
+  virtual size_t write (const uint8_t * buf, size_t len)
+  {
+    return ::write(mFd, buf, len);
+  }
+
+  int read ()
+  {
+    unsigned char c;
+    return ::recv(mFd, &c, 1, MSG_DONTWAIT) == 1 ? c : -1;
+  }
+
+private:
+  int mFd;
+};
+
+TimeBase timebase;
+Log logger;
+static TimerBank bank;
+static Port * port;
+Sync timesync (nullptr, &bank);
+
+static void run_clock (int fd, bool master, double seconds)
+{
+  port = new Port(fd);
+  timesync = Sync(port, &bank);
+  timesync.set_role(master ? Sync::k_master : Sync::k_slave);
+
+  for (unsigned char i = 0; i < 4; ++i)
+    bank.add(TimerBank::k_countdown, 12 * 60);
+
+  srand(master ? 1 : 2);
+  const double kWarmUp = 30e6;
+  bool started = false;
+  unsigned long next_report = 0;
+
+  // True residual, after the warm up
+  unsigned int n = 0;
+  double sum = 0, sq = 0, worst = 0;
+
+  while (real_us() < seconds * 1e6)
+    {
+      timebase.poll();
+      int c;
+      while ((c = port->read()) >= 0)
+        timesync.feed(c);
+      timesync.poll();
+
+      if (master && !started && real_us() > 5e6)
+        {
+          bank.start(0);
+          started = true;
+        }
+
+      if (!master && real_us() > kWarmUp)
+        {
+          // The master's time base is the host clock since the start
+          Stamp s = timebase.stamp();
+          double mine = s.ms * 1000.0 + s.us;
+          double err = real_us() - mine;
+          n ++;
+          sum += err;
+          sq += err * err;
+          if (fabs(err) > worst)
+            worst = fabs(err);
+        }
+
+      if (!master && (long)(timebase.now() - next_report) >= 0)
+        {
+          next_report = timebase.now() + 10000;
+          fprintf(stderr, "slave t=%5.1fs measured: n %u mean %ld mean abs %ld max %ld us, %ld ppm, timer 0 %ld ms\n",
+                  real_us() / 1e6, timesync.samples(), timesync.mean_us(),
+                  timesync.mad_us(), timesync.max_us(), timebase.freq_ppm(),
+                  bank.ms(0));
+          timesync.reset_stats();
+        }
+
+      // The rest of the loop (OLED, LEDs)
+      usleep(rand() % 8000);
+    }
+
+  if (master)
+    fprintf(stderr, "master: timer 0 %ld ms\n", bank.ms(0));
+  else if (n)
+    fprintf(stderr, "slave true residual after %.0fs: mean %.0f rms %.0f max %.0f us (%u samples)\n",
+            kWarmUp / 1e6, sum / n, sqrt(sq / n), worst, n);
+}
+
+int main (int argc, char ** argv)
+{
+  double seconds = argc > 1 ? atof(argv[1]) : 120;
+  double ppm = argc > 2 ? atof(argv[2]) : 3000;
+  double offset_ms = argc > 3 ? atof(argv[3]) : 5000;
+
+  int a[2], b[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, a) || socketpair(AF_UNIX, SOCK_STREAM, 0, b))
+    {
+      perror("socketpair");
+      return 1;
+    }
+
+  sim_start_ns = real_ns();
+
+  pid_t master = fork();
+  if (master == 0)
+    {
+      run_clock(a[1], true, seconds);
+      _exit(0);
+    }
+
+  pid_t slave = fork();
+  if (slave == 0)
+    {
+      sim_ppm = ppm;
+      sim_offset_us = offset_ms * 1000;
+      run_clock(b[1], false, seconds);
+      _exit(0);
+    }
+
+  // The wire: one byte per byte time in each direction
+  const double byte_ns = 10e9 / SERIAL_BAUD;
+  int from[2] = {a[0], b[0]};
+  int to[2] = {b[0], a[0]};
+  char queue[2][4096];
+  size_t head[2] = {0, 0}, tail[2] = {0, 0};
+  uint64_t free_at[2] = {0, 0};
+
+  int running = 2;
+  while (running)
+    {
+      pollfd fds[2] = {{from[0], POLLIN, 0}, {from[1], POLLIN, 0}};
+      poll(fds, 2, 0);
+      for (int d = 0; d < 2; ++d)
+        {
+          if (fds[d].revents & POLLIN)
+            {
+              ssize_t got = read(from[d], queue[d] + tail[d], sizeof(queue[d]) - tail[d]);
+              if (got > 0)
+                tail[d] += got;
+            }
+
+          uint64_t now = real_ns();
+          if (head[d] < tail[d] && now >= free_at[d])
+            {
+              if (write(to[d], queue[d] + head[d], 1) == 1)
+                head[d] ++;
+              // Back to back bytes keep to the bit clock
+              free_at[d] = (now - free_at[d] < byte_ns ? free_at[d] : now) + byte_ns;
+            }
+          if (head[d] == tail[d])
+            head[d] = tail[d] = 0;
+        }
+
+      int status;
+      while (waitpid(-1, &status, WNOHANG) > 0)
+        running --;
+      usleep(50);
+    }
+  return 0;
+}
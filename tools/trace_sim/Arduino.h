@@ -0,0 +1,35 @@
+#pragma once
+
+// Just enough of the Arduino core to build the button code on a PC (see
+// trace_sim.cpp). millis() and micros() are a simulated clock.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+#define LOW  0
+#define HIGH 1
+
+unsigned long micros ();
+unsigned long millis ();
+
+#define constrain(a, l, h) ((a) < (l) ? (l) : ((a) > (h) ? (h) : (a)))
+
+// Pins read high (released) unless a trace is playing
+static const uint8_t PINB = 0xFF;
+static const uint8_t PIND = 0xFF;
+
+class Print
+{
+public:
+  virtual size_t write (const uint8_t * buf, size_t len) = 0;
+
+  size_t print (const char * s)
+  {
+    return write((const uint8_t *)s, strlen(s));
+  }
+};
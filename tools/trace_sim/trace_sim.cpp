@@ -0,0 +1,116 @@
+/*
+ * Plays an input trace (src/Trace.h, fetched with tools/input_trace.py)
+ * through the button scanner on a PC.
+ *
+ *   g++ -O2 -std=gnu++11 -Itools/trace_sim -Isrc tools/trace_sim/trace_sim.cpp -o trace_sim
+ *   ./trace_sim TRACE [loop ms]
+ *
+ * Time is simulated: each loop of the clock takes the given ms (2 by
+ * default), so a run depends only on the trace and the code. Every
+ * button callback and command is printed with its time and how long
+ * after the press that caused it, then a checksum of the lot: two runs
+ * (or two versions of the scanner) behave the same if the checksums
+ * match.
+ */
+
+#include "Arduino.h"
+#include "HAL.h"
+#include "TimeBase.h"
+#include "Trace.h"
+#include "ButtonMgr.h"
+
+static unsigned long sim_us = 0;
+
+unsigned long micros ()
+{
+  return sim_us;
+}
+
+unsigned long millis ()
+{
+  return sim_us / 1000;
+}
+
+TimeBase timebase;
+InputTrace trace;
+
+static uint32_t checksum = 2166136261u;
+
+static void report (const char * what)
+{
+  char line[80];
+  snprintf(line, sizeof(line), "%8lu ms  %-8s +%lu ms after the press\n",
+           millis(), what, (micros() - timebase.input_us()) / 1000);
+  fputs(line, stdout);
+  // FNV-1a over everything printed
+  for (const char * p = line; *p; ++p)
+    checksum = (checksum ^ (uint8_t)*p) * 16777619u;
+}
+
+static void up () { report("up"); }
+static void dn () { report("down"); }
+static void entr () { report("enter"); }
+static void bk () { report("back"); }
+
+static void command (char c)
+{
+  timebase.stamp_input(micros());
+  char what[16];
+  snprintf(what, sizeof(what), "cmd '%c'", c);
+  report(what);
+}
+
+int main (int argc, char ** argv)
+{
+  if (argc < 2)
+    {
+      fprintf(stderr, "usage: %s TRACE [loop ms]\n", argv[0]);
+      return 1;
+    }
+  unsigned long loop_us = (argc > 2 ? atof(argv[2]) : 2) * 1000;
+
+  FILE * f = fopen(argv[1], "rb");
+  if (!f)
+    {
+      perror(argv[1]);
+      return 1;
+    }
+  uint32_t levels;
+  if (fread(&levels, sizeof(levels), 1, f) != 1)
+    {
+      fprintf(stderr, "%s: no trace\n", argv[1]);
+      return 1;
+    }
+  TraceEvent e;
+  unsigned char n = 0;
+  while (fread(&e, sizeof(e), 1, f) == 1)
+    trace.load(n++, e, levels);
+  fclose(f);
+
+  ButtonScanner<4> buttons;
+  buttons.add(BTN_UP, ButtonScanner<4>::k_btn_repeat, &up);
+  buttons.add(BTN_DOWN, ButtonScanner<4>::k_btn_repeat, &dn);
+  buttons.add(BTN_OPT, ButtonScanner<4>::k_btn_press_hold, &entr, &bk);
+  trace.on_command(&command);
+
+  // A second in, as on the clock after setup()
+  sim_us = 1000000;
+  trace.replay();
+  buttons.init();
+  printf("%u events, loop %lu us\n", trace.count(), loop_us);
+
+  // Until the trace is over and any hold has had time to fire
+  unsigned long idle_until = 0;
+  while (trace.mode() == InputTrace::k_replay || millis() < idle_until)
+    {
+      if (trace.mode() == InputTrace::k_replay)
+        idle_until = millis() + 2 * HOLD_TIME;
+      timebase.poll();
+      trace.poll();
+      buttons.scan();
+      sim_us += loop_us;
+    }
+
+  printf("checksum %08x\n", checksum);
+  return 0;
+}
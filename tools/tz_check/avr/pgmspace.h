@@ -0,0 +1,9 @@
+#pragma once
+
+// Flash is just memory on a PC
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
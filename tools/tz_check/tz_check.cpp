@@ -0,0 +1,19 @@
+/*
+ * src/TimeZone.h on a PC, for tz_check.py: reads "l UTC" (local time
+ * for a Unix time) and "u LOCAL" (UTC for a local time) a line each,
+ * and prints the answers a line each.
+ */
+
+#include "Arduino.h"
+#include "TimeZone.h"
+
+TimeZone zone;
+
+int main ()
+{
+  char op;
+  unsigned long t;
+  while (scanf(" %c %lu", &op, &t) == 2)
+    printf("%lu\n", (unsigned long)(op == 'l' ? zone.local(t) : zone.to_utc(t)));
+  return 0;
+}
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""Check src/TimeZone.h and tools/tz_table.py against Python's zoneinfo.
+
+    tz_check.py [ZONE ...] [--from YEAR] [--years 10]
+
+For each zone (Australia/Sydney, Europe/London, America/New_York and
+UTC by default) a table is made with tz_table.py and built with
+TimeZone.h into tz_check.cpp on the PC. Then:
+
+  - local() for every hour of the table's years and the seconds either
+    side of each change, asked in a random order (so the cached span is
+    left and found again), against zoneinfo's offset
+  - to_utc() for every quarter hour of local time, against zoneinfo
+    with fold=0: the first of a time that came twice, and for a time
+    the clocks jumped over, the offset before the jump
+
+Needs g++ and Python 3.9 or later. Exits non-zero if any zone fails.
+"""
+
+import argparse
+import datetime
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+from zoneinfo import ZoneInfo
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(os.path.dirname(HERE))
+sys.path.insert(0, os.path.join(ROOT, "tools"))
+import tz_table  # noqa: E402
+
+UTC = datetime.timezone.utc
+
+
+def build(tmp, name, first, years):
+    """tz_check for a zone's table, in tmp. TimeZone.h takes the table
+    from its own directory, so it is copied in beside it."""
+    for f in ("TimeZone.h", "Calendar.h"):
+        shutil.copy(os.path.join(ROOT, "src", f), tmp)
+    base, changes = tz_table.table(name, first, years)
+    with open(os.path.join(tmp, "TimeZoneTable.h"), "w") as f:
+        f.write(tz_table.header(name, first, years, base, changes))
+    exe = os.path.join(tmp, "tz_check")
+    subprocess.check_call(["g++", "-O2", "-std=gnu++11", "-I" + HERE, "-I" + tmp,
+                           os.path.join(HERE, "tz_check.cpp"), "-o", exe])
+    return exe, changes
+
+
+def run(exe, queries):
+    text = "".join("%s %d\n" % q for q in queries)
+    out = subprocess.run([exe], input=text, capture_output=True, text=True, check=True)
+    return [int(v) for v in out.stdout.split()]
+
+
+def check(name, first, years):
+    zone = ZoneInfo(name)
+    start = int(datetime.datetime(first, 1, 1, tzinfo=UTC).timestamp())
+    end = int(datetime.datetime(first + years, 1, 1, tzinfo=UTC).timestamp())
+    with tempfile.TemporaryDirectory() as tmp:
+        exe, changes = build(tmp, name, first, years)
+
+        utcs = list(range(start, end, 3600))
+        for t, _ in changes:
+            utcs += [t - 2, t - 1, t, t + 1]
+        random.Random(1).shuffle(utcs)
+        got = run(exe, [("l", t) for t in utcs])
+        bad_local = sum(1 for t, g in zip(utcs, got)
+                        if g != t + tz_table.offset_min(zone, t) * 60)
+
+        # Local times as Unix times of the same wall clock reading
+        locals_ = list(range(start + 86400, end - 86400, 900))
+        random.Random(2).shuffle(locals_)
+        got = run(exe, [("u", t) for t in locals_])
+        bad_utc = 0
+        for t, g in zip(locals_, got):
+            wall = datetime.datetime.fromtimestamp(t, UTC).replace(tzinfo=zone, fold=0)
+            if g != int(wall.timestamp()):
+                bad_utc += 1
+
+    ok = not bad_local and not bad_utc
+    print("%-4s %-18s %d changes: local() %d wrong of %d, to_utc() %d wrong of %d"
+          % ("ok" if ok else "FAIL", name, len(changes), bad_local, len(utcs),
+             bad_utc, len(locals_)))
+    return ok
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("zones", nargs="*",
+                    default=["Australia/Sydney", "Europe/London", "America/New_York", "UTC"])
+    ap.add_argument("--from", dest="first", type=int, default=datetime.date.today().year)
+    ap.add_argument("--years", type=int, default=10)
+    a = ap.parse_args()
+
+    results = [check(z, a.first, a.years) for z in a.zones]
+    print("all ok" if all(results) else "FAILED")
+    sys.exit(0 if all(results) else 1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,34 @@
+"""PlatformIO pre-build script: keeps src/TimeZoneTable.h for the zone.
+
+The table is made again (tools/tz_table.py) only when the zone in
+platformio.ini (custom_tz) isn't the one in it, starting from the same
+year as the table there, so a build doesn't change it by the date.
+Moving the table on to later years is a tz_table.py run by hand. If
+the table can't be made (no zoneinfo data), the one there is used as
+it is.
+"""
+
+Import("env")  # noqa: F821 (SCons)
+
+import os
+import re
+import subprocess
+import sys
+
+zone = env.GetProjectOption("custom_tz", "UTC")  # noqa: F821
+years = int(env.GetProjectOption("custom_tz_years", "10"))  # noqa: F821
+root = env["PROJECT_DIR"]  # noqa: F821
+path = os.path.join(root, "src", "TimeZoneTable.h")
+
+have = {}
+if os.path.exists(path):
+    have = dict(re.findall(r"#define (TZ_\w+) \"?([^\"\n]*)\"?", open(path).read()))
+
+if have.get("TZ_NAME") != zone:
+    cmd = [sys.executable, os.path.join(root, "tools", "tz_table.py"), zone,
+           "--years", str(years), "-o", path]
+    if "TZ_FROM_YEAR" in have:
+        cmd += ["--from", have["TZ_FROM_YEAR"]]
+    if subprocess.call(cmd) != 0:
+        print("tz_pre: couldn't make the table for %s, building with %s"
+              % (zone, have.get("TZ_NAME", "none")))
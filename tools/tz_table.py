@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Write the clock's time zone table (src/TimeZoneTable.h).
+
+    tz_table.py ZONE [--from YEAR] [--years 10] [-o src/TimeZoneTable.h]
+
+ZONE is an IANA zone name (Australia/Sydney, Europe/London, UTC). The
+table is every change of UTC offset in the zone from the start of YEAR
+(this year by default) for the given number of years, worked out from
+Python's zoneinfo, for src/TimeZone.h. Past its end the clock keeps
+the last offset, so run it again within the decade. (The PlatformIO
+build runs it through tools/tz_pre.py only when the zone changes.)
+
+Needs Python 3.9 or later (and the tzdata package on Windows).
+"""
+
+import argparse
+import datetime
+import os
+import sys
+from zoneinfo import ZoneInfo
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+DEFAULT_OUT = os.path.normpath(os.path.join(HERE, "..", "src", "TimeZoneTable.h"))
+UTC = datetime.timezone.utc
+
+
+def offset_min(zone, t):
+    """UTC offset in minutes at Unix time t."""
+    dt = datetime.datetime.fromtimestamp(t, UTC).astimezone(zone)
+    return int(dt.utcoffset().total_seconds()) // 60
+
+
+def transitions(zone, start, end):
+    """[(unix time, new offset min)] for changes in [start, end)."""
+    out = []
+    day = 86400
+    t = start
+    last = offset_min(zone, t)
+    while t < end:
+        nxt = min(t + day, end)
+        off = offset_min(zone, nxt)
+        if off != last:
+            # The change is in (t, nxt]: find its second
+            lo, hi = t, nxt
+            while hi - lo > 1:
+                mid = (lo + hi) // 2
+                if offset_min(zone, mid) == last:
+                    lo = mid
+                else:
+                    hi = mid
+            out.append((hi, off))
+            last = off
+        t = nxt
+    return out
+
+
+def table(name, first_year, years):
+    zone = ZoneInfo(name)
+    start = int(datetime.datetime(first_year, 1, 1, tzinfo=UTC).timestamp())
+    end = int(datetime.datetime(first_year + years, 1, 1, tzinfo=UTC).timestamp())
+    return offset_min(zone, start), transitions(zone, start, end)
+
+
+def header(name, first_year, years, base, changes):
+    lines = [
+        "#pragma once",
+        "",
+        "// Generated by tools/tz_table.py: %s, %d to %d. Don't edit."
+        % (name, first_year, first_year + years - 1),
+        "",
+        '#define TZ_NAME "%s"' % name,
+        "#define TZ_FROM_YEAR %d" % first_year,
+        "#define TZ_YEARS %d" % years,
+        "",
+        "// UTC offset (min) before the first change",
+        "const int16_t kTzBaseOffset = %d;" % base,
+        "",
+        "// Changes of offset: Unix time, and the offset (min) from then",
+        "const byte kTzCount = %d;" % len(changes),
+        "const TzChange kTzChanges[] PROGMEM = {",
+    ]
+    for t, off in changes:
+        when = datetime.datetime.fromtimestamp(t, UTC).strftime("%Y-%m-%d %H:%M")
+        lines.append("  {%dUL, %d},%s// %s UTC" % (t, off, " " * max(1, 6 - len(str(off))), when))
+    if not changes:
+        lines.append("  {0xFFFFFFFFUL, %d},     // (none)" % base)
+    lines.append("};")
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("zone")
+    ap.add_argument("--from", dest="first", type=int,
+                    default=datetime.date.today().year)
+    ap.add_argument("--years", type=int, default=10)
+    ap.add_argument("-o", "--output", default=DEFAULT_OUT)
+    a = ap.parse_args()
+
+    base, changes = table(a.zone, a.first, a.years)
+    if len(changes) > 255:
+        sys.exit("%d changes: too many for the table" % len(changes))
+    text = header(a.zone, a.first, a.years, base, changes)
+    if a.output == "-":
+        sys.stdout.write(text)
+    else:
+        with open(a.output, "w") as f:
+            f.write(text)
+        print("%s: %d changes, %d bytes of flash" % (a.output, len(changes), 6 * len(changes)))
+
+
+if __name__ == "__main__":
+    main()
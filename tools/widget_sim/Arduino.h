@@ -0,0 +1,12 @@
+#pragma once
+
+// Just enough of the Arduino core to build the widget layer on a PC
+// (see widget_sim.cpp).
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
@@ -0,0 +1,62 @@
+#pragma once
+
+// A screen in memory in place of the OLED (lib/MyOLED), with the calls
+// the widget layer makes
+
+#include "Arduino.h"
+
+class OLED
+{
+public:
+  static const unsigned char kRows = 4;
+  static const unsigned char kCols = 20;
+
+  OLED ()
+  {
+    clear();
+  }
+
+  void clear ()
+  {
+    memset(mText, ' ', sizeof(mText));
+    mClears ++;
+  }
+
+  unsigned char clears () const
+  {
+    return mClears;
+  }
+
+  void set_point (unsigned char line, unsigned char pos)
+  {
+    mRow = line;
+    mCol = pos;
+  }
+
+  void write (const char * str)
+  {
+    while (*str && mCol < kCols)
+      mText[mRow][mCol++] = *str++;
+    mWrites ++;
+  }
+
+  char at (unsigned char row, unsigned char col) const
+  {
+    return mText[row][col];
+  }
+
+  // Writes since the last call
+  unsigned long take_writes ()
+  {
+    unsigned long n = mWrites;
+    mWrites = 0;
+    return n;
+  }
+
+private:
+  char mText[kRows][kCols];
+  unsigned char mRow = 0;
+  unsigned char mCol = 0;
+  unsigned char mClears = 0;
+  unsigned long mWrites = 0;
+};
@@ -0,0 +1,12 @@
+#pragma once
+
+// Flash is just memory on a PC
+
+#include <stdio.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define memcpy_P memcpy
+#define sprintf_P sprintf
+#define strncpy_P strncpy
@@ -0,0 +1,132 @@
+/*
+ * Checks of the retained OLED widgets (src/Widgets.h) on a PC.
+ *
+ *   g++ -O2 -std=gnu++11 -Itools/widget_sim -Isrc tools/widget_sim/widget_sim.cpp -o widget_sim
+ *   ./widget_sim [pairs]
+ *
+ * The OLED is a screen in memory. Checked:
+ *
+ *  - a long widget redraws for every change of less than 25033 (the
+ *    folded 16 bit key), over random pairs of values (200000 by
+ *    default), and the first difference that doesn't is 25033
+ *  - a marker moved by an invalidate() is taken off its last spot, and
+ *    after a clear it is drawn without one
+ *  - invalidate(i) redraws that widget and no other
+ *
+ * Prints each check and exits non-zero if any failed.
+ */
+
+#include "Arduino.h"
+#include "Widgets.h"
+
+static int failures = 0;
+
+static void check (bool ok, const char * what)
+{
+  printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+  if (!ok)
+    failures ++;
+}
+
+const char kFmtLong[] PROGMEM = "%ld";
+const char kArrows[] PROGMEM = "<<";
+
+const WidgetSpot kSpots[] PROGMEM = {
+  {3, 0, 2, 0},
+  {3, 12, 2, 0},
+};
+
+const WidgetSpec kSpecs[] PROGMEM = {
+  {k_widget_number, 0, 0, 12, kFmtLong, nullptr, nullptr},
+  {k_widget_marker, 0, 0, 2, kArrows, nullptr, kSpots},
+  {k_widget_text, 1, 0, 8, nullptr, nullptr, nullptr},
+};
+
+// xorshift32, so a run is the same every time
+static uint32_t rng = 2463534242u;
+
+static uint32_t next ()
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+int main (int argc, char ** argv)
+{
+  unsigned long pairs = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+
+  OLED disp;
+  WidgetLayer<3> layer(kSpecs);
+  long value = 0;
+  unsigned char spot = 0;
+  const char * title = nullptr;
+  layer.bind(0, &value);
+  layer.bind(1, &spot);
+  layer.bind(2, &title);
+  layer.draw(&disp);
+
+  // Longs near each other never share a key
+  unsigned long missed = 0;
+  for (unsigned long i = 0; i < pairs; ++i)
+    {
+      long a = (int32_t)next();
+      long d = 1 + next() % 25032;
+      long b = (int32_t)(uint32_t)(a + ((next() & 1) ? d : -d));
+      value = a;
+      layer.draw(&disp);
+      disp.take_writes();
+      value = b;
+      layer.draw(&disp);
+      if (!disp.take_writes())
+        missed ++;
+    }
+  char what[80];
+  snprintf(what, sizeof(what), "%lu random pairs under 25033 apart all redrawn (%lu not)",
+           pairs, missed);
+  check(missed == 0, what);
+
+  // The limit is where it says
+  long first = 0;
+  for (long d = 1; d <= 65536 && !first; ++d)
+    {
+      value = 0x10000 - d;
+      layer.draw(&disp);
+      disp.take_writes();
+      value = 0x10000;
+      layer.draw(&disp);
+      if (!disp.take_writes())
+        first = d;
+    }
+  snprintf(what, sizeof(what), "first difference not redrawn is %ld", first);
+  check(first == 25033, what);
+
+  // A marker moved by an invalidate leaves nothing behind
+  spot = 1;
+  layer.draw(&disp);
+  check(disp.at(3, 12) == '<' && disp.at(3, 0) == ' ', "marker drawn at its spot");
+  spot = 0;
+  layer.invalidate();
+  layer.draw(&disp);
+  check(disp.at(3, 0) == '<' && disp.at(3, 12) == ' ', "marker moved after invalidate(): old spot erased");
+
+  // After a clear there is nothing to erase, and it is all drawn
+  disp.clear();
+  layer.draw(&disp);
+  check(disp.at(3, 0) == '<' && disp.at(0, 0) != ' ', "everything drawn after a clear");
+
+  // One widget
+  static char label[] = "Keynote";
+  title = label;
+  layer.draw(&disp);
+  check(disp.at(1, 0) == 'K', "a new text pointer is drawn");
+  disp.take_writes();
+  strcpy(label, "Lunch");
+  layer.invalidate(2);
+  layer.draw(&disp);
+  check(disp.at(1, 0) == 'L' && disp.take_writes() == 1, "invalidate(i) draws that widget only");
+
+  printf("%s\n", failures ? "FAILED" : "all ok");
+  return failures ? 1 : 0;
+}